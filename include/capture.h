@@ -0,0 +1,70 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "utils.h"
+#include <stdatomic.h>
+
+/*
+Child stderr capture (--stderr=FILE, default stderr.txt): instead of inheriting
+the grader's stderr, so that every diagnostic line a submission prints lands on
+the terminal or CI log (and a slow consumer there stalls the run), each child
+slot writes its stderr into its own memfd. Writes never block and cost no
+terminal output.
+
+Each memfd is sized to CAPTURE_MEMFD_LIMIT (or 2 * --stderr-keep if larger) and
+sealed against growing, so however much a child prints, and whatever
+--output-limit is, a slot holds at most that much: writes past it fail (EPERM)
+and the record's header says "capped". Children write at the shared file
+offset, which tells how much they wrote; pages are punched out once collected.
+
+Once the pair is classified, the first and last --stderr-keep bytes are appended
+to FILE as one record, headed by the executable and parameter (a SESSION
+record covers every parameter its child was sent), and the memfd is emptied
+for the slot's next child:
+
+    ==> sol_3 2 (81 bytes) <==
+    Program: sol_3, PID: 4242, Mode: 2 - Exiting with status 1 (Incorrect answer)
+
+FILE holds at most --stderr-budget bytes in all; records past that are dropped
+and counted. A memfd is still a file, so --output-limit also kills a child that
+writes past it to stderr. --inherit-stderr turns capture off.
+*/
+
+#define CAPTURE_MEMFD_LIMIT (16LL << 20)  // Stderr bytes a slot holds at most
+
+typedef struct {
+    char *path;                   // NULL if capture is off (children inherit stderr)
+    int fd;                       // FILE, opened for appending
+    long long keep;
+    long long limit;              // Size of each memfd
+    long long budget;
+    atomic_llong used;            // Bytes appended to FILE
+    atomic_llong captured;        // Pairs (or sessions) whose stderr was appended
+    atomic_llong cut_bytes;       // Bytes left out between the first and last keep bytes
+    atomic_llong dropped;         // Records over the budget
+    atomic_llong dropped_bytes;   // Stderr bytes of those records
+} capture_t;
+
+
+// Start capturing into path (NULL to let children inherit stderr). truncate 1
+// starts path afresh; mq workers append to the file mq_autograder truncated.
+void capture_open(capture_t *capture, char *path, long long keep, long long budget, int truncate);
+
+
+// A memfd for one child slot's stderr (-1 if capture is off)
+int capture_create_fd(capture_t *capture);
+
+
+// In the child: send stderr to fd (nothing if fd is -1)
+void capture_redirect(int fd);
+
+
+// Append what the child behind fd wrote to stderr (if anything) for exe on
+// param, then empty fd for the slot's next child. Thread-safe.
+void capture_collect(capture_t *capture, int fd, const char *exe, const char *param);
+
+
+// Report what was cut or dropped and close FILE
+void capture_close(capture_t *capture);
+
+#endif // CAPTURE_H
@@ -0,0 +1,63 @@
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+#include "utils.h"
+
+/*
+Adaptive limit on the number of student processes running at once, shared by
+autograder (batch and session modes) and the mq_autograder workers.
+
+After every batch the limit is adjusted AIMD-style from live signals:
+
+    - CPU and memory pressure (PSI "some" stall time from /proc/pressure/cpu and memory,
+      measured over the batch rather than the kernel's 10s average)
+    - run queue length (running tasks in /proc/loadavg) relative to online CPUs
+    - the batch's timeout rate, relative to the run's usual timeout rate (student
+      programs that really loop forever shouldn't shrink the limit). Pairs the
+      runtime history expected to time out are left out altogether: run
+      longest-first, they come in a burst at the start that is no sign of load
+
+If any of them shows contention the limit is halved, otherwise a full batch
+raises it by one. Signals the kernel doesn't provide are ignored. With a fixed
+limit (--concurrency=N) the limit never changes, for reproducible runs.
+*/
+
+#define MAX_CONCURRENCY_FACTOR 4      // Adaptive limit grows to at most this many children per processor
+#define CPU_PRESSURE_BACKOFF 0.50     // Fraction of the batch some task was stalled on CPU
+#define MEMORY_PRESSURE_BACKOFF 0.10  // Fraction of the batch some task was stalled on memory
+#define RUN_QUEUE_BACKOFF 2           // Runnable tasks per online CPU
+#define TIMEOUT_RATE_BACKOFF 0.25     // Timeout rate above the run's usual rate
+
+typedef struct {
+    int limit;                  // Current number of children allowed at once
+    int min_limit;
+    int max_limit;
+    int fixed;                  // 1 to never adapt (static cap)
+    int psi_cpu_fd;             // /proc/pressure/cpu (-1 if unavailable)
+    int psi_memory_fd;          // /proc/pressure/memory (-1 if unavailable)
+    unsigned long long cpu_stall_us;     // PSI totals at the start of the batch
+    unsigned long long memory_stall_us;
+    long long batch_start_us;   // CLOCK_MONOTONIC at the start of the batch
+    double timeout_baseline;    // Moving average of the timeout rate per batch
+} concurrency_t;
+
+
+// Start adapting from initial within [1, max_limit], or stay at initial for good
+// if fixed is set
+void concurrency_init(concurrency_t *controller, int initial, int max_limit, int fixed);
+
+
+// Mark the start of a batch (samples the pressure counters)
+void concurrency_begin_batch(concurrency_t *controller);
+
+
+// Feed back a finished batch of completed children, timed_out of which were
+// killed at the timeout, expected_timeouts of those as the runtime history
+// predicted (status STUCK_OR_INFINITE last time). Returns the limit for the next batch.
+int concurrency_end_batch(concurrency_t *controller, int completed, int timed_out, int expected_timeouts);
+
+
+// Close the pressure files
+void concurrency_cleanup(concurrency_t *controller);
+
+#endif // CONCURRENCY_H
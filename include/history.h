@@ -0,0 +1,68 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "utils.h"
+
+/*
+Runtime history of (executable, parameter) pairs, kept between runs so the
+next run can start the slowest pairs (known hangers in particular) first and
+overlap their timeouts with the rest of the work.
+
+The history file (--history=FILE, default runtime_history.txt) is plain text:
+
+    #makespan <ms>                                  (wall time of the last run)
+    <executable>\t<param>\t<runtime_ms>\t<status>   (one line per pair)
+
+Pairs missing from the history are expected to take the prior (--prior-ms=N).
+*/
+
+typedef struct {
+    char *key;            // "<executable>\t<param>" (NULL if the slot is empty)
+    long long runtime_ms; // Smoothed runtime
+    int status;           // Last status (CORRECT, INCORRECT, ...)
+} history_entry_t;
+
+typedef struct {
+    char *path;               // History file (NULL if disabled)
+    long long prior_ms;       // Expected runtime of pairs never seen before
+    history_entry_t *entries; // Open-addressed hash table
+    size_t size;              // Power of two
+    size_t count;             // Used slots
+    int num_loaded;           // Pairs read from the file
+    long long last_makespan_ms; // Makespan of the previous run (-1 if unknown)
+} runtime_history_t;
+
+
+// Load path (a missing file is an empty history). path NULL disables the history.
+void history_load(runtime_history_t *history, char *path, long long prior_ms);
+
+
+// Expected runtime of executable on param (prior_ms if unknown)
+long long history_expected_ms(runtime_history_t *history, char *exe_name, char *param);
+
+
+// Last status recorded for executable on param (0 if unknown). Runs look this
+// up before recording the pair, to tell timeouts the history expected apart.
+int history_status(runtime_history_t *history, char *exe_name, char *param);
+
+
+// Record a measured runtime and status
+void history_record(runtime_history_t *history, char *exe_name, char *param, long long runtime_ms, int status);
+
+
+// Write the history back (atomically) along with this run's makespan, then free it
+void history_save(runtime_history_t *history, long long makespan_ms);
+
+
+// Estimated wall time to run n pairs with the given expected runtimes, in that
+// order, on slots parallel slots. If batched, each batch of slots pairs waits
+// for its slowest pair (autograder's batch modes); otherwise a pair starts as
+// soon as any slot is free (sessions, mq workers).
+long long estimate_makespan(long long *expected_ms, int n, int slots, int batched);
+
+
+// Print the estimated makespan of the default order against the scheduled
+// (longest-expected-first) order
+void report_makespan(long long *default_order_ms, long long *scheduled_ms, int n, int slots, int batched);
+
+#endif // HISTORY_H
@@ -0,0 +1,92 @@
+#ifndef HOST_POOL_H
+#define HOST_POOL_H
+
+#include "utils.h"
+#include <sys/sem.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/*
+Host-wide budget of running children, shared by every autograder, mq_autograder
+(through its workers) and thread_autograder on the machine, so that several
+graders started at once don't each size themselves to all processors and time
+out each other's children.
+
+The budget is a SysV semaphore set keyed on HOST_POOL_KEY_FILE (opened without
+O_CREAT unless missing: fs.protected_regular refuses O_CREAT on another user's
+file in /tmp, even one that exists): semaphore 0 holds the free slots,
+semaphore 1 counts the graders using it, and semaphore 2 holds the total:
+MAX_CONCURRENCY_FACTOR per processor the grader may use (get_batch_size(),
+affinity and cgroup quota included), what one grader's adaptive limit grows to,
+or --host-slots=N. The set is never removed, but a grader that finds it idle (no
+grader in it, every slot free) sizes it afresh, so an earlier --host-slots
+doesn't stick; on a pool in use, --host-slots resizes it for the graders running.
+
+A grader takes one slot per child before starting it and gives it back once the
+child is reaped. Every operation uses SEM_UNDO, so the slots and the membership
+of a grader that dies are returned by the kernel.
+
+Fair sharing: a grader never takes more than ceil(slots / graders) at once, and
+it only blocks while holding no slots (the rest are taken without waiting), so
+graders waiting on each other can't deadlock. Thread Autograder's threads take
+one slot each the same way (host_pool_acquire_thread()): a thread over the share
+waits for one of the process's slots to come back. --no-host-pool opts out, and
+so does an explicit --concurrency=N: the grader runs N children as asked.
+*/
+
+#define HOST_POOL_KEY_FILE "/tmp/autograder_host_pool"
+
+#define HOST_POOL_FREE 0   // Semaphore of free slots
+#define HOST_POOL_JOBS 1   // Semaphore counting graders
+#define HOST_POOL_SLOTS 2  // Semaphore holding the total number of slots
+
+typedef struct {
+    int semid;             // -1 if the pool is off
+    int slots;             // Slots of the whole host
+    int joined;            // 1 if this process counts as a grader (semaphore 1)
+    int split;             // Local mq workers sharing their mq_autograder's share (1 otherwise)
+    atomic_int held;       // Slots this process holds
+    pthread_mutex_t lock;  // Threads acquiring slots one at a time (host_pool_acquire_thread())
+    pthread_cond_t released;
+} host_pool_t;
+
+
+// Attach to the host pool, creating it if needed, and size it to slots (0:
+// MAX_CONCURRENCY_FACTOR per usable processor) if idle, or to slots anyway
+// unless 0. join 1 counts this process as a grader for fair sharing. Local mq
+// workers don't (their mq_autograder does) and each take 1 / split of its share.
+// enabled 0 leaves the pool off.
+void host_pool_open(host_pool_t *pool, int enabled, int slots, int join, int split);
+
+
+// Count this process as a grader (again) / no longer, for fair sharing. A
+// grader idle in --watch mode leaves.
+void host_pool_join(host_pool_t *pool);
+void host_pool_leave(host_pool_t *pool);
+
+
+// Take up to want slots, no more than this grader's fair share: waits for the
+// first one, takes the others only if they are free. Returns how many were
+// taken (want if the pool is off). Only call while holding no slots.
+int host_pool_acquire(host_pool_t *pool, int want);
+
+
+// Take one slot for the calling thread, within this grader's fair share like
+// host_pool_acquire(). Only blocks on the pool while the process holds no slots;
+// otherwise waits for a slot to be given back. Any thread may call it.
+void host_pool_acquire_thread(host_pool_t *pool);
+
+
+// Take up to want slots without waiting. Returns how many were taken (want if
+// the pool is off), possibly 0.
+int host_pool_try_acquire(host_pool_t *pool, int want);
+
+
+// Give back n slots
+void host_pool_release(host_pool_t *pool, int n);
+
+
+// Stop counting as a grader (slots still held are given back at exit)
+void host_pool_close(host_pool_t *pool);
+
+#endif // HOST_POOL_H
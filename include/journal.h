@@ -0,0 +1,69 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "utils.h"
+
+/*
+Append-only journal of classified pairs, so a run that dies halfway (OOM kill,
+Ctrl-C, a worker exiting on a bad output) can be resumed with --resume instead
+of starting over. Every status is appended with a single write() as soon as it
+is known, so records survive the grader being killed (not a power loss).
+
+The journal file (--journal=FILE, default results_journal.txt) is plain text:
+
+    #run <pid> <start time>             (a run started; start time from /proc/<pid>/stat)
+    #param <param>                      (the run's parameters, once each)
+    #exe <executable>                   (each executable the run found)
+    #queue <msqid>                      (the run's SysV message queue, mq_autograder)
+    <executable>\t<param>\t<status>     (one line per classified pair)
+
+A run that finishes removes its journal. Opening a journal left behind by an
+unfinished run cleans up what that run orphaned: its message queues (which also
+wakes its stray workers) and the output/<executable>.<param> files of the
+executables and parameters it recorded. Nothing is touched while the process
+that wrote the last #run line (same pid and start time) is still running: the
+journal is in use, and the new run goes without one.
+*/
+
+typedef struct {
+    char *key;            // "<executable>\t<param>"
+    int status;
+} journal_entry_t;
+
+typedef struct {
+    char *path;               // Journal file (NULL if disabled)
+    int fd;                   // Opened O_APPEND (-1 if disabled)
+    journal_entry_t *entries; // Records of the previous run, sorted by key (--resume only)
+    int num_entries;
+} journal_t;
+
+
+// Open path for this run (NULL disables the journal) after cleaning up an
+// unfinished run recorded in it. With resume its records are kept for
+// journal_restore(), otherwise the journal starts over.
+void journal_open(journal_t *journal, char *path, int resume, char **params, int total_params);
+
+
+// Record the message queue of this run so a resumed run can remove it
+void journal_note_queue(journal_t *journal, int msqid);
+
+
+// Record an executable of this run, whose output files a resumed run may remove
+void journal_note_executable(journal_t *journal, char *exe_name);
+
+
+// If the pair (result's executable, param) was classified by the resumed run,
+// copy its status into result (as param_idx) and return 1, otherwise return 0.
+// Restored statuses are fed to the fail-fast policy (see failfast_record()).
+int journal_restore(journal_t *journal, autograder_results_t *result, int param_idx, char *param,
+                    int total_params, grader_options_t *options);
+
+
+// Append the status of a classified pair
+void journal_record(journal_t *journal, char *exe_name, char *param, int status);
+
+
+// Close the journal. A finished run removes it, nothing is left to resume.
+void journal_close(journal_t *journal, int finished);
+
+#endif // JOURNAL_H
@@ -0,0 +1,73 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "utils.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+Live progress of a run, served on a Unix socket (--metrics=PATH) by a background
+thread:
+
+    > printf 'json\n' | nc -U PATH                     (JSON)
+    > nc -U PATH < /dev/null                            (Prometheus text format)
+    > curl --unix-socket PATH http://localhost/metrics  (either, over HTTP; a path
+                                                         ending in .json selects JSON)
+
+Reported: pairs done / in flight / pending, per-status counts, pairs/sec, p50 and
+p99 child runtime, timeouts fired, and per-worker busy time and utilisation.
+
+Counters live in one cache-line-aligned slot per worker (slot 0 is the grader
+itself, mq workers use their worker id). Each slot has a single writer, the
+supervisor's main thread, which only does relaxed atomic adds. Nothing is locked
+or aggregated until a client asks.
+*/
+
+#define LATENCY_BUCKETS 240  // 8 buckets per power of two, up to 2^31 ms (see latency_bucket())
+
+typedef struct {
+    atomic_llong assigned;               // Pairs handed to this worker (or started)
+    atomic_llong done;                   // Pairs classified, including not_run
+    atomic_llong not_run;                // Pairs classified without running (restored, skipped)
+    atomic_llong status[MAX_STATUS + 1];    // Classified pairs per status
+    atomic_llong busy_ms;                // Sum of child runtimes
+    atomic_llong latency[LATENCY_BUCKETS];  // Child runtime histogram
+} __attribute__((aligned(64))) metrics_slot_t;
+
+typedef struct {
+    metrics_slot_t *slots;    // NULL if metrics are disabled
+    int num_slots;
+    atomic_llong total_pairs; // Pairs in the run (grows while the directory is scanned)
+    long long start_ms;
+    char *socket_path;
+    int listen_fd;
+    int stop_pipe[2];         // Written to stop the server thread
+    pthread_t thread;
+} metrics_t;
+
+
+// Serve metrics for num_slots worker slots on socket_path. socket_path NULL
+// disables them (every other call is then a no-op).
+void metrics_start(metrics_t *metrics, char *socket_path, int num_slots);
+
+
+// Number of pairs in the run
+void metrics_set_total(metrics_t *metrics, long long total_pairs);
+
+
+// count pairs were handed to the worker in slot (or started by it)
+void metrics_assign(metrics_t *metrics, int slot, int count);
+
+
+// A pair of slot was classified as status after running for runtime_ms.
+// runtime_ms < 0 means it was never run nor assigned (restored from the journal,
+// skipped by the fail-fast policy).
+void metrics_record(metrics_t *metrics, int slot, int status, long long runtime_ms);
+
+
+// Stop the server thread and remove the socket
+void metrics_stop(metrics_t *metrics);
+
+#endif // METRICS_H
@@ -0,0 +1,67 @@
+#ifndef ORACLE_H
+#define ORACLE_H
+
+#include "utils.h"
+
+/*
+Expected-output oracle (--expected=DIR): instead of reading "0" / "1" from a
+child, its whole stdout is compared against DIR/<param>, the expected output for
+that parameter. With --ignore-whitespace, runs of whitespace compare equal to a
+single space and leading / trailing whitespace is ignored.
+
+Expected outputs are mapped once (mmap) when the oracle is opened. Child output
+is compared as it is read, chunk by chunk, so a comparison stops at the first
+mismatch without reading the rest, and a supervisor streaming a live child's
+stdout can kill it right there.
+*/
+
+typedef struct {
+    char *param;
+    char *data;           // Expected output (mmap'd, or normalized copy with --ignore-whitespace)
+    size_t len;
+    int mapped;           // 1 if data is mmap'd
+} oracle_expected_t;
+
+typedef struct {
+    char *dir;                    // NULL if the oracle is disabled
+    int ignore_whitespace;
+    oracle_expected_t *expected;  // One per distinct parameter
+    int num_expected;
+} oracle_t;
+
+typedef struct {
+    oracle_expected_t *expected;
+    size_t pos;           // Bytes of expected output matched so far
+    int ignore_whitespace;
+    int started;          // A non-whitespace byte was seen (--ignore-whitespace)
+    int pending_space;    // Whitespace seen since the last non-whitespace byte
+    int mismatch;
+} oracle_stream_t;
+
+
+// Map the expected output of each of the num_params params from dir. dir NULL
+// disables the oracle. A missing expected output is fatal.
+void oracle_open(oracle_t *oracle, char *dir, int ignore_whitespace, char **params, int num_params);
+
+
+// Start comparing a child's output for param
+void oracle_stream_begin(oracle_t *oracle, oracle_stream_t *stream, char *param);
+
+
+// Compare the next len bytes of output. Returns 0 once the output can no longer
+// match (nothing more needs to be read), 1 otherwise.
+int oracle_stream_feed(oracle_stream_t *stream, const char *buf, size_t len);
+
+
+// Status of the output fed so far, taken as complete: CORRECT or INCORRECT
+int oracle_stream_end(oracle_stream_t *stream);
+
+
+// Compare everything left to read on fd against the expected output for param
+int oracle_compare_fd(oracle_t *oracle, char *param, int fd);
+
+
+// Unmap the expected outputs
+void oracle_close(oracle_t *oracle);
+
+#endif // ORACLE_H
@@ -0,0 +1,65 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "utils.h"
+#include <stdint.h>
+
+/*
+Class-wide report on the results matrix (--report=FILE), written next to
+results.txt and scores.txt:
+
+    - per parameter, the share of executables in each outcome (correct,
+      incorrect, crash, stuck/inf, skipped, out-limit)
+    - a histogram of scores, in tenths
+    - the hardest parameters (lowest pass rate first)
+    - clusters of executables with identical outcome vectors (shared bugs,
+      or copied submissions)
+
+The status matrix is read once, into bit planes; everything after that is
+counted with popcounts over 64 pairs at a time:
+
+    rows      per executable and 64 parameters, the 3 bits of their statuses
+              sliced into 3 words: bit j of word b is bit b of the status of
+              parameter j (score = popcount of b0 & ~b1 & ~b2, i.e. status ==
+              CORRECT; an outcome vector is 3 * row_words words to hash and
+              compare)
+    columns   per outcome and parameter, bit e is set if executable e had that
+              outcome (per-parameter rates = popcounts), made from the rows by
+              64 x 64 bit transposes
+
+A 100000 x 1000 matrix takes ~115 MB of planes. Packing it is bound by reading
+the 400 MB of statuses; the report itself is then a few tens of milliseconds.
+*/
+
+#define REPORT_OUTCOMES MAX_STATUS // CORRECT .. MAX_STATUS
+#define REPORT_STATUS_BITS 3      // Statuses fit in 3 bits
+#define REPORT_SCORE_BINS 10
+#define REPORT_HARDEST 10         // Hardest parameters listed
+#define REPORT_CLUSTERS 10        // Clusters listed
+#define REPORT_CLUSTER_NAMES 8    // Executables named per cluster
+
+typedef struct {
+    int num_executables;
+    int total_params;
+    int exe_words;        // 64-bit words per column (one bit per executable)
+    int row_words;        // 64-bit words per row plane (one bit per parameter)
+    uint64_t *columns;    // columns[(outcome * total_params + j) * exe_words + w]
+    uint64_t *rows;       // rows[(e * row_words + w) * REPORT_STATUS_BITS + b]
+} report_t;
+
+
+// Pack the statuses of results into bit planes
+void report_build(report_t *report, autograder_results_t *results, int num_executables, int total_params);
+
+
+// Write the report to path (params label the parameters)
+void report_write(report_t *report, char *path, autograder_results_t *results, char **params);
+
+
+void report_free(report_t *report);
+
+
+// report_build(), report_write() and report_free() in one go (nothing if path is NULL)
+void write_report_to_file(char *path, autograder_results_t *results, int num_executables, int total_params, char **params);
+
+#endif // REPORT_H
@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "utils.h"
+#include <stdatomic.h>
+
+/*
+Phase tracer for the graders themselves (--trace=FILE): timestamped spans of
+what autograder, mq_autograder and its workers spend wall time on (launching,
+reaping and classifying children, cleaning up, scoring, message send/receive),
+written as Chrome trace JSON. Open FILE in Perfetto (ui.perfetto.dev) or
+chrome://tracing.
+
+Each process appends spans to its own preallocated buffer (a slot is claimed
+with one atomic add, so threads never lock). Workers save theirs to FILE.<pid>
+when they finish; mq_autograder merges them with its own into FILE at exit.
+Timestamps are CLOCK_MONOTONIC, shared by every process on the host.
+
+When tracing is off, trace_begin() is one predictable branch and trace_end()
+returns immediately.
+*/
+
+#define TRACE_MAX_EVENTS 65536   // Spans kept per process, later ones are dropped
+#define TRACE_DETAIL_SIZE 48
+
+typedef struct {
+    const char *name;        // Phase ("launch", "reap", ...), a string literal
+    const char *category;
+    long long start_us;
+    long long duration_us;
+    int tid;                 // Thread, or child pid for spans of one child
+    char detail[TRACE_DETAIL_SIZE];  // Executable / parameter / message, may be empty
+} trace_event_t;
+
+typedef struct {
+    char *path;              // NULL if tracing is off
+    char process_name[32];
+    trace_event_t *events;
+    atomic_int num_events;   // Slots claimed (may exceed TRACE_MAX_EVENTS: dropped)
+} trace_t;
+
+extern trace_t tracer;
+
+
+// Start tracing this process (named process_name in the trace) into path.
+// path NULL leaves tracing off.
+void trace_open(char *path, char *process_name);
+
+
+long long trace_now_us();
+
+
+// Start of a span (0 when tracing is off)
+static inline long long trace_begin() {
+    return tracer.path != NULL ? trace_now_us() : 0;
+}
+
+
+// Record the span [start_us, now] of phase name for this thread (tid 0) or
+// child tid. detail is copied (NULL for none).
+void trace_end(const char *name, const char *category, long long start_us, int tid, const char *detail);
+
+
+// trace_end() of a span about one pair: detail is "<exe> <param>"
+void trace_end_pair(const char *name, const char *category, long long start_us, int tid, const char *exe, const char *param);
+
+
+// Worker: save this process's spans to <path>.<pid> for mq_autograder to merge
+void trace_save_part();
+
+
+// Write path: this process's spans plus the parts saved by the num_parts
+// processes in part_pids (waited for first, -1 entries are skipped)
+void trace_write(pid_t *part_pids, int num_parts);
+
+#endif // TRACE_H
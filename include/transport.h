@@ -0,0 +1,137 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "utils.h"
+
+/*
+Message transport between mq_autograder and its workers.
+
+Both sides exchange msgbuf_t messages with the same mtype conventions as the
+SysV message queue (see utils.h):
+
+    mq_autograder -> worker i:  mtype = i (pair count, pairs), BROADCAST_MTYPE (SYNACK)
+    worker i -> mq_autograder:  mtype = i (results, DONE), BROADCAST_MTYPE + 1 (ACK)
+
+TRANSPORT_SOCKET carries the same messages as fixed-size frames over one stream
+connection per worker (TCP, or a Unix socket locally), so workers can run on
+other machines:
+
+    tcp:<host>:<port>     e.g. tcp:0.0.0.0:4061 (listen) / tcp:grader1:4061 (connect)
+    unix:<path>           e.g. unix:/tmp/autograder.sock
+
+On connect a worker sends "HELLO <capacity>" and is answered with "WORKER <id>".
+
+Workers forked by mq_autograder use one of the local backends (--ipc=NAME):
+
+    sysv        TRANSPORT_SYSV       one SysV message queue shared by everyone (default)
+    posix       TRANSPORT_POSIX_MQ   two POSIX queues per worker (/autograder-<pid>-<id>-in/-out,
+                                     unlinked as soon as the worker has opened them)
+    seqpacket   TRANSPORT_SEQPACKET  one AF_UNIX SOCK_SEQPACKET socketpair per worker
+    shm         TRANSPORT_SHM        two single-producer single-consumer rings per worker
+                                     in a shared memfd, futex wakeups only when a side sleeps
+
+Except for SysV every worker has its own channels, which carry messages in
+protocol order, so mtype only selects the worker (like TRANSPORT_SOCKET). A
+worker learns how to attach from the channel spec it is exec'd with (see
+transport_prepare_worker()). transport_bench compares the backends.
+
+A peer that dies can't be seen on a POSIX queue or a shared ring, so blocking
+waits on them wake every TRANSPORT_PEER_CHECK_MS to check it is still running:
+mq_autograder checks the worker's pid without reaping it, a worker checks that
+its parent is still mq_autograder.
+*/
+
+#define TRANSPORT_PEER_CHECK_MS 1000
+
+#define TRANSPORT_SYSV 0
+#define TRANSPORT_SOCKET 1
+#define TRANSPORT_POSIX_MQ 2
+#define TRANSPORT_SEQPACKET 3
+#define TRANSPORT_SHM 4
+
+typedef struct {
+    int type;             // TRANSPORT_SYSV, TRANSPORT_SOCKET, ...
+    long worker_id;       // Worker side: own id (0 in mq_autograder)
+    int msqid;            // SysV: message queue id
+    int listen_fd;        // Socket (mq_autograder): listening socket (-1 if none)
+    char *unix_path;      // Socket (mq_autograder): Unix socket path to unlink on close
+    int *conn_fds;        // mq_autograder: connection (POSIX: queue from) worker i at index i - 1
+    int *send_fds;        // POSIX (mq_autograder): queue to worker i at index i - 1 (NULL: use conn_fds)
+    int *worker_fds;      // Seqpacket (mq_autograder): worker i's end until it is launched
+    int num_conns;        // mq_autograder: number of workers with their own channels
+    int next_broadcast;   // mq_autograder: worker receiving the next BROADCAST_MTYPE message
+    int server_fd;        // Worker: connection (POSIX: queue from) mq_autograder (-1 if none)
+    int server_send_fd;   // POSIX (worker): queue to mq_autograder (-1: use server_fd)
+    char *mq_prefix;      // POSIX: queue names are <mq_prefix>-<id>-in / -out
+    void *shm;            // Shared memory: mapped rings (see transport.c)
+    size_t shm_size;
+    int shm_fd;           // Shared memory (mq_autograder): memfd holding the rings
+    pid_t *worker_pids;   // Local backends (mq_autograder): worker i's pid at index i - 1 (-1 until forked)
+    pid_t parent_pid;     // Local backends (worker): mq_autograder's pid
+} transport_t;
+
+
+// TRANSPORT_* of a --ipc name ("sysv", "posix", "seqpacket", "shm"), -1 if unknown
+int transport_type_from_name(char *name);
+
+
+// Use an existing SysV message queue
+void transport_open_sysv(transport_t *transport, int msqid);
+
+
+// mq_autograder: create the channels of a local backend other than SysV for
+// num_workers workers, forked afterwards
+void transport_open_local(transport_t *transport, int type, int num_workers);
+
+
+// In the child forked for worker_id, before exec: keep the worker's channels open
+// across exec and describe them in spec (e.g. "shm:5"; for SysV the plain msqid)
+void transport_prepare_worker(transport_t *transport, long worker_id, char *spec, size_t len);
+
+
+// mq_autograder, once worker_id is forked as pid: close its copy of the worker's
+// end and remember pid, so a dead worker shows up as ECONNRESET on every backend
+void transport_release_worker(transport_t *transport, long worker_id, pid_t pid);
+
+
+// Worker: attach to the channels described by spec as worker_id
+void transport_attach(transport_t *transport, char *spec, long worker_id);
+
+
+// mq_autograder: listen on address and wait for num_workers workers to connect.
+// capacities[i] receives the capacity announced by worker i + 1.
+void transport_listen(transport_t *transport, char *address, int num_workers, int *capacities);
+
+
+// worker: connect to mq_autograder at address and announce capacity. Returns the
+// worker id assigned by mq_autograder.
+long transport_connect(transport_t *transport, char *address, int capacity);
+
+
+// Send msg, routed by msg->mtype like msgsnd(). Returns -1 on failure (errno =
+// ECONNRESET if the peer is gone while a POSIX queue or shared ring is full).
+int transport_send(transport_t *transport, msgbuf_t *msg);
+
+
+// Receive a message of type mtype like msgrcv(). With IPC_NOWAIT in flags, fails
+// with errno = ENOMSG if none is ready. Fails with errno = ECONNRESET if the
+// peer disconnected, or (local backends) died with nothing left to read. The
+// SysV queue has no peer: msgrcv() may still block for good there.
+int transport_recv(transport_t *transport, msgbuf_t *msg, long mtype, int flags);
+
+
+// Block for up to timeout_ms until a message may be ready (the SysV queue can't
+// be waited on without receiving, so this returns immediately)
+void transport_wait(transport_t *transport, int timeout_ms);
+
+
+// Stream size raw bytes of fd (from offset 0) to worker mtype / read size raw
+// bytes into fd. Only supported by TRANSPORT_SOCKET. Returns -1 on failure.
+int transport_send_file(transport_t *transport, long mtype, int fd, off_t size);
+int transport_recv_file(transport_t *transport, int fd, off_t size);
+
+
+// Close connections and remove the SysV queue / POSIX queues / Unix socket path
+void transport_close(transport_t *transport);
+
+#endif // TRANSPORT_H
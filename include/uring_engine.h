@@ -0,0 +1,43 @@
+#ifndef URING_ENGINE_H
+#define URING_ENGINE_H
+
+#include "utils.h"
+
+/*
+Alternate supervisor engine built on io_uring (selected with --engine=uring).
+
+Instead of one blocking syscall at a time (waitpid() per child, then open()/
+read()/close()/unlink() per output file), a batch is supervised through one
+shared submission ring:
+
+    1. IORING_OP_WAITID for every child, each linked to an IORING_OP_LINK_TIMEOUT
+       at the batch deadline. Children that hit the deadline are SIGKILLed and
+       reaped by a second WAITID.
+    2. IORING_OP_OPENAT for the output file of every child that exited.
+    3. IORING_OP_READ (hard-linked to IORING_OP_CLOSE) for every opened output file,
+       together with IORING_OP_UNLINKAT for every output file of the batch.
+
+Each step is a handful of io_uring_enter() calls regardless of batch size. The
+ring is driven with raw syscalls, so liburing is not required.
+*/
+
+
+// Set up the ring for batches of up to max_batch children. Returns 0 on success
+// and -1 if the kernel lacks io_uring or any of the opcodes above (e.g. WAITID
+// needs Linux 6.7), in which case callers keep using the classic engine.
+int uring_engine_init(int max_batch);
+
+
+// Wait for the num_children children in pids to finish, killing those still
+// running timeout_secs after the call, and classify them into statuses (CORRECT,
+// INCORRECT, SEGFAULT, STUCK_OR_INFINITE or OUTPUT_LIMIT). output_paths[j] is the file child
+// j's STDOUT was redirected to; it is unlinked afterwards if remove_outputs is set.
+// If exit_ms is not NULL, exit_ms[j] receives monotonic_ms() when child j was reaped.
+void uring_monitor_batch(pid_t *pids, char **output_paths, int num_children,
+                         int timeout_secs, int remove_outputs, int *statuses, long long *exit_ms);
+
+
+// Tear down the ring
+void uring_engine_cleanup();
+
+#endif // URING_ENGINE_H
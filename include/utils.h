@@ -1,6 +1,10 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // For pipe2(), fexecve() and friends
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -18,9 +22,16 @@
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <ctype.h> // For isdigit()
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/mman.h> // For memfd_create()
+#include <sched.h>    // For sched_getaffinity()
+#include <sys/prctl.h> // For PR_SET_PDEATHSIG
 
 
-#define TIMEOUT_SECS 10    // Timeout threshold for stuck/infinite loop
+#ifndef TIMEOUT_SECS
+#define TIMEOUT_SECS 10    // Timeout threshold for stuck/infinite loop (per parameter in SESSION mode)
+#endif
 #define MAX_INT_CHARS 10 // Maximum number of characters in an integer
 
 /************************* ONLY FOR MESSAGE QUEUES *************************/
@@ -32,10 +43,22 @@
 /************************* ONLY FOR MESSAGE QUEUES *************************/
 
 // Main struct for storing the results of the autograder
+// Fail-fast bookkeeping for one executable (see failfast_record())
+typedef struct {
+    int consecutive_failures; // crashes / timeouts in a row
+    int correct;              // pairs that passed so far
+    int finished;             // pairs tested so far
+    int stopped;              // 1 once the remaining pairs are skipped
+    int skipped;              // pairs SKIPPED because of it
+} failfast_state_t;
+
+
 typedef struct {
     char *exe_path;       // path to executable
-    int *params_tested;   // array of parameters tested
+    int exe_fd;           // executable opened with open_executable() (-1 to exec by path)
+    char **params_tested; // array of parameters tested (the graders' parameter strings)
     int *status;          // array of exit status codes for each parameter
+    failfast_state_t failfast;  // decides when the remaining parameters are skipped
 } autograder_results_t;
 
 
@@ -51,30 +74,243 @@ enum {
     CORRECT = 1,            // Corresponds to case 1: Exit with status 0 (correct answer)
     INCORRECT,              // Corresponds to case 2: Exit with status 1 (incorrect answer)
     SEGFAULT,               // Corresponds to case 3: Triggering a segmentation fault
-    STUCK_OR_INFINITE       // Corresponds to case 4 and 5: Stuck, or in an infinite loop
+    STUCK_OR_INFINITE,      // Corresponds to case 4 and 5: Stuck, or in an infinite loop
+    SKIPPED,                // Not run: the outcome was already decided (--stop-after, --min-score)
+    OUTPUT_LIMIT            // Killed for writing more than --output-limit bytes
 };
+// Journals store statuses by number: new ones go at the end, and this moves with them
+#define MAX_STATUS OUTPUT_LIMIT
 
 
 // Helper function to get executable name from path
 // Example: solutions/sol_1 -> sol_1
 char *get_exe_name(char *path);
 
+// Milliseconds on CLOCK_MONOTONIC
+long long monotonic_ms();
+
+// Map the contents of a child's output file ("0" or "1", optionally surrounded
+// by whitespace) to CORRECT, or INCORRECT for anything else
+int get_output_status(char *output);
+
+// Map the signal that killed a child to STUCK_OR_INFINITE (SIGKILL, sent at the
+// timeout), OUTPUT_LIMIT (SIGXFSZ, see limit_output_size()) or SEGFAULT (any
+// other signal is a crash)
+int get_signal_status(int signum);
+
 // Function to convert status macro to the corresponding message
 // Example: CORRECT -> "correct"
 const char* get_status_message(int status);
 
-// Takes in path to solutions directory and integer address for storing the 
-// total number of executables in the solutions directory. Returns a malloc'd
-// array of strings containing the executable paths.
-char **get_student_executables(char *solution_dir, int *num_executables);
+// Options shared by autograder and mq_autograder, given before <testdir>
+typedef struct {
+    int exec_only;        // --exec-only: skip regular files without an execute bit
+    int use_uring;        // --engine=uring|classic: supervise batches with io_uring
+    char *listen_address; // --listen=ADDR: mq_autograder waits for remote workers (see transport.h)
+    int num_workers;      // --workers=N: number of workers (default: number of processors)
+    char *connect_address;// --connect=ADDR: worker connects to mq_autograder at ADDR
+    int capacity;         // --capacity=N: most pairs a worker runs at once (remote default: 8; local: set by mq_autograder)
+    int concurrency;      // --concurrency=N: always run N children at once (per worker for mq_autograder)
+                          //                  instead of adapting to load (see concurrency.h)
+    int pin;              // --pin=core|l3: pin each worker / child slot to one PIN_CORE or PIN_L3 domain
+    char *history_path;   // --history=FILE / --no-history: runtime history (see history.h), NULL if disabled
+    long long prior_ms;   // --prior-ms=N: expected runtime of pairs without history
+    int stop_after;       // --stop-after=N: skip an executable after N crashes / timeouts in a row (0 = off)
+    double min_score;     // --min-score=F: skip an executable once its score can't reach F (0 = off)
+    char *journal_path;   // --journal=FILE / --no-journal: journal of classified pairs (see journal.h), NULL if disabled
+    int resume;           // --resume: restore the pairs journaled by an unfinished run instead of testing them
+    char *metrics_path;   // --metrics=PATH: serve live metrics on this Unix socket (see metrics.h), NULL if off
+    char *ipc;            // --ipc=sysv|posix|seqpacket|shm: how mq_autograder talks to local workers (see transport.h)
+    long long output_limit; // --output-limit=BYTES: kill children writing more output than this (0 = no limit)
+    char *expected_dir;   // --expected=DIR: compare outputs against DIR/<param> (see oracle.h), NULL for "0" / "1"
+    int ignore_whitespace;// --ignore-whitespace: runs of whitespace compare equal when comparing against DIR/<param>
+    char *trace_path;     // --trace=FILE: write a Chrome trace of the grader's own phases (see trace.h), NULL if off
+    char *stderr_path;    // --stderr=FILE / --inherit-stderr: where children's stderr is saved (see capture.h), NULL to inherit
+    long long stderr_keep;// --stderr-keep=BYTES: bytes kept from each end of a child's stderr
+    long long stderr_budget; // --stderr-budget=BYTES: most bytes of child stderr saved
+    char *log_path;       // --log=FILE: append log records here instead of stderr (see log.h)
+    char *log_level;      // --log-level=error|warn|info|debug: most verbose records logged (default info)
+    int host_pool;        // --no-host-pool: don't share a host-wide budget of children with other graders (see host_pool.h)
+    int host_slots;       // --host-slots=N: size of that budget while this grader runs (0 = MAX_CONCURRENCY_FACTOR per usable processor)
+    int host_pool_split;  // --host-pool-split=N: set by mq_autograder, its N local workers split its share
+    char *report_path;    // --report=FILE: write a class-wide report on the results (see report.h), NULL if off
+    char *params_spec;    // --params=SPEC: parameters beyond those after <testdir> (see load_params()), NULL if none
+    int watch;            // --watch: keep running and grade executables added to / replaced in <testdir>
+} grader_options_t;
+
+#define DEFAULT_HISTORY_FILE "runtime_history.txt"
+#define DEFAULT_PRIOR_MS 500
+#define DEFAULT_JOURNAL_FILE "results_journal.txt"
+#define DEFAULT_OUTPUT_LIMIT (1 << 20)  // Answers are a few bytes; this only stops runaway printers
+#define DEFAULT_STDERR_FILE "stderr.txt"
+#define DEFAULT_STDERR_KEEP 4096          // Bytes kept from each end of a child's stderr
+#define DEFAULT_STDERR_BUDGET (64 << 20)  // Bytes of child stderr saved per process
+
+#define PIN_NONE 0
+#define PIN_CORE 1
+#define PIN_L3 2
+
+
+#define EXE_TABLE_BLOCK (64UL << 10)  // Bytes of paths per block (more for a longer path)
+
+
+// Interned executable paths: every path is stored once, back to back in blocks
+// of EXE_TABLE_BLOCK bytes, and named by its index. Blocks are added as the
+// table grows and never move, so exe_table_path() pointers stay valid; a table
+// only takes the memory its paths need (--watch makes one per round).
+typedef struct {
+    char *block;          // Current block: a pointer to the previous one, then NUL-terminated paths
+    size_t block_len;     // bytes used in block
+    size_t block_size;
+    char **paths;         // paths[i]: where path i starts, in one of the blocks
+    int num_executables;  // number of paths interned
+    int capacity;         // allocated length of paths
+    int *buckets;         // open-addressed hash table of index + 1 (0 = free slot)
+    int num_buckets;      // power of two, at least twice num_executables
+} exe_table_t;
+
+
+// Incremental scanner over a solutions directory. Executables are discovered in
+// a single readdir() pass, so callers can start testing the first ones while
+// the rest of the directory is still being read.
+typedef struct {
+    DIR *dir;             // directory stream (NULL once the scan is complete)
+    char *solution_dir;   // path to solutions directory
+    int exec_only;        // 1 to only accept files with an execute bit set
+    exe_table_t table;    // executables discovered so far, in directory order
+} executable_scanner_t;
+
+
+// Parse the leading --options of argv into options. Returns the index of the
+// first positional argument (<testdir>).
+int parse_grader_options(int argc, char *argv[], grader_options_t *options);
+
+
+// Parameters to test: the num_argv_params given after <testdir>, followed by
+// those of --params=SPEC (NULL for none), which can be
+//     FIRST..LAST[:STEP]        every STEP-th integer from FIRST to LAST
+//     random:COUNT:SEED[:MAX]   COUNT distinct integers in 1..MAX (default 1000000), the same for a SEED
+//     @FILE                     whitespace-separated parameters read from FILE
+// Spec parameters are expanded into one allocation, without going through argv
+// (ARG_MAX). Sets total_params and returns the list: argv_params if no spec,
+// else one allocation to free() when done.
+char **load_params(char *spec, char **argv_params, int num_argv_params, int *total_params);
+
+
+// Fail-fast policy (opt-in): record a finished pair of an executable with total
+// pairs in the whole run, and return 1 once the rest should be SKIPPED. Pairs not
+// seen yet (including those on other mq workers) are assumed correct, so a
+// score is never cut short while it can still reach --min-score.
+int failfast_record(failfast_state_t *state, int status, int total, grader_options_t *options);
+
+
+void exe_table_init(exe_table_t *table);
+
+
+// Index of path in the table, adding a copy of it if it isn't there yet
+int exe_table_intern(exe_table_t *table, const char *path);
+
+
+// Path of executable index (valid until exe_table_free())
+static inline char *exe_table_path(exe_table_t *table, int index) {
+    return table->paths[index];
+}
+
+
+void exe_table_free(exe_table_t *table);
+
+
+// Open solution_dir for scanning with scan_executables()
+void open_executable_scanner(executable_scanner_t *scanner, char *solution_dir, int exec_only);
+
+
+// Discover up to max_new more executables (all remaining ones if max_new <= 0)
+// and append them to scanner->table. Returns the number discovered; 0 means
+// the scan is complete (scanner->dir == NULL).
+int scan_executables(executable_scanner_t *scanner, int max_new);
 
 
-// Count the number of times the pattern "processor" occurs in /proc/cpuinfo
+// 1 if solution_dir/name is a file scan_executables() would accept (watch mode)
+int accept_student_executable(char *solution_dir, char *name, int exec_only);
+
+
+// Stop scanning early. scanner->table stays owned by the caller.
+void close_executable_scanner(executable_scanner_t *scanner);
+
+
+// Takes in path to solutions directory and fills table with the executables
+// in it, in directory order. Returns the number of executables. If exec_only
+// is set, files without an execute bit are skipped.
+int get_student_executables(char *solution_dir, exe_table_t *table, int exec_only);
+
+
+// Number of CPUs this process can actually use: the CPUs in its affinity mask,
+// capped by the CPU quota (cpu.max / cpu.cfs_quota_us) of its cgroup
 int get_batch_size();
 
 
-// Create the input/<input>.in files for each parameter
-void create_input_files(char **argv_params, int num_parameters);
+// Split the CPUs this process may run on into physical cores (PIN_CORE) or L3
+// cache domains (PIN_L3). Stores a malloc'd array in domains and returns its
+// length (0 for PIN_NONE).
+int get_cpu_domains(int pin, cpu_set_t **domains);
+
+
+// Restrict this process (and children forked afterwards) to domains[index],
+// wrapping around if there are fewer domains. Does nothing if num_domains is 0.
+void pin_to_cpu_domain(cpu_set_t *domains, int num_domains, int index);
+
+
+// Raise the soft RLIMIT_NOFILE to the hard limit so every executable can be
+// held open for fd-based launching
+void raise_open_file_limit();
+
+
+// SHA-256 of the contents of fd (read from offset 0), as HASH_HEX_LEN hex digits
+// into hex (HASH_HEX_LEN + 1 bytes). Remote workers cache executables under it,
+// so two submissions must never share it. Returns -1 on read failure.
+#define HASH_HEX_LEN 64
+int hash_file(int fd, char *hex);
+
+
+// Open an executable once (read-only, close-on-exec) so it can be launched with
+// exec_solution() and prefetched. Returns -1 if it can't be opened, in which
+// case the executable is launched by path instead.
+int open_executable(char *executable_path);
+
+
+// Start reading an opened executable into the page cache in the background so
+// its first launch doesn't pay for cold reads. No-op for exe_fd == -1.
+void prefetch_executable(int exe_fd);
+
+
+// Replace the current (child) process with the executable, using exe_fd when
+// available and falling back to executable_path. The executable is killed if
+// its parent dies, so a crashed grader leaves no stuck children. Only returns
+// on failure.
+void exec_solution(int exe_fd, char *executable_path, char *const exec_argv[]);
+
+
+// Cap the size of files the current (child) process writes to max_bytes
+// (RLIMIT_FSIZE), so a runaway printer is killed by SIGXFSZ instead of filling
+// output/. No-op for max_bytes <= 0. Pipes aren't covered (see run_sessions()).
+void limit_output_size(long long max_bytes);
+
+
+// Create a sealed, close-on-exec memfd holding len bytes of data (any binary
+// content). name is only used for debugging (/proc/<pid>/fd), and cut to its
+// first MEMFD_NAME_MAX bytes.
+#define MEMFD_NAME_MAX 249  // NAME_MAX less the "memfd:" prefix the kernel adds
+int create_input_memfd(char *name, const void *data, size_t len);
+
+
+// Create the REDIR inputs for each parameter as sealed memfds (no files under
+// input/ are written). Returns a malloc'd array of fds indexed like argv_params.
+int *create_input_files(char **argv_params, int num_parameters);
+
+
+// Open a new read-only file description of input_fd positioned at offset 0, to
+// become a child's STDIN. Returns -1 on failure.
+int open_input_fd(int input_fd);
 
 
 // Setup timer to determine if child processes are stuck
@@ -85,12 +321,12 @@ void start_timer(int seconds, void (*timeout_handler)(int));
 void cancel_timer();
 
 
-// Unlink all of the input/<input>.in files
-void remove_input_files(char **argv_params, int num_parameters);
+// Close all of the input memfds from create_input_files() and free the array
+void remove_input_files(int *input_fds, int num_parameters);
 
 
-// Unlink all of the output/<executable>.<param> files in the current batch
-void remove_output_files(autograder_results_t *results, int tested, int current_batch_size, char *param);
+// Unlink the output/<executable>.<param> file of one tested pair
+void remove_output_file(char *exe_path, char *param);
 
 
 /*
@@ -135,4 +371,11 @@ where <exe_name> is the name of the executable and <score> is the score of the e
 */
 void write_scores_to_file(autograder_results_t *results, int num_executables, char *results_file);
 
+
+// Rewrite only the rows of results[rows[k]] (indexes as sorted by
+// write_results_to_file()) in results.txt and scores.txt, in place. Returns -1
+// when a row no longer fits (new executable, longer name, skipped count...):
+// the caller then rewrites both files whole.
+int update_result_rows(autograder_results_t *results, int num_executables, int total_params, int *rows, int num_rows);
+
 #endif // UTILS_H
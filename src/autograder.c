@@ -1,4 +1,16 @@
 #include "utils.h"
+#include "uring_engine.h"
+#include "concurrency.h"
+#include "history.h"
+#include "journal.h"
+#include "metrics.h"
+#include "oracle.h"
+#include "trace.h"
+#include "log.h"
+#include "capture.h"
+#include "host_pool.h"
+#include "report.h"
+#include <sys/inotify.h>
 
 // Batch size is determined at runtime now
 pid_t *pids;
@@ -7,12 +19,71 @@ pid_t *pids;
 autograder_results_t *results;
 
 int num_executables;      // Number of executables in test directory
-int curr_batch_size;      // At most batch_size executables will be run at once
+int curr_batch_size;      // At most controller.limit executables will be run at once
 int total_params;         // Total number of parameters to test - (argc - 2)
 
+// An (executable, parameter) pair to test: results[exe_idx] on params[param_idx]
+typedef struct {
+    int exe_idx;
+    int param_idx;
+    long long expected_ms;  // Expected runtime (see history.h)
+} pair_t;
+
+pair_t *batch;            // Pairs of the current batch (batch[j] runs as pids[j])
+long long *start_ms;      // When batch[j] was started
+long long *exit_ms;       // When batch[j] was reaped
+long long *launch_us;     // When batch[j] was forked, on the trace clock (0 if tracing is off)
+int *batch_statuses;      // Statuses of the batch from the io_uring engine
+char **output_paths;      // output/<executable>.<param> of batch[j], PATH_MAX each
+int *stderr_fds;          // Memfd child slot j writes its stderr to (-1 entries with --inherit-stderr)
+
+// The per-batch arrays above (and pids, child_status) are allocated once for
+// controller.max_limit children by alloc_batch_scratch() and reused by every batch
+
+// Work queue. With runtime history every pair is queued up front, longest
+// expected first. Without, pairs are taken in directory order, one parameter
+// after the other, while the directory is still being scanned.
+pair_t *queue;            // NULL when streaming
+int queue_len;
+int queue_pos;
+int stream_param;         // Next pair when streaming
+int stream_exe;
+
+// Runtimes of previous runs, updated with this one
+runtime_history_t history;
+
+grader_options_t options; // Command line options (see utils.h)
+
+// Every classified pair is journaled so an unfinished run can be resumed
+journal_t journal;
+
+// Live progress for --metrics (slot 0 is the autograder itself)
+metrics_t metrics;
+
+// Expected outputs with --expected (see oracle.h)
+oracle_t oracle;
+
+// Children's stderr, saved to --stderr=FILE (see capture.h)
+capture_t capture;
+
+// Slots for children shared with the other graders on this host (see host_pool.h)
+host_pool_t host_pool;
+
 // Contains status of child processes (-1 for done, 1 for still running)
 int *child_status;
 
+// Decides how many children run at once (see concurrency.h)
+concurrency_t controller;
+
+// With --pin, child slot j runs on cpu_domains[j % num_cpu_domains]
+cpu_set_t *cpu_domains;
+int num_cpu_domains;
+
+#ifdef REDIR
+// Sealed memfd holding each parameter's STDIN contents (see create_input_files())
+int *input_fds;
+#endif
+
 
 // TODO (Change 3): Timeout handler for alarm signal - kill remaining running child processes
 void timeout_handler(int signum) {
@@ -27,8 +98,8 @@ void timeout_handler(int signum) {
 }
 
 
-// Execute the student's executable using exec()
-void execute_solution(char *executable_path, char *input, int batch_idx) {
+// Execute the student's executable using exec() (from exe_fd when it is open)
+void execute_solution(char *executable_path, int exe_fd, char *input, int param_idx, int batch_idx) {
     #ifdef PIPE
 
         // TODO: Setup pipe
@@ -39,10 +110,13 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
         }
     #endif
 
+    long long trace_start = trace_begin();
     pid_t pid = fork();
 
     // Child process
     if (pid == 0) {
+        pin_to_cpu_domain(cpu_domains, num_cpu_domains, batch_idx);
+        capture_redirect(stderr_fds[batch_idx]);
         char *executable_name = get_exe_name(executable_path);
 
         // TODO (Change 1): Redirect STDOUT to output/<executable>.<input> file
@@ -70,27 +144,20 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
             exit(EXIT_FAILURE);
         }
         free(output_path);
+        limit_output_size(options.output_limit);
 
         // TODO (Change 2): Handle different cases for input source
         #ifdef EXEC
 
-            execl(executable_path, executable_name, input, NULL);
+            char *exec_argv[] = {executable_name, input, NULL};
+            exec_solution(exe_fd, executable_path, exec_argv);
             
         #elif REDIR
 
-            // TODO: Redirect STDIN to input/<input>.in file
-            int len_input_path = strlen("input/") + strlen(input) + strlen(".in") + 1;  // +1 for the null terminator
-            char *input_path = malloc(len_input_path);    // +1 for the null terminator
-            if (input_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(input_path, len_input_path, "input/%s.in", input);
-
-            int child_fd = open(input_path, O_RDONLY);
-            free(input_path);
+            // TODO: Redirect STDIN to the input memfd of this parameter
+            int child_fd = open_input_fd(input_fds[param_idx]);
             if (child_fd == -1) {
-                fprintf(stderr, "Error occured at line %d: open failed", __LINE__ - 3);
+                fprintf(stderr, "Error occured at line %d: open failed", __LINE__ - 2);
                 exit(EXIT_FAILURE);
             }
             if (dup2(child_fd, STDIN_FILENO) == -1) {
@@ -101,7 +168,8 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
                 fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
                 exit(EXIT_FAILURE);
             }
-            execl(executable_path, executable_name, NULL);
+            char *exec_argv[] = {executable_name, NULL};
+            exec_solution(exe_fd, executable_path, exec_argv);
 
         #elif PIPE
 
@@ -120,7 +188,8 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
             }
             char string_of_pipefd[MAX_INT_CHARS + 1];
             snprintf(string_of_pipefd, sizeof(string_of_pipefd), "%d", pipefd[0]);
-            execl(executable_path, executable_name, string_of_pipefd, NULL);
+            char *exec_argv[] = {executable_name, string_of_pipefd, NULL};
+            exec_solution(exe_fd, executable_path, exec_argv);
         #endif
 
         // If exec fails
@@ -144,6 +213,9 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
         #endif
 
         pids[batch_idx] = pid;
+        start_ms[batch_idx] = monotonic_ms();
+        launch_us[batch_idx] = trace_start;
+        trace_end_pair("launch", "autograder", trace_start, 0, get_exe_name(executable_path), input);
     } else {  // Fork failed
         perror("Failed to fork");
         exit(1);
@@ -152,124 +224,175 @@ void execute_solution(char *executable_path, char *input, int batch_idx) {
 
 
 // Wait for the batch to finish and check results
-void monitor_and_evaluate_solutions(int tested, char *param, int param_idx) {
+void monitor_and_evaluate_solutions(char **params) {
     // Keep track of finished processes for alarm handler
-    child_status = malloc(curr_batch_size * sizeof(int));
-    if (child_status == NULL) {
-        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-        exit(EXIT_FAILURE);
-    }
     for (int j = 0; j < curr_batch_size; j++) {
         child_status[j] = 1;
     }
 
-    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out
-    for (int j = 0; j < curr_batch_size; j++) {
+    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out.
+    // Children are reaped in the order they finish so their runtimes are exact.
+    for (int reaped = 0; reaped < curr_batch_size; reaped++) {
         int status;
         errno = 0;
         // TODO: What if waitpid is interrupted by a signal?
         pid_t pid;
+        long long reap_start = trace_begin();
         do {
-            pid = waitpid(pids[j], &status, 0);
+            pid = waitpid(-1, &status, 0);
             if (pid == -1 && errno != EINTR) {
                 perror("waitpid");
                 exit(EXIT_FAILURE);
             }
         } while (pid == -1 && errno == EINTR);
+        trace_end("reap", "autograder", reap_start, 0, NULL);
+
+        int j = 0;
+        while (j < curr_batch_size && pids[j] != pid) {
+            j++;
+        }
+        if (j == curr_batch_size) {
+            reaped--;  // Not a child of this batch
+            continue;
+        }
+        exit_ms[j] = monotonic_ms();
+        char *param = params[batch[j].param_idx];
+        trace_end_pair("run", "child", launch_us[j], pid, get_exe_name(results[batch[j].exe_idx].exe_path), param);
+        long long classify_start = trace_begin();
 
         // TODO: Determine if the child process finished normally, segfaulted, or timed out
         int exited = WIFEXITED(status);
         int signaled = WIFSIGNALED(status);
         int final_status;
         if (signaled) {
-            if (WTERMSIG(status) == SIGSEGV) {
-                final_status = SEGFAULT;
-            } else if (WTERMSIG(status) == SIGKILL) {
-                final_status = STUCK_OR_INFINITE;
-            } else {
-                perror("Unrecognized signal");
-                exit(EXIT_FAILURE);
-            }
+            final_status = get_signal_status(WTERMSIG(status));
         } else if (exited) {
-            char *executable_name = get_exe_name(results[tested - curr_batch_size + j].exe_path);
-            int length_output_path = strlen("output/") + strlen(executable_name) + strlen(param) + 2;  // +2 for the null terminator and the dot
-            char *output_path = malloc(length_output_path);    // +2 for the null terminator and the dot
-            if (output_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(output_path, length_output_path, "output/%s.%s", executable_name, param);
+            char *output_path = output_paths[j];
+            snprintf(output_path, PATH_MAX, "output/%s.%s", get_exe_name(results[batch[j].exe_idx].exe_path), param);
 
             int fd;
             if ((fd = open(output_path, O_RDONLY)) == -1) {
-                free(output_path);
-                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 3);
+                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 1);
                 exit(EXIT_FAILURE);
             }
-            free(output_path);
 
-            int bytes_read;
-            char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
-            if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
-                perror("Read Failed");
-                exit(EXIT_FAILURE);
+            if (oracle.dir != NULL) {
+                final_status = oracle_compare_fd(&oracle, param, fd);
+            } else {
+                int bytes_read;
+                char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
+                if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
+                    perror("Read Failed");
+                    exit(EXIT_FAILURE);
+                }
+                output[bytes_read] = '\0';
+                final_status = get_output_status(output);
             }
             if (close(fd) == -1) {
                 perror("close failed");
                 exit(EXIT_FAILURE);
             }
-            output[bytes_read] = '\0';
-            if (atoi(output) == 0) {
-                final_status = CORRECT;
-            } else if (atoi(output) == 1) {
-                final_status = INCORRECT;
-            } else {
-                perror("Invalid output");
-                exit(EXIT_FAILURE);
-            }
         }
 
         // TODO: Also, update the results struct with the status of the child process
-        results[tested - curr_batch_size + j].status[param_idx] = final_status;
+        results[batch[j].exe_idx].status[batch[j].param_idx] = final_status;
 
         // NOTE: Make sure you are using the output/<executable>.<input> file to determine the status
         //       of the child process, NOT the exit status like in Project 1.
 
         // Adding tested parameter to results struct
-        results[tested - curr_batch_size + j].params_tested[param_idx] = atoi(param);
+        results[batch[j].exe_idx].params_tested[batch[j].param_idx] = param;
+        trace_end_pair("classify", "autograder", classify_start, 0, get_exe_name(results[batch[j].exe_idx].exe_path), param);
 
         // Mark the process as finished
         child_status[j] = -1;
     }
+}
 
-    free(child_status);
+
+
+// Same as monitor_and_evaluate_solutions() + remove_output_file(), supervised
+// through io_uring (see uring_engine.h)
+void uring_monitor_and_evaluate_solutions(char **params) {
+    for (int j = 0; j < curr_batch_size; j++) {
+        snprintf(output_paths[j], PATH_MAX, "output/%s.%s", get_exe_name(results[batch[j].exe_idx].exe_path),
+                 params[batch[j].param_idx]);
+    }
+
+    long long trace_start = trace_begin();
+    uring_monitor_batch(pids, output_paths, curr_batch_size, TIMEOUT_SECS, 1, batch_statuses, exit_ms);
+    trace_end("uring batch", "autograder", trace_start, 0, NULL);
+
+    for (int j = 0; j < curr_batch_size; j++) {
+        results[batch[j].exe_idx].status[batch[j].param_idx] = batch_statuses[j];
+        results[batch[j].exe_idx].params_tested[batch[j].param_idx] = params[batch[j].param_idx];
+    }
 }
 
 
+int scratch_size;         // Children the per-batch arrays have room for
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <testdir> <p1> <p2> ... <pn>\n", argv[0]);
-        return 1;
+
+// Allocate the per-batch arrays for up to max_children children at once
+void alloc_batch_scratch(int max_children) {
+    batch = malloc(max_children * sizeof(pair_t));
+    pids = malloc(max_children * sizeof(pid_t));
+    child_status = malloc(max_children * sizeof(int));
+    start_ms = malloc(max_children * sizeof(long long));
+    exit_ms = malloc(max_children * sizeof(long long));
+    launch_us = malloc(max_children * sizeof(long long));
+    batch_statuses = malloc(max_children * sizeof(int));
+    output_paths = malloc(max_children * sizeof(char *));
+    stderr_fds = malloc(max_children * sizeof(int));
+    char *path_block = malloc((size_t) max_children * PATH_MAX);
+    if (batch == NULL || pids == NULL || child_status == NULL || start_ms == NULL || exit_ms == NULL ||
+        launch_us == NULL || batch_statuses == NULL || output_paths == NULL || stderr_fds == NULL || path_block == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 3);
+        exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < max_children; j++) {
+        output_paths[j] = path_block + (size_t) j * PATH_MAX;
+        stderr_fds[j] = capture_create_fd(&capture);
     }
+    scratch_size = max_children;
+}
 
-    char *testdir = argv[1];
-    total_params = argc - 2;
 
-    // TODO (Change 0): Implement get_batch_size() function
-    int batch_size = get_batch_size();
+void free_batch_scratch() {
+    for (int j = 0; j < scratch_size; j++) {
+        if (stderr_fds[j] != -1) {
+            close(stderr_fds[j]);
+        }
+    }
+    free(stderr_fds);
+    free(batch);
+    free(pids);
+    free(child_status);
+    free(start_ms);
+    free(exit_ms);
+    free(launch_us);
+    free(batch_statuses);
+    free(output_paths[0]);
+    free(output_paths);
+}
+
+
+// Scanner over the test directory. The first parameter's batches are launched
+// while the directory is still being read.
+executable_scanner_t scanner;
 
-    char **executable_paths = get_student_executables(testdir, &num_executables);
 
-    // Construct summary struct
-    results = malloc(num_executables * sizeof(autograder_results_t));
+// Add results entries for the executables of scanner.table not in results yet
+void add_new_results() {
+    results = realloc(results, scanner.table.capacity * sizeof(autograder_results_t));
     if (results == NULL) {
-        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        fprintf(stderr, "Error occured at line %d: realloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < num_executables; i++) {
-        results[i].exe_path = executable_paths[i];
-        results[i].params_tested = malloc((total_params) * sizeof(int));
+    for (int i = num_executables; i < scanner.table.num_executables; i++) {
+        results[i].exe_path = exe_table_path(&scanner.table, i);
+        results[i].exe_fd = open_executable(results[i].exe_path);
+        results[i].params_tested = malloc((total_params) * sizeof(char *));
         if (results[i].params_tested == NULL) {
             fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
@@ -279,61 +402,940 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
+        memset(&results[i].failfast, 0, sizeof(failfast_state_t));
+        journal_note_executable(&journal, get_exe_name(results[i].exe_path));
     }
+    num_executables = scanner.table.num_executables;
+}
 
-    #ifdef REDIR
-        // TODO: Create the input/<input>.in files and write the parameters to them
-        create_input_files(argv + 2, total_params);  // Implement this function (src/utils.c)
-    #endif
 
-    // MAIN LOOP: For each parameter, run all executables in batch size chunks
-    for (int i = 2; i < argc; i++) {
-        int remaining = num_executables;
-        int tested = 0;
-
-        // Test the parameter on each executable
-        while (remaining > 0) {
-            // Determine current batch size - min(remaining, batch_size)
-            curr_batch_size = remaining < batch_size ? remaining : batch_size;
-            pids = malloc(curr_batch_size * sizeof(pid_t));
-            if (pids == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+// Discover up to max_new more executables and add them to the results struct
+void discover_executables(int max_new) {
+    long long trace_start = trace_begin();
+    if (scan_executables(&scanner, max_new) == 0) {
+        return;
+    }
+    add_new_results();
+    metrics_set_total(&metrics, (long long) num_executables * total_params);
+    trace_end("scan", "autograder", trace_start, 0, NULL);
+}
+
+
+// Mark a pair as SKIPPED without running it (see failfast_record())
+void skip_pair(int exe_idx, int param_idx, char **params) {
+    results[exe_idx].status[param_idx] = SKIPPED;
+    results[exe_idx].params_tested[param_idx] = params[param_idx];
+    results[exe_idx].failfast.skipped++;
+    journal_record(&journal, get_exe_name(results[exe_idx].exe_path), params[param_idx], SKIPPED);
+    metrics_record(&metrics, 0, SKIPPED, -1);
+}
+
+
+// With --resume, take the status of a pair the unfinished run already
+// classified instead of testing it again. Returns 1 if it did.
+int restore_pair(int exe_idx, int param_idx, char **params) {
+    if (!journal_restore(&journal, &results[exe_idx], param_idx, params[param_idx], total_params, &options)) {
+        return 0;
+    }
+    metrics_record(&metrics, 0, results[exe_idx].status[param_idx], -1);
+    return 1;
+}
+
+
+// Take up to limit pairs off the work queue into batch, skipping those restored
+// from the journal or of executables the fail-fast policy gave up on. Returns
+// how many.
+int take_batch(int limit, char **params) {
+    int count = 0;
+    while (count < limit) {
+        if (queue != NULL) {
+            if (queue_pos == queue_len) {
+                break;
+            }
+            pair_t pair = queue[queue_pos++];
+            if (restore_pair(pair.exe_idx, pair.param_idx, params)) {
+                continue;
+            } else if (results[pair.exe_idx].failfast.stopped) {
+                skip_pair(pair.exe_idx, pair.param_idx, params);
+            } else {
+                batch[count++] = pair;
+            }
+            continue;
+        }
+
+        // Keep the directory scan ahead of this batch and the next one (to prefetch)
+        if (scanner.dir != NULL && num_executables - stream_exe < 2 * limit) {
+            discover_executables(2 * limit - (num_executables - stream_exe));
+        }
+        if (stream_exe < num_executables) {
+            int exe_idx = stream_exe++;
+            if (restore_pair(exe_idx, stream_param, params)) {
+                continue;
+            } else if (results[exe_idx].failfast.stopped) {
+                skip_pair(exe_idx, stream_param, params);
+            } else {
+                batch[count].exe_idx = exe_idx;
+                batch[count++].param_idx = stream_param;
+            }
+        } else if (stream_param + 1 < total_params && num_executables > 0) {
+            stream_param++;
+            stream_exe = 0;
+        } else {
+            break;
+        }
+    }
+    return count;
+}
+
+
+// 1 once every pair has been taken off the work queue
+int queue_done() {
+    if (queue != NULL) {
+        return queue_pos == queue_len;
+    }
+    return scanner.dir == NULL && stream_exe >= num_executables && stream_param + 1 >= total_params;
+}
+
+
+// Executable of the k-th pair after the current batch, -1 if unknown yet
+int peek_executable(int k) {
+    if (queue != NULL) {
+        return queue_pos + k < queue_len ? queue[queue_pos + k].exe_idx : -1;
+    }
+    int exe_idx = stream_exe + k;
+    if (exe_idx >= num_executables && stream_param + 1 < total_params && scanner.dir == NULL) {
+        exe_idx -= num_executables;
+    }
+    return exe_idx < num_executables ? exe_idx : -1;
+}
+
+
+// Order pairs by expected runtime, longest first (ties keep directory order)
+int compare_expected(const void *a, const void *b) {
+    const pair_t *pair_a = a, *pair_b = b;
+    if (pair_a->expected_ms != pair_b->expected_ms) {
+        return pair_a->expected_ms < pair_b->expected_ms ? 1 : -1;
+    }
+    long order_a = (long) pair_a->param_idx * num_executables + pair_a->exe_idx;
+    long order_b = (long) pair_b->param_idx * num_executables + pair_b->exe_idx;
+    return order_a < order_b ? -1 : order_a > order_b;
+}
+
+
+// Queue every pair longest-expected-first and report the expected gain over
+// directory order
+void build_queue(char **params) {
+    discover_executables(0);
+    queue_len = num_executables * total_params;
+    queue = malloc(queue_len * sizeof(pair_t));
+    long long *default_order_ms = malloc(queue_len * sizeof(long long));
+    long long *scheduled_ms = malloc(queue_len * sizeof(long long));
+    if (queue == NULL || default_order_ms == NULL || scheduled_ms == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < total_params; i++) {
+        for (int e = 0; e < num_executables; e++) {
+            pair_t *pair = &queue[i * num_executables + e];
+            pair->exe_idx = e;
+            pair->param_idx = i;
+            pair->expected_ms = history_expected_ms(&history, get_exe_name(results[e].exe_path), params[i]);
+            default_order_ms[i * num_executables + e] = pair->expected_ms;
+        }
+    }
+    qsort(queue, queue_len, sizeof(pair_t), compare_expected);
+    for (int k = 0; k < queue_len; k++) {
+        scheduled_ms[k] = queue[k].expected_ms;
+    }
+
+    report_makespan(default_order_ms, scheduled_ms, queue_len, controller.limit, 1);
+    free(default_order_ms);
+    free(scheduled_ms);
+}
+
+
+// Report the finished batch to the controller and record its runtimes
+void end_batch(char **params) {
+    int timed_out = 0, expected_timeouts = 0;
+    for (int j = 0; j < curr_batch_size; j++) {
+        int status = results[batch[j].exe_idx].status[batch[j].param_idx];
+        if (status == STUCK_OR_INFINITE) {
+            timed_out++;
+            expected_timeouts += history_status(&history, get_exe_name(results[batch[j].exe_idx].exe_path),
+                                                params[batch[j].param_idx]) == STUCK_OR_INFINITE;
+        }
+        history_record(&history, get_exe_name(results[batch[j].exe_idx].exe_path), params[batch[j].param_idx],
+                       exit_ms[j] - start_ms[j], status);
+        journal_record(&journal, get_exe_name(results[batch[j].exe_idx].exe_path), params[batch[j].param_idx], status);
+        metrics_record(&metrics, 0, status, exit_ms[j] - start_ms[j]);
+        failfast_record(&results[batch[j].exe_idx].failfast, status, total_params, &options);
+        capture_collect(&capture, stderr_fds[j], results[batch[j].exe_idx].exe_path, params[batch[j].param_idx]);
+        log_debug("pair_done", "exe=%s param=%s status=%s runtime_ms=%lld", results[batch[j].exe_idx].exe_path,
+                  params[batch[j].param_idx], get_status_message(status), exit_ms[j] - start_ms[j]);
+    }
+    host_pool_release(&host_pool, curr_batch_size);
+    concurrency_end_batch(&controller, curr_batch_size, timed_out, expected_timeouts);
+}
+
+
+#ifndef SESSION
+
+// Run the work queue in batches of (at most) controller.limit pairs
+void run_batches(char **params) {
+    // MAIN LOOP: one batch per iteration until the queue is empty
+    while (!queue_done()) {
+        // One host slot per child: waits while other graders use them all, and
+        // shrinks the batch to this grader's fair share
+        int batch_size = host_pool_acquire(&host_pool, controller.limit);
+        curr_batch_size = take_batch(batch_size, params);
+        host_pool_release(&host_pool, batch_size - curr_batch_size);
+        if (curr_batch_size == 0) {
+            break;
+        }
+        metrics_assign(&metrics, 0, curr_batch_size);
+
+        // TODO: Execute the programs in batch size chunks
+        concurrency_begin_batch(&controller);
+        for (int j = 0; j < curr_batch_size; j++) {
+            autograder_results_t *result = &results[batch[j].exe_idx];
+            execute_solution(result->exe_path, result->exe_fd, params[batch[j].param_idx], batch[j].param_idx, j);
+        }
+
+        // Warm the page cache for the next batch while this one runs
+        for (int k = 0; k < batch_size; k++) {
+            int exe_idx = peek_executable(k);
+            if (exe_idx == -1) {
+                break;
+            }
+            prefetch_executable(results[exe_idx].exe_fd);
+        }
+
+        if (options.use_uring) {
+            // Reap, time out, read and unlink the whole batch through io_uring
+            uring_monitor_and_evaluate_solutions(params);
+            end_batch(params);
+            continue;
+        }
+
+        // TODO (Change 3): Setup timer to determine if child process is stuck
+        start_timer(TIMEOUT_SECS, timeout_handler);  // Implement this function (src/utils.c)
+
+        // TODO: Wait for the batch to finish and check results
+        monitor_and_evaluate_solutions(params);
+
+        // TODO: Cancel the timer if all child processes have finished
+        if (child_status == NULL) {
+            cancel_timer();  // Implement this function (src/utils.c)
+        }
+
+        // TODO Unlink all output files in current batch (output/<executable>.<input>)
+        long long cleanup_start = trace_begin();
+        for (int j = 0; j < curr_batch_size; j++) {
+            remove_output_file(results[batch[j].exe_idx].exe_path, params[batch[j].param_idx]);  // Implement this function (src/utils.c)
+        }
+        trace_end("cleanup", "autograder", cleanup_start, 0, NULL);
+
+        end_batch(params);
+    }
+}
+
+
+
+// Submissions often land in bursts (several files, or a copy then a chmod):
+// they are collected until none arrived for this long, then graded together
+#define WATCH_DEBOUNCE_MS 500
+
+volatile sig_atomic_t watch_stopped;  // Set by SIGINT / SIGTERM in watch mode
+
+
+void stop_watching(int signum) {
+    (void) signum;
+    watch_stopped = 1;
+}
+
+
+// Index into results of the executable at path, adding an entry if it is new
+int find_result(char *path) {
+    int table_idx = exe_table_intern(&scanner.table, path);
+    if (table_idx >= num_executables) {
+        add_new_results();
+        return table_idx;
+    }
+    // write_results_to_file() reordered results, but their paths still point into the table
+    char *interned = exe_table_path(&scanner.table, table_idx);
+    int exe_idx = 0;
+    while (results[exe_idx].exe_path != interned) {
+        exe_idx++;
+    }
+    return exe_idx;
+}
+
+
+// Test the executables named in arrivals (new or replaced) on every parameter
+// and update their rows of results.txt and scores.txt
+void grade_submissions(char *testdir, exe_table_t *arrivals, char **params) {
+    long long round_start_ms = monotonic_ms();
+    int *changed = malloc(arrivals->num_executables * sizeof(int));
+    if (changed == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int num_changed = 0;
+    int added = 0;
+    for (int k = 0; k < arrivals->num_executables; k++) {
+        char *name = exe_table_path(arrivals, k);
+        if (!accept_student_executable(testdir, name, options.exec_only)) {
+            continue;  // Removed again, hidden, not executable yet, ...
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", testdir, name);
+        int known = num_executables;
+        int exe_idx = find_result(path);
+        if (exe_idx >= known) {
+            added++;
+        } else {
+            // Replaced: the open fd still refers to the previous submission
+            if (results[exe_idx].exe_fd != -1) {
+                close(results[exe_idx].exe_fd);
+            }
+            results[exe_idx].exe_fd = open_executable(results[exe_idx].exe_path);
+            memset(&results[exe_idx].failfast, 0, sizeof(failfast_state_t));
+        }
+        changed[num_changed++] = exe_idx;
+    }
+    if (num_changed == 0) {
+        free(changed);
+        return;
+    }
+
+    // Same order as a full run: one parameter after the other
+    queue_len = num_changed * total_params;
+    queue_pos = 0;
+    queue = malloc(queue_len * sizeof(pair_t));
+    if (queue == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < total_params; i++) {
+        for (int k = 0; k < num_changed; k++) {
+            queue[i * num_changed + k].exe_idx = changed[k];
+            queue[i * num_changed + k].param_idx = i;
+            queue[i * num_changed + k].expected_ms = 0;
+        }
+    }
+    metrics_set_total(&metrics, atomic_load(&metrics.total_pairs) + queue_len);
+    host_pool_join(&host_pool);
+    run_batches(params);
+    host_pool_leave(&host_pool);
+    free(queue);
+    queue = NULL;
+
+    // New rows have to be sorted in, which moves the others
+    if (added > 0 || update_result_rows(results, num_executables, total_params, changed, num_changed) == -1) {
+        write_results_to_file(results, num_executables, total_params);
+        write_scores_to_file(results, num_executables, "results.txt");
+    }
+    write_report_to_file(options.report_path, results, num_executables, total_params, params);
+    printf("Graded %d submission(s) (%d new) in %lld ms\n", num_changed, added, monotonic_ms() - round_start_ms);
+    free(changed);
+}
+
+
+// Watch mode: grade executables as they are written to (IN_CLOSE_WRITE) or
+// moved into (IN_MOVED_TO) testdir, until SIGINT / SIGTERM
+void watch_solutions(char *testdir, char **params) {
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1 || inotify_add_watch(inotify_fd, testdir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        perror("Failed to watch test directory");
+        exit(EXIT_FAILURE);
+    }
+    // No SA_RESTART: the signal has to interrupt poll()
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_watching;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGINT, &action, NULL) == -1 || sigaction(SIGTERM, &action, NULL) == -1) {
+        perror("sigaction failed");
+        exit(EXIT_FAILURE);
+    }
+    printf("Watching %s for submissions (Ctrl-C to stop)\n", testdir);
+    fflush(stdout);
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!watch_stopped) {
+        // Names written or moved in, each once
+        exe_table_t arrivals;
+        exe_table_init(&arrivals);
+
+        // Block until the first one, then until WATCH_DEBOUNCE_MS pass without another
+        int timeout_ms = -1;
+        while (!watch_stopped) {
+            struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+            int ready = poll(&pfd, 1, timeout_ms);
+            if (ready == -1 && errno == EINTR) {
+                continue;
+            }
+            if (ready == -1) {
+                perror("poll failed");
                 exit(EXIT_FAILURE);
             }
+            if (ready == 0) {
+                break;
+            }
+            ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+            if (len == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Failed to read inotify events");
+                exit(EXIT_FAILURE);
+            }
+            for (char *ptr = buffer; ptr < buffer + len;) {
+                struct inotify_event *event = (struct inotify_event *) ptr;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    fprintf(stderr, "Too many submissions at once, some were missed (inotify queue overflow)\n");
+                } else if (event->len > 0) {
+                    exe_table_intern(&arrivals, event->name);
+                }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+            timeout_ms = WATCH_DEBOUNCE_MS;
+        }
+
+        if (!watch_stopped && arrivals.num_executables > 0) {
+            grade_submissions(testdir, &arrivals, params);
+            fflush(stdout);
+        }
+        exe_table_free(&arrivals);
+    }
+    close(inotify_fd);
+}
+
+#endif
+
+
+#ifdef SESSION
+
+// One long-lived child process that is fed every parameter in turn over a pipe
+typedef struct {
+    int exe_idx;               // Index into results (-1 if the slot is idle)
+    int slot;                  // Index into sessions (selects the CPU domain with --pin)
+    pid_t pid;                 // Running child (-1 if it has to be (re)started)
+    int to_child;              // Write end of the child's stdin pipe
+    int from_child;            // Read end of the child's stdout pipe
+    int param_idx;             // Parameter the child is currently working on
+    long long deadline_ms;     // When the current parameter times out
+    char line[MAX_INT_CHARS + 2];  // Partially received result line
+    int line_len;
+    oracle_stream_t answer;    // With --expected: the line so far against the expected one
+    long long output_bytes;    // Read for the current parameter (capped by --output-limit)
+    long long trace_start;     // When the current parameter was sent, on the trace clock (0 if tracing is off)
+    int stderr_fd;             // Memfd the child writes its stderr to (-1 with --inherit-stderr)
+} session_t;
+
+#define SESSION_DRAIN_BYTES (64 * BUFSIZ)  // Most output discarded between two parameters
+
+// Parameters finished (and timed out, as the history expected or not) since the
+// last concurrency adjustment
+int session_completed;
+int session_timed_out;
+int session_expected_timeouts;
+
+// With runtime history, sessions start in this order of results indexes
+// (longest expected total first) instead of directory order
+int *session_order;
+
+
+// Discard what the child printed after its last answer, so that it isn't read
+// as the answer to the next parameter. Gives up after SESSION_DRAIN_BYTES: the
+// rest counts against the next parameter (and --output-limit).
+void drain_session_output(session_t *session) {
+    char buffer[BUFSIZ];
+    struct pollfd pollfd = { .fd = session->from_child, .events = POLLIN };
+    for (size_t drained = 0; drained < SESSION_DRAIN_BYTES && poll(&pollfd, 1, 0) == 1 && (pollfd.revents & POLLIN);) {
+        ssize_t bytes_read = read(session->from_child, buffer, sizeof(buffer));
+        if (bytes_read <= 0) {
+            break;  // EOF (the child died) is seen by run_sessions()
+        }
+        drained += bytes_read;
+    }
+}
+
+
+// Send the session's current parameter and restart its timeout
+void send_session_param(session_t *session, char **params) {
+    char buffer[PATH_MAX];
+    int len = snprintf(buffer, sizeof(buffer), "%s\n", params[session->param_idx]);
+    session->deadline_ms = monotonic_ms() + TIMEOUT_SECS * 1000;
+    session->trace_start = trace_begin();
+    session->line_len = 0;
+    session->output_bytes = 0;
+    if (oracle.dir != NULL) {
+        oracle_stream_begin(&oracle, &session->answer, params[session->param_idx]);
+    }
+    metrics_assign(&metrics, 0, 1);
+
+    // A child that already died shows up as EOF on from_child
+    if (write(session->to_child, buffer, len) == -1 && errno != EPIPE) {
+        perror("write failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Fork a session process for the remaining parameters of session->exe_idx
+void start_session(session_t *session, char **params) {
+    int in_pipe[2], out_pipe[2];
+
+    // Close-on-exec so the other sessions' children don't hold these pipes open
+    if (pipe2(in_pipe, O_CLOEXEC) == -1 || pipe2(out_pipe, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error occured at line %d: pipe failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
 
-            // TODO: Execute the programs in batch size chunks
-            for (int j = 0; j < curr_batch_size; j++) {
-                execute_solution(executable_paths[tested], argv[i], j);
-                tested++;
+    char *executable_path = results[session->exe_idx].exe_path;
+    long long trace_start = trace_begin();
+    pid_t pid = fork();
+    if (pid == 0) {
+        pin_to_cpu_domain(cpu_domains, num_cpu_domains, session->slot);
+        // Ignored signals survive exec(): a child still printing once its pipe is
+        // closed must die of SIGPIPE, not spin on EPIPE while we wait for it
+        signal(SIGPIPE, SIG_DFL);
+        capture_redirect(session->stderr_fd);
+        if (dup2(in_pipe[0], STDIN_FILENO) == -1 || dup2(out_pipe[1], STDOUT_FILENO) == -1) {
+            fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        char *exec_argv[] = {get_exe_name(executable_path), NULL};
+        exec_solution(results[session->exe_idx].exe_fd, executable_path, exec_argv);
+        perror("Failed to execute program");
+        exit(1);
+    } else if (pid < 0) {
+        perror("Failed to fork");
+        exit(1);
+    }
+
+    if (close(in_pipe[0]) == -1 || close(out_pipe[1]) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    session->pid = pid;
+    session->to_child = in_pipe[1];
+    session->from_child = out_pipe[0];
+    trace_end("launch", "autograder", trace_start, 0, get_exe_name(executable_path));
+    send_session_param(session, params);
+}
+
+
+// Reap the session's child and close its pipes. Returns the wait status.
+int stop_session(session_t *session) {
+    int status;
+    pid_t pid;
+
+    if (close(session->to_child) == -1 || close(session->from_child) == -1) {
+        fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
+        exit(EXIT_FAILURE);
+    }
+    do {
+        pid = waitpid(session->pid, &status, 0);
+        if (pid == -1 && errno != EINTR) {
+            perror("waitpid");
+            exit(EXIT_FAILURE);
+        }
+    } while (pid == -1 && errno == EINTR);
+
+    // One record for all the parameters this child was sent
+    capture_collect(&capture, session->stderr_fd, results[session->exe_idx].exe_path, "session");
+    session->pid = -1;
+    return status;
+}
+
+
+// First parameter from param_idx on that the session still has to test. Those
+// restored from the journal or given up on by the fail-fast policy are passed over.
+int next_session_param(int exe_idx, int param_idx, char **params) {
+    while (param_idx < total_params) {
+        if (restore_pair(exe_idx, param_idx, params)) {
+            param_idx++;
+        } else if (results[exe_idx].failfast.stopped) {
+            skip_pair(exe_idx, param_idx++, params);
+        } else {
+            break;
+        }
+    }
+    return param_idx;
+}
+
+
+// Record the current parameter's status and move the session on to the next
+// parameter, or idle once the executable is done (see fill_sessions())
+void finish_session_param(session_t *session, int final_status, char **params) {
+    // One row per session slot: its child may already be reaped (and restarted)
+    trace_end_pair("param", "child", session->trace_start, session->slot + 1, get_exe_name(results[session->exe_idx].exe_path),
+                   params[session->param_idx]);
+    session_completed++;
+    if (final_status == STUCK_OR_INFINITE) {
+        session_timed_out++;
+        session_expected_timeouts += history_status(&history, get_exe_name(results[session->exe_idx].exe_path),
+                                                    params[session->param_idx]) == STUCK_OR_INFINITE;
+    }
+    long long runtime_ms = monotonic_ms() - (session->deadline_ms - TIMEOUT_SECS * 1000);
+    history_record(&history, get_exe_name(results[session->exe_idx].exe_path), params[session->param_idx],
+                   runtime_ms, final_status);
+    metrics_record(&metrics, 0, final_status, runtime_ms);
+    results[session->exe_idx].status[session->param_idx] = final_status;
+    results[session->exe_idx].params_tested[session->param_idx] = params[session->param_idx];
+    journal_record(&journal, get_exe_name(results[session->exe_idx].exe_path), params[session->param_idx], final_status);
+    log_debug("pair_done", "exe=%s param=%s status=%s runtime_ms=%lld", results[session->exe_idx].exe_path,
+              params[session->param_idx], get_status_message(final_status), runtime_ms);
+
+    // Fail-fast: give up on the remaining parameters (see next_session_param())
+    failfast_record(&results[session->exe_idx].failfast, final_status, total_params, &options);
+
+    session->param_idx = next_session_param(session->exe_idx, session->param_idx + 1, params);
+    if (session->param_idx < total_params) {
+        // Crashed or killed children are restarted for the remaining parameters
+        if (session->pid == -1) {
+            start_session(session, params);
+        } else {
+            drain_session_output(session);
+            send_session_param(session, params);
+        }
+        return;
+    }
+
+    // All parameters tested -> EOF on stdin tells the child to exit
+    if (session->pid != -1) {
+        stop_session(session);
+    }
+    session->exe_idx = -1;
+    host_pool_release(&host_pool, 1);
+}
+
+
+// Start the next executables on idle slots until controller.limit sessions are
+// active. Returns the new number of active sessions.
+int fill_sessions(session_t *sessions, int num_slots, int active, char **params, int *next_exe) {
+    for (int j = 0; j < num_slots && active < controller.limit; j++) {
+        if (sessions[j].exe_idx != -1) {
+            continue;
+        }
+        if (scanner.dir != NULL && *next_exe == num_executables) {
+            discover_executables(controller.limit - active);
+        }
+        if (*next_exe == num_executables) {
+            break;
+        }
+        // One host slot per session (see host_pool.h), only waited for while none runs
+        if ((active == 0 ? host_pool_acquire(&host_pool, 1) : host_pool_try_acquire(&host_pool, 1)) == 0) {
+            break;
+        }
+        int exe_idx = session_order != NULL ? session_order[*next_exe] : *next_exe;
+        (*next_exe)++;
+        sessions[j].param_idx = next_session_param(exe_idx, 0, params);
+        if (sessions[j].param_idx == total_params) {
+            host_pool_release(&host_pool, 1);
+            j--;  // Nothing left to test (all restored) -> try the next executable on this slot
+            continue;
+        }
+        sessions[j].exe_idx = exe_idx;
+        start_session(&sessions[j], params);
+        active++;
+    }
+    return active;
+}
+
+
+// Order sessions by expected total runtime, longest first (ties keep directory order)
+int compare_session_expected(const void *a, const void *b) {
+    const pair_t *pair_a = a, *pair_b = b;
+    if (pair_a->expected_ms != pair_b->expected_ms) {
+        return pair_a->expected_ms < pair_b->expected_ms ? 1 : -1;
+    }
+    return pair_a->exe_idx - pair_b->exe_idx;
+}
+
+
+// Fill session_order longest-expected-first and report the expected gain over
+// directory order
+void build_session_order(char **params) {
+    discover_executables(0);
+    pair_t *totals = malloc(num_executables * sizeof(pair_t));
+    long long *default_order_ms = malloc(num_executables * sizeof(long long));
+    long long *scheduled_ms = malloc(num_executables * sizeof(long long));
+    session_order = malloc(num_executables * sizeof(int));
+    if (totals == NULL || default_order_ms == NULL || scheduled_ms == NULL || session_order == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int e = 0; e < num_executables; e++) {
+        totals[e].exe_idx = e;
+        totals[e].expected_ms = 0;
+        for (int i = 0; i < total_params; i++) {
+            totals[e].expected_ms += history_expected_ms(&history, get_exe_name(results[e].exe_path), params[i]);
+        }
+        default_order_ms[e] = totals[e].expected_ms;
+    }
+    qsort(totals, num_executables, sizeof(pair_t), compare_session_expected);
+    for (int e = 0; e < num_executables; e++) {
+        session_order[e] = totals[e].exe_idx;
+        scheduled_ms[e] = totals[e].expected_ms;
+    }
+
+    report_makespan(default_order_ms, scheduled_ms, num_executables, controller.limit, 0);
+    free(totals);
+    free(default_order_ms);
+    free(scheduled_ms);
+}
+
+
+// Test every executable on every parameter with one process per executable and
+// at most controller.limit sessions at once, each parameter having its own timeout
+void run_sessions(char **params) {
+    // A session that dies between parameters must not kill the autograder
+    signal(SIGPIPE, SIG_IGN);
+
+    int batch_size = controller.max_limit;
+    session_t *sessions = malloc(batch_size * sizeof(session_t));
+    struct pollfd *pollfds = malloc(batch_size * sizeof(struct pollfd));
+    if (sessions == NULL || pollfds == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    if (history.num_loaded > 0) {
+        build_session_order(params);
+    }
+
+    int next_exe = 0;
+    for (int j = 0; j < batch_size; j++) {
+        sessions[j].exe_idx = -1;
+        sessions[j].pid = -1;
+        sessions[j].slot = j;
+        sessions[j].stderr_fd = capture_create_fd(&capture);
+    }
+    concurrency_begin_batch(&controller);
+    int active = fill_sessions(sessions, batch_size, 0, params, &next_exe);
+
+    while (active > 0) {
+        // Sleep until some session answers or the earliest deadline passes
+        long long now = monotonic_ms();
+        long long earliest = -1;
+        for (int j = 0; j < batch_size; j++) {
+            pollfds[j].fd = sessions[j].exe_idx == -1 ? -1 : sessions[j].from_child;
+            pollfds[j].events = POLLIN;
+            pollfds[j].revents = 0;
+            if (sessions[j].exe_idx != -1 && (earliest == -1 || sessions[j].deadline_ms < earliest)) {
+                earliest = sessions[j].deadline_ms;
+            }
+        }
+        int timeout = earliest - now > 0 ? (int) (earliest - now) : 0;
+        if (poll(pollfds, batch_size, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            exit(EXIT_FAILURE);
+        }
+
+        now = monotonic_ms();
+        for (int j = 0; j < batch_size; j++) {
+            session_t *session = &sessions[j];
+            if (session->exe_idx == -1) {
+                continue;
             }
 
-            // TODO (Change 3): Setup timer to determine if child process is stuck
-            start_timer(TIMEOUT_SECS, timeout_handler);  // Implement this function (src/utils.c)
+            int finished = 0;  // The current parameter was classified during this wakeup
+            if (pollfds[j].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[BUFSIZ];
+                ssize_t bytes_read = read(session->from_child, buffer, sizeof(buffer));
+                if (bytes_read == -1) {
+                    perror("Read Failed");
+                    exit(EXIT_FAILURE);
+                }
+
+                if (bytes_read == 0) {
+                    // Child died before answering -> classify like a one-shot run
+                    int status = stop_session(session);
+                    int final_status = INCORRECT;
+                    if (WIFSIGNALED(status)) {
+                        final_status = get_signal_status(WTERMSIG(status));
+                    }
+                    finish_session_param(session, final_status, params);
+                    finished = 1;
+                }
 
-            // TODO: Wait for the batch to finish and check results
-            monitor_and_evaluate_solutions(tested, argv[i], i - 2);
+                // The child only ever owes one line: more output with it is a wrong answer.
+                // RLIMIT_FSIZE doesn't cover pipes -> cap what a parameter may print here.
+                session->output_bytes += bytes_read;
+                int answered = 0;
+                for (ssize_t k = 0; k < bytes_read; k++) {
+                    if (buffer[k] == '\n') {
+                        session->line[session->line_len] = '\0';
+                        int final_status;
+                        if (oracle.dir != NULL) {
+                            // The expected output of a parameter is its line, newline included
+                            oracle_stream_feed(&session->answer, buffer, k + 1);
+                            final_status = oracle_stream_end(&session->answer);
+                        } else {
+                            final_status = get_output_status(session->line);
+                        }
+                        if (k + 1 < bytes_read) {
+                            final_status = INCORRECT;
+                        }
+                        finish_session_param(session, final_status, params);
+                        answered = 1;
+                        finished = 1;
+                        break;
+                    }
+                    if (session->line_len < MAX_INT_CHARS) {
+                        session->line[session->line_len++] = buffer[k];
+                    }
+                }
+                if (!answered && bytes_read > 0 && oracle.dir != NULL && !oracle_stream_feed(&session->answer, buffer, bytes_read)) {
+                    // Already wrong -> no need to wait for the rest of the line
+                    if (kill(session->pid, SIGKILL) == -1) {
+                        perror("Kill Failed");
+                        exit(EXIT_FAILURE);
+                    }
+                    stop_session(session);
+                    finish_session_param(session, INCORRECT, params);
+                    finished = 1;
+                } else if (!answered && bytes_read > 0 && options.output_limit > 0 && session->output_bytes > options.output_limit) {
+                    if (kill(session->pid, SIGKILL) == -1) {
+                        perror("Kill Failed");
+                        exit(EXIT_FAILURE);
+                    }
+                    stop_session(session);
+                    finish_session_param(session, OUTPUT_LIMIT, params);
+                    finished = 1;
+                }
+            }
+            // Checked on every wakeup: a child that keeps printing still times out
+            if (!finished && session->exe_idx != -1 && now >= session->deadline_ms) {
+                // Stuck on this parameter -> kill it, the next one gets a fresh process
+                if (kill(session->pid, SIGKILL) == -1) {
+                    perror("Kill Failed");
+                    exit(EXIT_FAILURE);
+                }
+                stop_session(session);
+                finish_session_param(session, STUCK_OR_INFINITE, params);
+            }
 
-            // TODO: Cancel the timer if all child processes have finished
-            if (child_status == NULL) {
-                cancel_timer();  // Implement this function (src/utils.c)
+            if (session->exe_idx == -1) {
+                active--;
             }
+        }
 
-            // TODO Unlink all output files in current batch (output/<executable>.<input>)
-            remove_output_files(results, tested, curr_batch_size, argv[i]);  // Implement this function (src/utils.c)
+        // Every limit parameters count as one batch for the controller
+        if (session_completed >= controller.limit) {
+            concurrency_end_batch(&controller, session_completed, session_timed_out, session_expected_timeouts);
+            session_completed = 0;
+            session_timed_out = 0;
+            session_expected_timeouts = 0;
+            concurrency_begin_batch(&controller);
+        }
+        active = fill_sessions(sessions, batch_size, active, params, &next_exe);
+    }
 
+    for (int j = 0; j < batch_size; j++) {
+        if (sessions[j].stderr_fd != -1) {
+            close(sessions[j].stderr_fd);
+        }
+    }
+    free(pollfds);
+    free(sessions);
+    free(session_order);
+}
 
-            // Adjust the remaining count after the batch has finished
-            remaining -= curr_batch_size;
+#endif
+
+
+int main(int argc, char *argv[]) {
+    int first_arg = parse_grader_options(argc, argv, &options);
+    // Parameters come after <testdir>, from --params=SPEC, or both
+    if (argc - first_arg < (options.params_spec != NULL ? 1 : 2)) {
+        printf("Usage: %s [options] <testdir> <p1> <p2> ... <pn>\n"
+               "       %s [options] --params=FIRST..LAST[:STEP]|random:COUNT:SEED[:MAX]|@FILE <testdir> [<p1> ...]\n",
+               argv[0], argv[0]);
+        return 1;
+    }
 
-            free(pids);
+    char *testdir = argv[first_arg];
+    char **params = load_params(options.params_spec, argv + first_arg + 1, argc - first_arg - 1, &total_params);
+
+    // TODO (Change 0): Implement get_batch_size() function
+    // Start at one child per processor and adapt from there, unless fixed
+    if (options.concurrency > 0) {
+        concurrency_init(&controller, options.concurrency, options.concurrency, 1);
+    } else {
+        int processors = get_batch_size();
+        concurrency_init(&controller, processors, MAX_CONCURRENCY_FACTOR * processors, 0);
+    }
+
+    num_cpu_domains = get_cpu_domains(options.pin, &cpu_domains);
+    metrics_start(&metrics, options.metrics_path, 1);
+    log_open(options.log_path, options.log_level, "autograder");
+    trace_open(options.trace_path, "autograder");
+
+    // Each executable stays open for the whole run (see open_executable())
+    raise_open_file_limit();
+
+    #ifdef SESSION
+        if (options.watch) {
+            fprintf(stderr, "--watch is not supported in SESSION mode, grading once\n");
         }
+    #endif
+
+    // The io_uring engine only reads the first bytes of each output ("0" / "1")
+    if (options.use_uring && options.expected_dir != NULL) {
+        fprintf(stderr, "--expected compares whole outputs, using the classic engine\n");
+        options.use_uring = 0;
     }
+    if (options.use_uring && uring_engine_init(controller.max_limit) == -1) {
+        fprintf(stderr, "io_uring engine unavailable, falling back to the classic engine\n");
+        options.use_uring = 0;
+    }
+    oracle_open(&oracle, options.expected_dir, options.ignore_whitespace, params, total_params);
+
+    // Executables are discovered batch by batch during the first parameter
+    open_executable_scanner(&scanner, testdir, options.exec_only);
+    num_executables = 0;
+    results = NULL;
 
     #ifdef REDIR
-        // TODO: Unlink all input files for REDIR case (<input>.in)
-        remove_input_files(argv + 2, total_params);  // Implement this function (src/utils.c)
+        // TODO: Create the input memfds and write the parameters to them
+        input_fds = create_input_files(params, total_params);  // Implement this function (src/utils.c)
     #endif
 
+    // With runtime history, schedule longest-expected-first (see history.h)
+    long long run_start_ms = monotonic_ms();
+    history_load(&history, options.history_path, options.prior_ms);
+
+    // With --resume, pairs journaled by the unfinished run are not tested again
+    journal_open(&journal, options.journal_path, options.resume, params, total_params);
+
+    capture_open(&capture, options.stderr_path, options.stderr_keep, options.stderr_budget, 1);
+    host_pool_open(&host_pool, options.host_pool && options.concurrency == 0, options.host_slots, 1, 1);
+
+    #ifdef SESSION
+        // One process per executable tests every parameter
+        run_sessions(params);
+    #else
+    alloc_batch_scratch(controller.max_limit);
+    if (history.num_loaded > 0) {
+        build_queue(params);
+    }
+
+    run_batches(params);
+    free(queue);
+    #endif
+
+    history_save(&history, monotonic_ms() - run_start_ms);
+
+    long long score_start = trace_begin();
     write_results_to_file(results, num_executables, total_params);
 
     // You can use this to debug your scores function
@@ -341,16 +1343,55 @@ int main(int argc, char *argv[]) {
 
     // Print each score to scores.txt
     write_scores_to_file(results, num_executables, "results.txt");
+    trace_end("score", "autograder", score_start, 0, NULL);
+
+    long long report_start = trace_begin();
+    write_report_to_file(options.report_path, results, num_executables, total_params, params);
+    trace_end("report", "autograder", report_start, 0, NULL);
+
+    // Every pair made it into results.txt -> nothing to resume
+    journal_close(&journal, 1);
+
+    #ifndef SESSION
+    if (options.watch) {
+        // The history was saved (and freed) with the full run's makespan
+        history.path = NULL;
+        host_pool_leave(&host_pool);  // Only counted as a grader while grading
+        watch_solutions(testdir, params);
+    }
+    #endif
+
+    #ifdef REDIR
+        // TODO: Close all input memfds for REDIR case
+        remove_input_files(input_fds, total_params);  // Implement this function (src/utils.c)
+    #endif
+
+    uring_engine_cleanup();
+    concurrency_cleanup(&controller);
+    metrics_stop(&metrics);
+    oracle_close(&oracle);
+    capture_close(&capture);
+    host_pool_close(&host_pool);
 
     // Free the results struct and its fields
     for (int i = 0; i < num_executables; i++) {
-        free(results[i].exe_path);
+        if (results[i].exe_fd != -1) {
+            close(results[i].exe_fd);
+        }
         free(results[i].params_tested);
         free(results[i].status);
     }
 
     free(results);
-    free(executable_paths);
+    exe_table_free(&scanner.table);
+    free(cpu_domains);
+    if (options.params_spec != NULL) {
+        free(params);
+    }
+    #ifndef SESSION
+        free_batch_scratch();
+    #endif
 
+    trace_write(NULL, 0);
     return 0;
 }
@@ -0,0 +1,138 @@
+#include "capture.h"
+
+
+void capture_open(capture_t *capture, char *path, long long keep, long long budget, int truncate) {
+    memset(capture, 0, sizeof(capture_t));
+    capture->fd = -1;
+    capture->keep = keep;
+    capture->budget = budget;
+    capture->limit = 2 * keep > CAPTURE_MEMFD_LIMIT ? 2 * keep : CAPTURE_MEMFD_LIMIT;
+    if (path == NULL) {
+        return;
+    }
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+    if (capture->fd == -1) {
+        perror("Failed to open stderr file");
+        exit(EXIT_FAILURE);
+    }
+    capture->path = path;
+}
+
+
+int capture_create_fd(capture_t *capture) {
+    if (capture->path == NULL) {
+        return -1;
+    }
+    int fd = memfd_create("child-stderr", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    // Sparse until written; sealed, no child can write past the limit or shrink it
+    if (fd == -1 || ftruncate(fd, capture->limit) == -1 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) == -1) {
+        perror("Failed to create stderr memfd");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+
+void capture_redirect(int fd) {
+    if (fd != -1 && dup2(fd, STDERR_FILENO) == -1) {
+        perror("Failed to redirect stderr");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Read len bytes at offset of fd into buf. Returns the number of bytes read.
+static size_t read_at(int fd, char *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t bytes_read = pread(fd, buf + done, len - done, offset + done);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            break;
+        }
+        done += bytes_read;
+    }
+    return done;
+}
+
+
+void capture_collect(capture_t *capture, int fd, const char *exe, const char *param) {
+    if (fd == -1) {
+        return;
+    }
+    // The children shared the fd's offset: it ends where they stopped writing
+    long long size = lseek(fd, 0, SEEK_CUR);
+    if (size <= 0) {
+        return;
+    }
+    if (size > capture->limit) {
+        size = capture->limit;
+    }
+    long long head = size > 2 * capture->keep ? capture->keep : size;
+    long long tail = size > 2 * capture->keep ? capture->keep : 0;
+
+    char header[PATH_MAX + 64];
+    int header_len = snprintf(header, sizeof(header), "==> %s %s (%lld bytes%s) <==\n", get_exe_name((char *) exe), param,
+                              size, size == capture->limit ? ", capped" : "");
+    char cut[64];
+    int cut_len = tail > 0 ? snprintf(cut, sizeof(cut), "\n... %lld bytes cut ...\n", size - head - tail) : 0;
+    long long record_len = header_len + head + cut_len + tail + 2;  // Newline at the end, blank line after
+
+    // Reserve room in the budget
+    if (atomic_fetch_add(&capture->used, record_len) + record_len > capture->budget) {
+        atomic_fetch_sub(&capture->used, record_len);
+        atomic_fetch_add(&capture->dropped, 1);
+        atomic_fetch_add(&capture->dropped_bytes, size);
+    } else {
+        char *record = (char *) malloc(record_len);
+        if (record == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        size_t len = header_len;
+        memcpy(record, header, header_len);
+        len += read_at(fd, record + len, head, 0);
+        if (tail > 0) {
+            memcpy(record + len, cut, cut_len);
+            len += cut_len;
+            len += read_at(fd, record + len, tail, size - tail);
+            atomic_fetch_add(&capture->cut_bytes, size - head - tail);
+        }
+        if (record[len - 1] != '\n') {
+            record[len++] = '\n';
+        }
+        record[len++] = '\n';
+        // One write per record: O_APPEND keeps records of threads and workers whole
+        if (write(capture->fd, record, len) == -1) {
+            perror("Failed to save child stderr");
+        }
+        free(record);
+        atomic_fetch_add(&capture->captured, 1);
+    }
+
+    // Free the pages and rewind for the slot's next child
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, size) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        perror("Failed to empty stderr memfd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+void capture_close(capture_t *capture) {
+    if (capture->path == NULL) {
+        return;
+    }
+    long long dropped = atomic_load(&capture->dropped);
+    long long cut_bytes = atomic_load(&capture->cut_bytes);
+    if (dropped > 0 || cut_bytes > 0) {
+        fprintf(stderr, "Child stderr in %s: %lld record(s) saved, %lld bytes cut from their middles, "
+                        "%lld record(s) (%lld bytes) dropped over the %lld byte budget\n",
+                capture->path, atomic_load(&capture->captured), cut_bytes, dropped,
+                atomic_load(&capture->dropped_bytes), capture->budget);
+    }
+    close(capture->fd);
+    capture->path = NULL;
+}
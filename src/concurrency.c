@@ -0,0 +1,131 @@
+#include "concurrency.h"
+
+
+static long long monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+// Read the cumulative "some" stall time (in microseconds) from a PSI file.
+// Returns 0 if the file is unavailable.
+static unsigned long long read_stall_us(int fd) {
+    if (fd == -1) {
+        return 0;
+    }
+    char buffer[256];
+    ssize_t bytes_read = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (bytes_read <= 0) {
+        return 0;
+    }
+    buffer[bytes_read] = '\0';
+
+    unsigned long long total = 0;
+    if (sscanf(buffer, "some avg10=%*f avg60=%*f avg300=%*f total=%llu", &total) != 1) {
+        return 0;
+    }
+    return total;
+}
+
+
+// Number of runnable tasks on the host ("running" in /proc/loadavg), -1 if unknown
+static int read_run_queue() {
+    FILE *fp = fopen("/proc/loadavg", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    int running = -1;
+    if (fscanf(fp, "%*f %*f %*f %d/%*d", &running) != 1) {
+        running = -1;
+    }
+    fclose(fp);
+    return running;
+}
+
+
+void concurrency_init(concurrency_t *controller, int initial, int max_limit, int fixed) {
+    memset(controller, 0, sizeof(concurrency_t));
+    controller->fixed = fixed;
+    controller->min_limit = 1;
+    controller->max_limit = max_limit < 1 ? 1 : max_limit;
+    controller->limit = initial < 1 ? 1 : initial;
+    if (controller->limit > controller->max_limit) {
+        controller->limit = controller->max_limit;
+    }
+
+    controller->psi_cpu_fd = -1;
+    controller->psi_memory_fd = -1;
+    if (!fixed) {
+        controller->psi_cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+        controller->psi_memory_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+
+void concurrency_begin_batch(concurrency_t *controller) {
+    if (controller->fixed) {
+        return;
+    }
+    controller->cpu_stall_us = read_stall_us(controller->psi_cpu_fd);
+    controller->memory_stall_us = read_stall_us(controller->psi_memory_fd);
+    controller->batch_start_us = monotonic_us();
+}
+
+
+int concurrency_end_batch(concurrency_t *controller, int completed, int timed_out, int expected_timeouts) {
+    if (controller->fixed || completed == 0) {
+        return controller->limit;
+    }
+
+    long long elapsed_us = monotonic_us() - controller->batch_start_us;
+    if (elapsed_us < 1) {
+        elapsed_us = 1;
+    }
+    double cpu_pressure = (double) (read_stall_us(controller->psi_cpu_fd) - controller->cpu_stall_us) / elapsed_us;
+    double memory_pressure = (double) (read_stall_us(controller->psi_memory_fd) - controller->memory_stall_us) / elapsed_us;
+
+    int run_queue = read_run_queue();
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Timeouts only count against the limit when they exceed what this run
+    // usually sees, so genuinely stuck submissions don't throttle everyone.
+    // Known hangers don't count at all, not even towards the usual rate.
+    int unexpected = timed_out - expected_timeouts;
+    int judged = completed - expected_timeouts;
+    int timeouts_spiked = 0;
+    if (judged > 0) {
+        double timeout_rate = (double) unexpected / judged;
+        timeouts_spiked = unexpected > 0 && timeout_rate > controller->timeout_baseline + TIMEOUT_RATE_BACKOFF;
+        controller->timeout_baseline = 0.8 * controller->timeout_baseline + 0.2 * timeout_rate;
+    }
+
+    int contended = cpu_pressure > CPU_PRESSURE_BACKOFF
+                 || memory_pressure > MEMORY_PRESSURE_BACKOFF
+                 || (run_queue != -1 && online_cpus > 0 && run_queue > RUN_QUEUE_BACKOFF * online_cpus)
+                 || timeouts_spiked;
+
+    if (contended) {
+        // Multiplicative decrease
+        controller->limit /= 2;
+        if (controller->limit < controller->min_limit) {
+            controller->limit = controller->min_limit;
+        }
+    } else if (completed >= controller->limit && controller->limit < controller->max_limit) {
+        // Additive increase, only when the batch actually used the whole limit
+        controller->limit++;
+    }
+    return controller->limit;
+}
+
+
+void concurrency_cleanup(concurrency_t *controller) {
+    if (controller->psi_cpu_fd != -1) {
+        close(controller->psi_cpu_fd);
+        controller->psi_cpu_fd = -1;
+    }
+    if (controller->psi_memory_fd != -1) {
+        close(controller->psi_memory_fd);
+        controller->psi_memory_fd = -1;
+    }
+}
@@ -0,0 +1,231 @@
+#include "history.h"
+
+
+static size_t hash_key(char *exe_name, char *param) {
+    // FNV-1a over "<executable>\t<param>"
+    size_t hash = 2166136261u;
+    for (char *c = exe_name; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    hash = (hash ^ (unsigned char) '\t') * 16777619u;
+    for (char *c = param; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash;
+}
+
+
+// Find the slot of (exe_name, param), or the empty slot where it belongs
+static history_entry_t *find_entry(runtime_history_t *history, char *exe_name, char *param) {
+    size_t name_len = strlen(exe_name);
+    size_t slot = hash_key(exe_name, param) & (history->size - 1);
+    while (history->entries[slot].key != NULL) {
+        char *key = history->entries[slot].key;
+        if (strncmp(key, exe_name, name_len) == 0 && key[name_len] == '\t' && strcmp(key + name_len + 1, param) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (history->size - 1);
+    }
+    return &history->entries[slot];
+}
+
+
+// Double the table once it is half full
+static void grow_if_needed(runtime_history_t *history) {
+    if (2 * (history->count + 1) <= history->size) {
+        return;
+    }
+    history_entry_t *old_entries = history->entries;
+    size_t old_size = history->size;
+
+    history->size = old_size == 0 ? 64 : 2 * old_size;
+    history->entries = (history_entry_t *) calloc(history->size, sizeof(history_entry_t));
+    if (history->entries == NULL) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_entries[i].key == NULL) {
+            continue;
+        }
+        char *tab = strchr(old_entries[i].key, '\t');
+        *tab = '\0';
+        history_entry_t *entry = find_entry(history, old_entries[i].key, tab + 1);
+        *tab = '\t';
+        *entry = old_entries[i];
+    }
+    free(old_entries);
+}
+
+
+static void insert_entry(runtime_history_t *history, char *exe_name, char *param, long long runtime_ms, int status) {
+    grow_if_needed(history);
+    history_entry_t *entry = find_entry(history, exe_name, param);
+    if (entry->key == NULL) {
+        size_t len = strlen(exe_name) + strlen(param) + 2;
+        entry->key = (char *) malloc(len);
+        if (entry->key == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(entry->key, len, "%s\t%s", exe_name, param);
+        history->count++;
+    }
+    entry->runtime_ms = runtime_ms;
+    entry->status = status;
+}
+
+
+void history_load(runtime_history_t *history, char *path, long long prior_ms) {
+    memset(history, 0, sizeof(runtime_history_t));
+    history->path = path;
+    history->prior_ms = prior_ms;
+    history->last_makespan_ms = -1;
+    grow_if_needed(history);
+    if (path == NULL) {
+        return;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT) {
+            perror("Failed to open runtime history");
+        }
+        return;
+    }
+    char line[PATH_MAX + 128];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "#makespan %lld", &history->last_makespan_ms) == 1) {
+            continue;
+        }
+        char *saveptr;
+        char *exe_name = strtok_r(line, "\t", &saveptr);
+        char *param = strtok_r(NULL, "\t", &saveptr);
+        char *runtime = strtok_r(NULL, "\t", &saveptr);
+        char *status = strtok_r(NULL, "\t", &saveptr);
+        if (exe_name == NULL || param == NULL || runtime == NULL || status == NULL) {
+            continue;  // Skip malformed lines instead of failing the run
+        }
+        insert_entry(history, exe_name, param, atoll(runtime), atoi(status));
+        history->num_loaded++;
+    }
+    fclose(fp);
+}
+
+
+long long history_expected_ms(runtime_history_t *history, char *exe_name, char *param) {
+    history_entry_t *entry = find_entry(history, exe_name, param);
+    return entry->key == NULL ? history->prior_ms : entry->runtime_ms;
+}
+
+
+int history_status(runtime_history_t *history, char *exe_name, char *param) {
+    if (history->entries == NULL) {
+        return 0;  // Saved (and freed) already
+    }
+    history_entry_t *entry = find_entry(history, exe_name, param);
+    return entry->key == NULL ? 0 : entry->status;
+}
+
+
+void history_record(runtime_history_t *history, char *exe_name, char *param, long long runtime_ms, int status) {
+    if (history->path == NULL || status == SKIPPED) {
+        return;
+    }
+    // Average with the previous runtime unless the outcome changed (e.g. a
+    // resubmission that no longer hangs)
+    history_entry_t *entry = find_entry(history, exe_name, param);
+    if (entry->key != NULL && entry->status == status) {
+        runtime_ms = (entry->runtime_ms + runtime_ms) / 2;
+    }
+    insert_entry(history, exe_name, param, runtime_ms, status);
+}
+
+
+void history_save(runtime_history_t *history, long long makespan_ms) {
+    if (history->path != NULL) {
+        // Write a temporary file and rename it so a crash never truncates the history
+        char tmp_path[PATH_MAX];
+        snprintf(tmp_path, PATH_MAX, "%s.tmp", history->path);
+        FILE *fp = fopen(tmp_path, "w");
+        if (fp == NULL) {
+            perror("Failed to save runtime history");
+        } else {
+            fprintf(fp, "#makespan %lld\n", makespan_ms);
+            for (size_t i = 0; i < history->size; i++) {
+                if (history->entries[i].key != NULL) {
+                    fprintf(fp, "%s\t%lld\t%d\n", history->entries[i].key, history->entries[i].runtime_ms, history->entries[i].status);
+                }
+            }
+            if (fclose(fp) == EOF || rename(tmp_path, history->path) == -1) {
+                perror("Failed to save runtime history");
+            }
+        }
+
+        if (history->last_makespan_ms >= 0) {
+            printf("Makespan: %lld ms (previous run: %lld ms)\n", makespan_ms, history->last_makespan_ms);
+        } else {
+            printf("Makespan: %lld ms\n", makespan_ms);
+        }
+    }
+
+    for (size_t i = 0; i < history->size; i++) {
+        free(history->entries[i].key);
+    }
+    free(history->entries);
+    history->entries = NULL;
+}
+
+
+long long estimate_makespan(long long *expected_ms, int n, int slots, int batched) {
+    if (slots < 1) {
+        slots = 1;
+    }
+    if (batched) {
+        long long makespan = 0;
+        for (int i = 0; i < n; i += slots) {
+            long long slowest = 0;
+            for (int j = i; j < n && j < i + slots; j++) {
+                if (expected_ms[j] > slowest) {
+                    slowest = expected_ms[j];
+                }
+            }
+            makespan += slowest;
+        }
+        return makespan;
+    }
+
+    // Greedy list scheduling: each pair goes to the slot that frees up first
+    long long *free_at = (long long *) calloc(slots, sizeof(long long));
+    if (free_at == NULL) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    long long makespan = 0;
+    for (int i = 0; i < n; i++) {
+        int earliest = 0;
+        for (int k = 1; k < slots; k++) {
+            if (free_at[k] < free_at[earliest]) {
+                earliest = k;
+            }
+        }
+        free_at[earliest] += expected_ms[i];
+        if (free_at[earliest] > makespan) {
+            makespan = free_at[earliest];
+        }
+    }
+    free(free_at);
+    return makespan;
+}
+
+
+void report_makespan(long long *default_order_ms, long long *scheduled_ms, int n, int slots, int batched) {
+    long long before = estimate_makespan(default_order_ms, n, slots, batched);
+    long long after = estimate_makespan(scheduled_ms, n, slots, batched);
+    printf("Expected makespan: %lld ms in directory order, %lld ms longest-expected-first", before, after);
+    if (before > 0) {
+        printf(" (%.1f%% shorter)", 100.0 * (before - after) / before);
+    }
+    printf("\n");
+}
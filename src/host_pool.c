@@ -0,0 +1,247 @@
+#include "host_pool.h"
+#include "concurrency.h"
+
+#define HOST_POOL_INIT_WAIT_MS 1000
+#define HOST_POOL_RECHECK_MS 100  // Threads over the share also notice other graders' releases
+
+
+// Apply delta to semaphore num of the pool. Returns -1 (errno EAGAIN) if flags
+// has IPC_NOWAIT and the semaphore is too low.
+static int adjust(host_pool_t *pool, int num, int delta, int flags) {
+    struct sembuf op = { .sem_num = num, .sem_op = delta, .sem_flg = SEM_UNDO | flags };
+    while (semop(pool->semid, &op, 1) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN) {
+            return -1;
+        }
+        perror("Host pool semop failed");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+
+// Create the semaphore set, or attach to the one another grader created.
+// Returns the set's id, or -1 if SysV semaphores are unavailable.
+static int attach_pool_set(int slots) {
+    int fd = open(HOST_POOL_KEY_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        fd = open(HOST_POOL_KEY_FILE, O_RDONLY | O_CREAT | O_CLOEXEC, 0666);
+    }
+    if (fd == -1) {
+        return -1;
+    }
+    fchmod(fd, 0666);  // Graders of other users share it too (best effort)
+    close(fd);
+    key_t key = ftok(HOST_POOL_KEY_FILE, 'G');
+    if (key == -1) {
+        return -1;
+    }
+
+    int semid = semget(key, 3, IPC_CREAT | IPC_EXCL | 0666);
+    if (semid != -1) {
+        // Without SEM_UNDO, the slots outlive us. semop() (unlike SETVAL) also
+        // sets sem_otime, which tells other graders the set is ready.
+        struct sembuf init[2] = { { .sem_num = HOST_POOL_FREE, .sem_op = slots },
+                                  { .sem_num = HOST_POOL_SLOTS, .sem_op = slots } };
+        if (semop(semid, init, 2) == -1) {
+            return -1;
+        }
+        return semid;
+    }
+    if (errno != EEXIST || (semid = semget(key, 3, 0)) == -1) {
+        return -1;
+    }
+
+    // Created a moment ago: wait for its creator to fill it
+    long long deadline_ms = monotonic_ms() + HOST_POOL_INIT_WAIT_MS;
+    struct semid_ds ds;
+    while (semctl(semid, 0, IPC_STAT, &ds) == 0 && ds.sem_otime == 0) {
+        if (monotonic_ms() > deadline_ms) {
+            return -1;
+        }
+        usleep(1000);
+    }
+    return semid;
+}
+
+
+// Size an idle pool (no grader in it, every slot free) to slots afresh, so an
+// earlier --host-slots or another host's size doesn't stick. Checked and done
+// in one semop(), nobody can join in between. Returns the pool's size.
+static int reseed_idle_pool(host_pool_t *pool, int slots) {
+    int current = semctl(pool->semid, HOST_POOL_SLOTS, GETVAL);
+    if (current == -1 || current == slots) {
+        return current;
+    }
+    struct sembuf reseed[7] = { { .sem_num = HOST_POOL_JOBS, .sem_op = 0, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_FREE, .sem_op = -current, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_FREE, .sem_op = 0, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_SLOTS, .sem_op = -current, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_SLOTS, .sem_op = 0, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_FREE, .sem_op = slots, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_SLOTS, .sem_op = slots, .sem_flg = IPC_NOWAIT } };
+    if (semop(pool->semid, reseed, 7) == -1) {
+        return current;  // In use: keep its size
+    }
+    return slots;
+}
+
+
+// Resize a pool in use to slots (--host-slots while other graders run). Shrinking
+// only works while the slots to remove are free.
+static void resize_pool(host_pool_t *pool, int slots) {
+    int delta = slots - pool->slots;
+    // Not undone at exit: it lasts until the pool is next idle (reseed_idle_pool())
+    struct sembuf resize[2] = { { .sem_num = HOST_POOL_FREE, .sem_op = delta, .sem_flg = IPC_NOWAIT },
+                                { .sem_num = HOST_POOL_SLOTS, .sem_op = delta, .sem_flg = IPC_NOWAIT } };
+    if (semop(pool->semid, resize, 2) == -1) {
+        fprintf(stderr, "Host pool: %d slots busy, keeping %d slots instead of %d\n", -delta, pool->slots, slots);
+        return;
+    }
+    pool->slots = slots;
+}
+
+
+void host_pool_open(host_pool_t *pool, int enabled, int slots, int join, int split) {
+    memset(pool, 0, sizeof(host_pool_t));
+    pool->semid = -1;
+    pool->split = split;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->released, NULL);
+    if (!enabled) {
+        return;
+    }
+    // As many children as one grader's adaptive limit may grow to on the CPUs it
+    // may use: the pool bounds graders together, it doesn't shrink any of them
+    // run alone
+    int size = slots > 0 ? slots : MAX_CONCURRENCY_FACTOR * get_batch_size();
+    pool->semid = attach_pool_set(size);
+    if (pool->semid == -1) {
+        perror("Host pool unavailable, not sharing processors with other graders");
+        return;
+    }
+    pool->slots = reseed_idle_pool(pool, size);
+    if (slots > 0 && slots != pool->slots) {
+        resize_pool(pool, slots);
+    }
+    if (pool->slots <= 0) {
+        pool->slots = 1;
+    }
+    atomic_init(&pool->held, 0);
+    if (join) {
+        host_pool_join(pool);
+    }
+}
+
+
+void host_pool_join(host_pool_t *pool) {
+    if (pool->semid != -1 && !pool->joined) {
+        adjust(pool, HOST_POOL_JOBS, 1, 0);
+        pool->joined = 1;
+    }
+}
+
+
+void host_pool_leave(host_pool_t *pool) {
+    if (pool->semid != -1 && pool->joined) {
+        adjust(pool, HOST_POOL_JOBS, -1, 0);
+        pool->joined = 0;
+    }
+}
+
+
+// Most slots this process should hold: the host's, split between graders (and
+// further between the local workers of one mq_autograder)
+static int fair_share(host_pool_t *pool) {
+    int graders = semctl(pool->semid, HOST_POOL_JOBS, GETVAL);
+    if (graders < 1) {
+        graders = 1;
+    }
+    // Read afresh: a grader idle in --watch mode may find the pool resized
+    int slots = semctl(pool->semid, HOST_POOL_SLOTS, GETVAL);
+    if (slots < 1) {
+        slots = 1;
+    }
+    int share = (slots + graders - 1) / graders;
+    if (pool->split > 1) {
+        share = (share + pool->split - 1) / pool->split;
+    }
+    return share;
+}
+
+
+int host_pool_try_acquire(host_pool_t *pool, int want) {
+    if (pool->semid == -1) {
+        return want;
+    }
+    int room = fair_share(pool) - atomic_load(&pool->held);
+    if (want > room) {
+        want = room;
+    }
+    int taken = 0;
+    while (taken < want && adjust(pool, HOST_POOL_FREE, -1, IPC_NOWAIT) == 0) {
+        taken++;
+    }
+    atomic_fetch_add(&pool->held, taken);
+    return taken;
+}
+
+
+int host_pool_acquire(host_pool_t *pool, int want) {
+    if (pool->semid == -1 || want <= 0) {
+        return want;
+    }
+    adjust(pool, HOST_POOL_FREE, -1, 0);
+    atomic_fetch_add(&pool->held, 1);
+    return 1 + host_pool_try_acquire(pool, want - 1);
+}
+
+
+void host_pool_acquire_thread(host_pool_t *pool) {
+    if (pool->semid == -1) {
+        return;
+    }
+    // One thread at a time: the one blocking on the pool is then the only one
+    pthread_mutex_lock(&pool->lock);
+    while (host_pool_try_acquire(pool, 1) == 0) {
+        if (atomic_load(&pool->held) == 0) {
+            adjust(pool, HOST_POOL_FREE, -1, 0);
+            atomic_fetch_add(&pool->held, 1);
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += HOST_POOL_RECHECK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&pool->released, &pool->lock, &deadline);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void host_pool_release(host_pool_t *pool, int n) {
+    if (pool->semid == -1 || n <= 0) {
+        return;
+    }
+    atomic_fetch_sub(&pool->held, n);
+    adjust(pool, HOST_POOL_FREE, n, 0);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->released);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void host_pool_close(host_pool_t *pool) {
+    if (pool->semid == -1) {
+        return;
+    }
+    host_pool_release(pool, atomic_load(&pool->held));
+    host_pool_leave(pool);
+    pool->semid = -1;
+}
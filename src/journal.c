@@ -0,0 +1,345 @@
+#include "journal.h"
+
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const journal_entry_t *) a)->key, ((const journal_entry_t *) b)->key);
+}
+
+
+// Start time of process pid (clock ticks since boot, field 22 of
+// /proc/<pid>/stat), -1 if there is no such process
+static long long process_start_time(int pid) {
+    char path[MAX_INT_CHARS + 16];
+    char stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t len = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    stat[len] = '\0';
+    // The command name (field 2) may hold spaces and parentheses -> count from its end
+    char *field = strrchr(stat, ')');
+    long long start_time = -1;
+    for (int i = 2; field != NULL && i < 22; i++) {
+        field = strchr(field + 1, ' ');
+    }
+    if (field == NULL || sscanf(field + 1, "%lld", &start_time) != 1) {
+        return -1;
+    }
+    return start_time;
+}
+
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+
+// Append a copy of name to a growing array of strings
+static void add_name(char ***names, int *num_names, int *capacity, char *name) {
+    if (*num_names == *capacity) {
+        *capacity = *capacity == 0 ? 64 : 2 * *capacity;
+        *names = (char **) realloc(*names, *capacity * sizeof(char *));
+        if (*names == NULL) {
+            fprintf(stderr, "Error occurred at line %d: realloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*names)[*num_names] = strdup(name);
+    if ((*names)[*num_names] == NULL) {
+        fprintf(stderr, "Error occurred at line %d: strdup failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    (*num_names)++;
+}
+
+
+static void free_names(char **names, int num_names) {
+    for (int i = 0; i < num_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+// Remove a message queue of the unfinished run. Its stray workers get EIDRM and exit.
+static void remove_orphaned_queue(int msqid) {
+    struct msqid_ds info;
+    if (msgctl(msqid, IPC_STAT, &info) == -1 || info.msg_perm.cuid != geteuid()) {
+        return;  // Already gone (or the id now belongs to someone else)
+    }
+    if (msgctl(msqid, IPC_RMID, NULL) == -1) {
+        perror("Failed to remove orphaned message queue");
+        return;
+    }
+    printf("Removed message queue %d of the unfinished run\n", msqid);
+}
+
+
+// Unlink the output/<executable>.<param> files the unfinished run left behind,
+// for the executables and params it recorded (both sorted)
+static void remove_orphaned_outputs(char **exe_names, int num_exe_names, char **params, int num_params) {
+    if (num_exe_names == 0 || num_params == 0) {
+        return;
+    }
+    DIR *dir = opendir("output");
+    if (dir == NULL) {
+        return;
+    }
+    int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Executable names may hold dots too -> try every split
+        char name[sizeof(entry->d_name)];
+        strcpy(name, entry->d_name);
+        for (char *dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+            *dot = '\0';
+            char *exe_name = name, *param = dot + 1;
+            int recorded = bsearch(&exe_name, exe_names, num_exe_names, sizeof(char *), compare_names) != NULL
+                           && bsearch(&param, params, num_params, sizeof(char *), compare_names) != NULL;
+            *dot = '.';
+            if (recorded) {
+                if (unlinkat(dirfd(dir), entry->d_name, 0) == -1) {
+                    perror("Failed to remove orphaned output file");
+                } else {
+                    removed++;
+                }
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    if (removed > 0) {
+        printf("Removed %d output files of the unfinished run\n", removed);
+    }
+}
+
+
+// Add a "<executable>\t<param>\t<status>" record to the entries to restore
+static void add_entry(journal_t *journal, char *line, int *capacity) {
+    char *status = strrchr(line, '\t');
+    if (status == NULL || status == line || strchr(line, '\t') == status) {
+        return;  // Malformed
+    }
+    int value = atoi(status + 1);
+    if (value < CORRECT || value > MAX_STATUS) {
+        return;
+    }
+    if (journal->num_entries == *capacity) {
+        *capacity = *capacity == 0 ? 64 : 2 * *capacity;
+        journal->entries = (journal_entry_t *) realloc(journal->entries, *capacity * sizeof(journal_entry_t));
+        if (journal->entries == NULL) {
+            fprintf(stderr, "Error occurred at line %d: realloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+    }
+    *status = '\0';
+    journal->entries[journal->num_entries].key = strdup(line);
+    journal->entries[journal->num_entries].status = value;
+    if (journal->entries[journal->num_entries].key == NULL) {
+        fprintf(stderr, "Error occurred at line %d: strdup failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    journal->num_entries++;
+}
+
+
+void journal_open(journal_t *journal, char *path, int resume, char **params, int total_params) {
+    memset(journal, 0, sizeof(journal_t));
+    journal->path = path;
+    journal->fd = -1;
+    if (path == NULL) {
+        return;
+    }
+
+    // Read what the previous run left behind. Only the last #run is of
+    // interest for cleaning up: earlier ones were cleaned up by the runs resuming them.
+    int owner_pid = 0;
+    long long owner_start_time = -1;
+    int *queues = NULL;
+    int num_queues = 0, queue_capacity = 0;
+    char **exe_names = NULL, **old_params = NULL;
+    int num_exe_names = 0, exe_capacity = 0, num_old_params = 0, param_capacity = 0;
+    int capacity = 0;
+    off_t complete_len = 0;  // Up to the last complete line (a crash can tear the last one)
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL && errno != ENOENT) {
+        perror("Failed to open journal");
+    }
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    while (fp != NULL && (len = getline(&line, &line_capacity, fp)) != -1) {
+        if (line[len - 1] != '\n') {
+            break;
+        }
+        complete_len += len;
+        line[len - 1] = '\0';
+
+        int msqid;
+        if (strncmp(line, "#run ", 5) == 0) {
+            owner_start_time = -1;
+            sscanf(line, "#run %d %lld", &owner_pid, &owner_start_time);
+            num_queues = 0;
+            free_names(exe_names, num_exe_names);
+            free_names(old_params, num_old_params);
+            exe_names = old_params = NULL;
+            num_exe_names = exe_capacity = num_old_params = param_capacity = 0;
+        } else if (sscanf(line, "#queue %d", &msqid) == 1) {
+            if (num_queues == queue_capacity) {
+                queue_capacity = queue_capacity == 0 ? 4 : 2 * queue_capacity;
+                queues = (int *) realloc(queues, queue_capacity * sizeof(int));
+                if (queues == NULL) {
+                    fprintf(stderr, "Error occurred at line %d: realloc failed\n", __LINE__ - 2);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            queues[num_queues++] = msqid;
+        } else if (strncmp(line, "#exe ", 5) == 0) {
+            add_name(&exe_names, &num_exe_names, &exe_capacity, line + 5);
+        } else if (strncmp(line, "#param ", 7) == 0) {
+            add_name(&old_params, &num_old_params, &param_capacity, line + 7);
+        } else if (resume && line[0] != '#') {
+            add_entry(journal, line, &capacity);
+        }
+    }
+    free(line);
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    // Same pid and start time -> the run that wrote it is still going (a pid alone may be reused)
+    long long start_time = owner_pid > 0 ? process_start_time(owner_pid) : -1;
+    int in_use = start_time != -1 && (owner_start_time == -1 || start_time == owner_start_time);
+    if (in_use) {
+        fprintf(stderr, "Journal %s is in use by running grader %d, running without a journal\n", path, owner_pid);
+    } else if (owner_pid > 0) {
+        for (int i = 0; i < num_queues; i++) {
+            remove_orphaned_queue(queues[i]);
+        }
+        qsort(exe_names, num_exe_names, sizeof(char *), compare_names);
+        qsort(old_params, num_old_params, sizeof(char *), compare_names);
+        remove_orphaned_outputs(exe_names, num_exe_names, old_params, num_old_params);
+    }
+    free(queues);
+    free_names(exe_names, num_exe_names);
+    free_names(old_params, num_old_params);
+    if (in_use) {
+        journal_close(journal, 0);
+        return;
+    }
+
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if (journal->fd == -1) {
+        perror("Failed to open journal");
+        return;
+    }
+    if (resume && ftruncate(journal->fd, complete_len) == -1) {
+        perror("Failed to truncate journal");
+    }
+    if (resume) {
+        qsort(journal->entries, journal->num_entries, sizeof(journal_entry_t), compare_entries);
+        printf("Resuming: %d pairs restored from %s\n", journal->num_entries, path);
+    }
+
+    // The header and parameters go out in BUFSIZ chunks (only complete lines count on resume)
+    char buffer[BUFSIZ];
+    int buffer_len = snprintf(buffer, sizeof(buffer), "#run %d %lld\n", (int) getpid(), process_start_time(getpid()));
+    for (int i = 0; i <= total_params; i++) {
+        int line_len = i < total_params ? (int) strlen(params[i]) + 8 : 0;
+        if (i == total_params || buffer_len + line_len > (int) sizeof(buffer)) {
+            if (write(journal->fd, buffer, buffer_len) != buffer_len) {
+                perror("Failed to write journal");
+            }
+            buffer_len = 0;
+        }
+        if (i < total_params && line_len <= (int) sizeof(buffer)) {
+            buffer_len += snprintf(buffer + buffer_len, sizeof(buffer) - buffer_len, "#param %s\n", params[i]);
+        }
+    }
+}
+
+
+void journal_note_queue(journal_t *journal, int msqid) {
+    if (journal->fd == -1 || msqid == -1) {
+        return;
+    }
+    char line[MAX_INT_CHARS + 10];
+    int len = snprintf(line, sizeof(line), "#queue %d\n", msqid);
+    if (write(journal->fd, line, len) != len) {
+        perror("Failed to write journal");
+    }
+}
+
+
+void journal_note_executable(journal_t *journal, char *exe_name) {
+    if (journal->fd == -1) {
+        return;
+    }
+    char line[PATH_MAX + 8];
+    int len = snprintf(line, sizeof(line), "#exe %s\n", exe_name);
+    if (len < (int) sizeof(line) && write(journal->fd, line, len) != len) {
+        perror("Failed to write journal");
+    }
+}
+
+
+int journal_restore(journal_t *journal, autograder_results_t *result, int param_idx, char *param,
+                    int total_params, grader_options_t *options) {
+    if (journal->num_entries == 0) {
+        return 0;
+    }
+    char key[2 * PATH_MAX];
+    snprintf(key, sizeof(key), "%s\t%s", get_exe_name(result->exe_path), param);
+    journal_entry_t target = {key, 0};
+    journal_entry_t *entry = (journal_entry_t *) bsearch(&target, journal->entries, journal->num_entries,
+                                                         sizeof(journal_entry_t), compare_entries);
+    if (entry == NULL) {
+        return 0;
+    }
+
+    result->status[param_idx] = entry->status;
+    result->params_tested[param_idx] = param;
+    if (entry->status == SKIPPED) {
+        result->failfast.skipped++;
+        result->failfast.stopped = 1;
+    } else {
+        failfast_record(&result->failfast, entry->status, total_params, options);
+    }
+    return 1;
+}
+
+
+void journal_record(journal_t *journal, char *exe_name, char *param, int status) {
+    if (journal->fd == -1) {
+        return;
+    }
+    // One write() per record: O_APPEND keeps it whole even if we die right after
+    char line[2 * PATH_MAX];
+    int len = snprintf(line, sizeof(line), "%s\t%s\t%d\n", exe_name, param, status);
+    if (write(journal->fd, line, len) != len) {
+        perror("Failed to write journal");
+    }
+}
+
+
+void journal_close(journal_t *journal, int finished) {
+    if (journal->fd != -1) {
+        close(journal->fd);
+        journal->fd = -1;
+        if (finished && unlink(journal->path) == -1) {
+            perror("Failed to remove journal");
+        }
+    }
+    for (int i = 0; i < journal->num_entries; i++) {
+        free(journal->entries[i].key);
+    }
+    free(journal->entries);
+    journal->entries = NULL;
+    journal->num_entries = 0;
+}
@@ -0,0 +1,227 @@
+#include "log.h"
+
+#define LOG_BATCH_SIZE 65536
+
+logger_t logger;
+
+static const char *level_names[] = {"error", "warn", "info", "debug"};
+
+
+// Write all of buf to fd
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;  // Nowhere left to complain
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+
+// Copy the ready records from the ring to batch and write them out. Returns the
+// number of records flushed.
+static int flush_ring(char *batch) {
+    int flushed = 0;
+    size_t len = 0;
+    for (;;) {
+        log_record_t *record = &logger.ring[logger.tail & (LOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) != logger.tail + 1) {
+            break;
+        }
+        if (len + record->len > LOG_BATCH_SIZE) {
+            write_all(logger.fd, batch, len);
+            len = 0;
+        }
+        memcpy(batch + len, record->text, record->len);
+        len += record->len;
+        // Hand the slot back to producers one lap ahead
+        atomic_store_explicit(&record->sequence, logger.tail + LOG_RING_SLOTS, memory_order_release);
+        logger.tail++;
+        flushed++;
+    }
+
+    long long dropped = atomic_exchange_explicit(&logger.dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        len += snprintf(batch + len, LOG_RECORD_SIZE, "ts=%lld.%03ld level=warn proc=%s pid=%d event=log_dropped count=%lld\n",
+                        (long long) now.tv_sec, now.tv_nsec / 1000000, logger.process_name, (int) logger.owner, dropped);
+    }
+    if (len > 0) {
+        write_all(logger.fd, batch, len);
+    }
+    return flushed;
+}
+
+
+static void *run_flusher(void *arg) {
+    char *batch = (char *) malloc(LOG_BATCH_SIZE + LOG_RECORD_SIZE);
+    if (batch == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_lock(&logger.lock);
+    while (!atomic_load(&logger.stopping)) {
+        pthread_mutex_unlock(&logger.lock);
+        flush_ring(batch);
+        pthread_mutex_lock(&logger.lock);
+        if (atomic_load(&logger.stopping)) {
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&logger.wake, &logger.lock, &deadline);
+    }
+    pthread_mutex_unlock(&logger.lock);
+    flush_ring(batch);
+    free(batch);
+    return NULL;
+}
+
+
+// Only the process that opened the log flushes it (not children forked since)
+static void close_at_exit() {
+    if (logger.ring != NULL && getpid() == logger.owner) {
+        log_close();
+    }
+}
+
+
+void log_open(char *path, char *level, char *process_name) {
+    logger.level = LOG_LEVEL_INFO;
+    if (level != NULL) {
+        logger.level = -1;
+        for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++) {
+            if (strcmp(level, level_names[i]) == 0) {
+                logger.level = i;
+            }
+        }
+        if (logger.level == -1) {
+            fprintf(stderr, "Unknown log level: %s (error, warn, info or debug)\n", level);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Spaces would split the proc=... field
+    snprintf(logger.process_name, sizeof(logger.process_name), "%s", process_name);
+    for (char *c = logger.process_name; *c != '\0'; c++) {
+        if (*c == ' ') {
+            *c = '_';
+        }
+    }
+
+    logger.fd = STDERR_FILENO;
+    if (path != NULL) {
+        logger.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (logger.fd == -1) {
+            perror("Failed to open log");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    logger.ring = (log_record_t *) malloc(LOG_RING_SLOTS * sizeof(log_record_t));
+    if (logger.ring == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned long i = 0; i < LOG_RING_SLOTS; i++) {
+        atomic_init(&logger.ring[i].sequence, i);
+    }
+    atomic_init(&logger.head, 0);
+    logger.tail = 0;
+    atomic_init(&logger.dropped, 0);
+    atomic_init(&logger.stopping, 0);
+    logger.owner = getpid();
+    pthread_mutex_init(&logger.lock, NULL);
+    pthread_cond_init(&logger.wake, NULL);
+
+    // The flusher never takes signals (SIGALRM and SIGINT are for the main thread)
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+    int error = pthread_create(&logger.flusher, NULL, run_flusher, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (error != 0) {
+        fprintf(stderr, "Failed to start log thread: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    atexit(close_at_exit);
+}
+
+
+void log_write(int level, const char *event, const char *fmt, ...) {
+    char text[LOG_RECORD_SIZE];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int len = snprintf(text, sizeof(text), "ts=%lld.%03ld level=%s proc=%s pid=%d event=%s ",
+                       (long long) now.tv_sec, now.tv_nsec / 1000000, level_names[level],
+                       logger.process_name, (int) logger.owner, event);
+    if (len < (int) sizeof(text)) {
+        va_list args;
+        va_start(args, fmt);
+        len += vsnprintf(text + len, sizeof(text) - len, fmt, args);
+        va_end(args);
+    }
+    if (len > (int) sizeof(text) - 1) {
+        len = sizeof(text) - 1;  // Truncated
+    }
+    text[len++] = '\n';
+
+    if (logger.ring == NULL) {
+        write_all(STDERR_FILENO, text, len);  // Not opened (yet), or already closed
+        return;
+    }
+
+    // Claim the next slot, unless the flusher hasn't freed it yet (ring full)
+    unsigned long pos = atomic_load_explicit(&logger.head, memory_order_relaxed);
+    log_record_t *record;
+    for (;;) {
+        record = &logger.ring[pos & (LOG_RING_SLOTS - 1)];
+        long diff = (long) (atomic_load_explicit(&record->sequence, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&logger.head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&logger.head, memory_order_relaxed);
+        }
+    }
+    memcpy(record->text, text, len);
+    record->len = len;
+    atomic_store_explicit(&record->sequence, pos + 1, memory_order_release);
+
+    // Wake the flusher early every half ring of records, before the ring can fill
+    if ((pos & (LOG_RING_SLOTS / 2 - 1)) == 0) {
+        pthread_cond_signal(&logger.wake);
+    }
+}
+
+
+void log_close() {
+    if (logger.ring == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&logger.lock);
+    atomic_store(&logger.stopping, 1);
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+    pthread_join(logger.flusher, NULL);
+
+    if (logger.fd != STDERR_FILENO) {
+        close(logger.fd);
+    }
+    free(logger.ring);
+    logger.ring = NULL;
+}
@@ -0,0 +1,332 @@
+#include "metrics.h"
+
+
+// Histogram bucket of a runtime: exact below 8 ms, then 8 buckets per power of
+// two (at most 12.5% wide)
+static int latency_bucket(long long ms) {
+    if (ms < 8) {
+        return ms < 0 ? 0 : (int) ms;
+    }
+    if (ms > INT_MAX) {
+        ms = INT_MAX;
+    }
+    int exponent = 63 - __builtin_clzll(ms);
+    return 8 + (exponent - 3) * 8 + (int) ((ms >> (exponent - 3)) & 7);
+}
+
+
+// Largest runtime falling in bucket
+static long long bucket_upper_ms(int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    int exponent = (bucket - 8) / 8 + 3;
+    return ((8LL + (bucket - 8) % 8 + 1) << (exponent - 3)) - 1;
+}
+
+
+// Runtime below which a fraction q of the runs in histogram fall
+static long long latency_percentile(long long *histogram, long long count, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    long long rank = (long long) (q * count);
+    if (rank < q * count || rank == 0) {
+        rank++;
+    }
+    long long seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen >= rank) {
+            return bucket_upper_ms(b);
+        }
+    }
+    return bucket_upper_ms(LATENCY_BUCKETS - 1);
+}
+
+
+// Aggregate the slots and print them in Prometheus text format or JSON
+static void write_metrics(metrics_t *metrics, FILE *out, int json) {
+    long long assigned = 0, done = 0, not_run = 0, busy_ms = 0;
+    long long status[MAX_STATUS + 1] = {0};
+    long long histogram[LATENCY_BUCKETS] = {0};
+    long long runs = 0;
+    for (int w = 0; w < metrics->num_slots; w++) {
+        metrics_slot_t *slot = &metrics->slots[w];
+        assigned += atomic_load_explicit(&slot->assigned, memory_order_relaxed);
+        done += atomic_load_explicit(&slot->done, memory_order_relaxed);
+        not_run += atomic_load_explicit(&slot->not_run, memory_order_relaxed);
+        busy_ms += atomic_load_explicit(&slot->busy_ms, memory_order_relaxed);
+        for (int s = CORRECT; s <= MAX_STATUS; s++) {
+            status[s] += atomic_load_explicit(&slot->status[s], memory_order_relaxed);
+        }
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            long long n = atomic_load_explicit(&slot->latency[b], memory_order_relaxed);
+            histogram[b] += n;
+            runs += n;
+        }
+    }
+    long long total = atomic_load_explicit(&metrics->total_pairs, memory_order_relaxed);
+    long long pending = total > assigned ? total - assigned : 0;
+    long long in_flight = assigned > done ? assigned - done : 0;
+    long long elapsed_ms = monotonic_ms() - metrics->start_ms;
+    if (elapsed_ms < 1) {
+        elapsed_ms = 1;
+    }
+    double pairs_per_sec = 1000.0 * (done - not_run) / elapsed_ms;
+    long long p50 = latency_percentile(histogram, runs, 0.50);
+    long long p99 = latency_percentile(histogram, runs, 0.99);
+
+    if (json) {
+        fprintf(out, "{\"pairs\": {\"total\": %lld, \"done\": %lld, \"in_flight\": %lld, \"pending\": %lld},\n",
+                total, done, in_flight, pending);
+        fprintf(out, " \"status\": {");
+        for (int s = CORRECT; s <= MAX_STATUS; s++) {
+            fprintf(out, "%s\"%s\": %lld", s == CORRECT ? "" : ", ", get_status_message(s), status[s]);
+        }
+        fprintf(out, "},\n \"pairs_per_second\": %.3f, \"runtime_ms\": {\"p50\": %lld, \"p99\": %lld},"
+                     " \"timeouts\": %lld, \"elapsed_seconds\": %.3f,\n \"workers\": [",
+                pairs_per_sec, p50, p99, status[STUCK_OR_INFINITE], elapsed_ms / 1000.0);
+        int first = 1;
+        for (int w = 0; w < metrics->num_slots; w++) {
+            metrics_slot_t *slot = &metrics->slots[w];
+            long long slot_assigned = atomic_load_explicit(&slot->assigned, memory_order_relaxed);
+            if (slot_assigned == 0) {
+                continue;
+            }
+            long long slot_busy_ms = atomic_load_explicit(&slot->busy_ms, memory_order_relaxed);
+            fprintf(out, "%s\n  {\"worker\": %d, \"assigned\": %lld, \"done\": %lld, \"busy_seconds\": %.3f,"
+                         " \"utilisation\": %.3f}", first ? "" : ",", w, slot_assigned,
+                    atomic_load_explicit(&slot->done, memory_order_relaxed), slot_busy_ms / 1000.0,
+                    (double) slot_busy_ms / elapsed_ms);
+            first = 0;
+        }
+        fprintf(out, "]}\n");
+        return;
+    }
+
+    fprintf(out, "# HELP autograder_pairs Pairs of the run by state\n# TYPE autograder_pairs gauge\n");
+    fprintf(out, "autograder_pairs{state=\"done\"} %lld\n", done);
+    fprintf(out, "autograder_pairs{state=\"in_flight\"} %lld\n", in_flight);
+    fprintf(out, "autograder_pairs{state=\"pending\"} %lld\n", pending);
+    fprintf(out, "# HELP autograder_pairs_status_total Classified pairs by status\n"
+                 "# TYPE autograder_pairs_status_total counter\n");
+    for (int s = CORRECT; s <= MAX_STATUS; s++) {
+        fprintf(out, "autograder_pairs_status_total{status=\"%s\"} %lld\n", get_status_message(s), status[s]);
+    }
+    fprintf(out, "# HELP autograder_pairs_per_second Pairs run per second since the start\n"
+                 "# TYPE autograder_pairs_per_second gauge\nautograder_pairs_per_second %.3f\n", pairs_per_sec);
+    fprintf(out, "# HELP autograder_child_runtime_ms Runtime of student processes\n"
+                 "# TYPE autograder_child_runtime_ms summary\n");
+    fprintf(out, "autograder_child_runtime_ms{quantile=\"0.5\"} %lld\n", p50);
+    fprintf(out, "autograder_child_runtime_ms{quantile=\"0.99\"} %lld\n", p99);
+    fprintf(out, "autograder_child_runtime_ms_sum %lld\nautograder_child_runtime_ms_count %lld\n", busy_ms, runs);
+    fprintf(out, "# HELP autograder_timeouts_total Children killed at the timeout\n"
+                 "# TYPE autograder_timeouts_total counter\nautograder_timeouts_total %lld\n", status[STUCK_OR_INFINITE]);
+    fprintf(out, "# HELP autograder_worker_busy_seconds_total Sum of the runtimes of a worker's children\n"
+                 "# TYPE autograder_worker_busy_seconds_total counter\n");
+    for (int w = 0; w < metrics->num_slots; w++) {
+        if (atomic_load_explicit(&metrics->slots[w].assigned, memory_order_relaxed) > 0) {
+            fprintf(out, "autograder_worker_busy_seconds_total{worker=\"%d\"} %.3f\n", w,
+                    atomic_load_explicit(&metrics->slots[w].busy_ms, memory_order_relaxed) / 1000.0);
+        }
+    }
+    fprintf(out, "# HELP autograder_worker_utilisation Average number of a worker's children running\n"
+                 "# TYPE autograder_worker_utilisation gauge\n");
+    for (int w = 0; w < metrics->num_slots; w++) {
+        if (atomic_load_explicit(&metrics->slots[w].assigned, memory_order_relaxed) > 0) {
+            fprintf(out, "autograder_worker_utilisation{worker=\"%d\"} %.3f\n", w,
+                    (double) atomic_load_explicit(&metrics->slots[w].busy_ms, memory_order_relaxed) / elapsed_ms);
+        }
+    }
+}
+
+
+// Answer one client: read its request (if any) and write the metrics
+static void serve_client(metrics_t *metrics, int client) {
+    char request[1024];
+    size_t len = 0;
+    struct pollfd pollfd = {client, POLLIN, 0};
+    while (len < sizeof(request) - 1 && poll(&pollfd, 1, 200) > 0) {
+        ssize_t bytes_read = read(client, request + len, sizeof(request) - 1 - len);
+        if (bytes_read <= 0) {
+            break;
+        }
+        len += bytes_read;
+        if (memchr(request, '\n', len) != NULL) {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    // "GET /path HTTP/1.x" (JSON if path ends in .json), or a bare "json" line
+    int http = strncmp(request, "GET ", 4) == 0;
+    int json;
+    if (http) {
+        size_t path_len = strcspn(request + 4, " ?\r\n");
+        json = path_len >= 5 && strncmp(request + 4 + path_len - 5, ".json", 5) == 0;
+    } else {
+        json = strncmp(request, "json", 4) == 0;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        perror("open_memstream failed");
+        return;
+    }
+    write_metrics(metrics, out, json);
+    fclose(out);
+
+    char header[256];
+    int header_len = 0;
+    if (http) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                              json ? "application/json" : "text/plain; version=0.0.4", body_len);
+    }
+    // MSG_NOSIGNAL: a client that hung up must not kill the grader with SIGPIPE
+    if (send(client, header, header_len, MSG_NOSIGNAL) == header_len) {
+        size_t sent = 0;
+        while (sent < body_len) {
+            ssize_t bytes_sent = send(client, body + sent, body_len - sent, MSG_NOSIGNAL);
+            if (bytes_sent <= 0) {
+                break;
+            }
+            sent += bytes_sent;
+        }
+    }
+    free(body);
+}
+
+
+static void *serve_metrics(void *arg) {
+    metrics_t *metrics = (metrics_t *) arg;
+    struct pollfd pollfds[2] = {{metrics->listen_fd, POLLIN, 0}, {metrics->stop_pipe[0], POLLIN, 0}};
+    while (1) {
+        if (poll(pollfds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            return NULL;
+        }
+        if (pollfds[1].revents != 0) {
+            return NULL;
+        }
+        if (pollfds[0].revents & POLLIN) {
+            int client = accept4(metrics->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client != -1) {
+                serve_client(metrics, client);
+                close(client);
+            }
+        }
+    }
+}
+
+
+void metrics_start(metrics_t *metrics, char *socket_path, int num_slots) {
+    memset(metrics, 0, sizeof(metrics_t));
+    metrics->listen_fd = -1;
+    if (socket_path == NULL) {
+        return;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Metrics socket path too long: %s\n", socket_path);
+        return;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    // A socket left behind by a crashed run would make bind() fail
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+    metrics->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (metrics->listen_fd == -1 || bind(metrics->listen_fd, (struct sockaddr *) &address, sizeof(address)) == -1
+        || listen(metrics->listen_fd, 16) == -1 || pipe2(metrics->stop_pipe, O_CLOEXEC) == -1) {
+        perror("Failed to serve metrics");
+        if (metrics->listen_fd != -1) {
+            close(metrics->listen_fd);
+            metrics->listen_fd = -1;
+        }
+        return;
+    }
+
+    metrics->slots = (metrics_slot_t *) aligned_alloc(64, num_slots * sizeof(metrics_slot_t));
+    if (metrics->slots == NULL) {
+        fprintf(stderr, "Error occurred at line %d: aligned_alloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    memset(metrics->slots, 0, num_slots * sizeof(metrics_slot_t));
+    metrics->num_slots = num_slots;
+    metrics->socket_path = socket_path;
+    metrics->start_ms = monotonic_ms();
+
+    // The server thread never takes signals (SIGALRM is for the main thread)
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+    int error = pthread_create(&metrics->thread, NULL, serve_metrics, metrics);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (error != 0) {
+        fprintf(stderr, "Failed to start metrics thread: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    printf("Serving metrics on %s\n", socket_path);
+}
+
+
+void metrics_set_total(metrics_t *metrics, long long total_pairs) {
+    if (metrics->slots != NULL) {
+        atomic_store_explicit(&metrics->total_pairs, total_pairs, memory_order_relaxed);
+    }
+}
+
+
+void metrics_assign(metrics_t *metrics, int slot, int count) {
+    if (metrics->slots != NULL) {
+        atomic_fetch_add_explicit(&metrics->slots[slot].assigned, count, memory_order_relaxed);
+    }
+}
+
+
+void metrics_record(metrics_t *metrics, int slot, int status, long long runtime_ms) {
+    if (metrics->slots == NULL || status < CORRECT || status > MAX_STATUS) {
+        return;
+    }
+    metrics_slot_t *counters = &metrics->slots[slot];
+    if (runtime_ms < 0) {
+        atomic_fetch_add_explicit(&counters->assigned, 1, memory_order_relaxed);
+    }
+    if (runtime_ms < 0 || status == SKIPPED) {
+        atomic_fetch_add_explicit(&counters->not_run, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&counters->busy_ms, runtime_ms, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->latency[latency_bucket(runtime_ms)], 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&counters->status[status], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->done, 1, memory_order_relaxed);
+}
+
+
+void metrics_stop(metrics_t *metrics) {
+    if (metrics->slots == NULL) {
+        return;
+    }
+    if (write(metrics->stop_pipe[1], "x", 1) == -1) {
+        perror("write failed");
+    }
+    pthread_join(metrics->thread, NULL);
+    close(metrics->stop_pipe[0]);
+    close(metrics->stop_pipe[1]);
+    close(metrics->listen_fd);
+    unlink(metrics->socket_path);
+    free(metrics->slots);
+    metrics->slots = NULL;
+}
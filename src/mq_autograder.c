@@ -1,4 +1,14 @@
 #include "utils.h"
+#include "transport.h"
+#include "history.h"
+#include "journal.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+#include "capture.h"
+#include "host_pool.h"
+#include "report.h"
+#include "concurrency.h"
 
 pid_t *workers;          // Workers determined by batch size
 int *worker_done;        // 1 for done, 0 for still running
@@ -9,38 +19,146 @@ autograder_results_t *results;
 int num_executables;      // Number of executables in test directory
 int total_params;         // Total number of parameters to test - (argc - 2)
 int num_workers;          // Number of workers to spawn
+int worker_capacity;      // --capacity of each local worker: its share of MAX_CONCURRENCY_FACTOR children per processor
 
+grader_options_t options; // Command line options (see utils.h)
+transport_t transport;    // SysV message queue, or sockets with --listen (see transport.h)
+runtime_history_t history; // Runtimes of previous runs, updated with this one (see history.h)
+journal_t journal;         // Every received status, to resume an unfinished run (see journal.h)
+metrics_t metrics;         // Live progress for --metrics: slot 0 for restored pairs, then one per worker
+capture_t capture;         // Children's stderr, appended to --stderr=FILE by local workers (see capture.h)
+host_pool_t host_pool;     // Counts this run as one grader; local workers take its slots (see host_pool.h)
 
-void launch_worker(int msqid, int pairs_per_worker, int worker_id) {
+// Expected runtime of pair p (executable p % num_executables on parameter
+// p / num_executables), used to send pairs longest-expected-first
+long long *pair_expected_ms;
+
+
+void launch_worker(int pairs_per_worker, int worker_id) {
     
-    pid_t pid = fork();
+    // Remote workers connected on their own (see transport_listen())
+    pid_t parent_pid = getpid();
+    pid_t pid = transport.type != TRANSPORT_SOCKET ? fork() : -2;
 
     // Child process
     if (pid == 0) {
+        // Don't outlive mq_autograder, stuck on a queue nobody reads. It may
+        // have died before prctl() already, we would have been reparented.
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1) {
+            perror("prctl failed");
+        }
+        if (getppid() != parent_pid) {
+            _exit(1);
+        }
 
         // TODO: exec() the worker program and pass it the message queue id and worker id.
         //       Use ./worker as the path to the worker program.
-        char msqid_str[MAX_INT_CHARS + 1];
+        char channel[PATH_MAX];
         char worker_id_str[MAX_INT_CHARS + 1];
-        snprintf(msqid_str, MAX_INT_CHARS, "%d", msqid);
+        transport_prepare_worker(&transport, worker_id, channel, sizeof(channel));
         snprintf(worker_id_str, MAX_INT_CHARS, "%d", worker_id);
-        execl("./worker", "worker", msqid_str, worker_id_str, NULL);
+        char concurrency[MAX_INT_CHARS + 16];
+        char capacity[MAX_INT_CHARS + 16];
+        char stop_after[MAX_INT_CHARS + 16];
+        char min_score[64];
+        char output_limit[32];
+        char expected_dir[PATH_MAX + 16];
+        char trace_path[PATH_MAX + 16];
+        char log_path[PATH_MAX + 16];
+        char log_level[32];
+        char stderr_path[PATH_MAX + 16];
+        char stderr_keep[48];
+        char stderr_budget[48];
+        char host_slots[48];
+        char host_pool_split[48];
+        char *worker_argv[24];
+        int worker_argc = 0;
+        worker_argv[worker_argc++] = "worker";
+        worker_argv[worker_argc++] = options.use_uring ? "--engine=uring" : "--engine=classic";
+        if (options.concurrency > 0) {
+            snprintf(concurrency, sizeof(concurrency), "--concurrency=%d", options.concurrency);
+            worker_argv[worker_argc++] = concurrency;
+        }
+        snprintf(capacity, sizeof(capacity), "--capacity=%d", worker_capacity);
+        worker_argv[worker_argc++] = capacity;
+        if (options.stop_after > 0) {
+            snprintf(stop_after, sizeof(stop_after), "--stop-after=%d", options.stop_after);
+            worker_argv[worker_argc++] = stop_after;
+        }
+        if (options.min_score > 0) {
+            snprintf(min_score, sizeof(min_score), "--min-score=%g", options.min_score);
+            worker_argv[worker_argc++] = min_score;
+        }
+        if (options.output_limit != DEFAULT_OUTPUT_LIMIT) {
+            snprintf(output_limit, sizeof(output_limit), "--output-limit=%lld", options.output_limit);
+            worker_argv[worker_argc++] = output_limit;
+        }
+        if (options.expected_dir != NULL) {
+            snprintf(expected_dir, sizeof(expected_dir), "--expected=%s", options.expected_dir);
+            worker_argv[worker_argc++] = expected_dir;
+        }
+        if (options.ignore_whitespace) {
+            worker_argv[worker_argc++] = "--ignore-whitespace";
+        }
+        if (options.pin != PIN_NONE) {
+            worker_argv[worker_argc++] = options.pin == PIN_L3 ? "--pin=l3" : "--pin=core";
+        }
+        if (options.trace_path != NULL) {
+            // Saved as <trace>.<pid>, merged by trace_write() at the end
+            snprintf(trace_path, sizeof(trace_path), "--trace=%s", options.trace_path);
+            worker_argv[worker_argc++] = trace_path;
+        }
+        if (options.log_path != NULL) {
+            snprintf(log_path, sizeof(log_path), "--log=%s", options.log_path);
+            worker_argv[worker_argc++] = log_path;
+        }
+        if (options.log_level != NULL) {
+            snprintf(log_level, sizeof(log_level), "--log-level=%s", options.log_level);
+            worker_argv[worker_argc++] = log_level;
+        }
+        if (options.stderr_path != NULL) {
+            // Workers append to the file truncated below, each within its share of the budget
+            snprintf(stderr_path, sizeof(stderr_path), "--stderr=%s", options.stderr_path);
+            snprintf(stderr_keep, sizeof(stderr_keep), "--stderr-keep=%lld", options.stderr_keep);
+            snprintf(stderr_budget, sizeof(stderr_budget), "--stderr-budget=%lld", options.stderr_budget / num_workers);
+            worker_argv[worker_argc++] = stderr_path;
+            worker_argv[worker_argc++] = stderr_keep;
+            worker_argv[worker_argc++] = stderr_budget;
+        } else {
+            worker_argv[worker_argc++] = "--inherit-stderr";
+        }
+        if (!options.host_pool) {
+            worker_argv[worker_argc++] = "--no-host-pool";
+        } else {
+            // The workers split this run's fair share of the host
+            snprintf(host_pool_split, sizeof(host_pool_split), "--host-pool-split=%d", num_workers);
+            worker_argv[worker_argc++] = host_pool_split;
+            if (options.host_slots > 0) {
+                snprintf(host_slots, sizeof(host_slots), "--host-slots=%d", options.host_slots);
+                worker_argv[worker_argc++] = host_slots;
+            }
+        }
+        worker_argv[worker_argc++] = channel;
+        worker_argv[worker_argc++] = worker_id_str;
+        worker_argv[worker_argc] = NULL;
+        execv("./worker", worker_argv);
         perror("Failed to spawn worker");
         exit(1);
     }
     // Parent process
-    else if (pid > 0) {
+    else if (pid > 0 || pid == -2) {
         // TODO: Send the total number of pairs to worker via message queue (mtype = worker_id)
         msgbuf_t msg;
         memset(&msg, 0, sizeof(msgbuf_t));
         msg.mtype = worker_id;
-        snprintf(msg.mtext, MESSAGE_SIZE, "%d", pairs_per_worker);
-        if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
+        snprintf(msg.mtext, MESSAGE_SIZE, "%d %d", pairs_per_worker, total_params);
+        if (transport_send(&transport, &msg) == -1) {
             perror("Failed to send message to worker");
             exit(1);
         }
-        // Store the worker's pid for monitoring
-        workers[worker_id - 1] = pid;
+        // Store the worker's pid for monitoring (-1 for remote workers)
+        workers[worker_id - 1] = pid > 0 ? pid : -1;
+        transport_release_worker(&transport, worker_id, workers[worker_id - 1]);
     }
     // Fork failed 
     else {
@@ -50,35 +168,87 @@ void launch_worker(int msqid, int pairs_per_worker, int worker_id) {
 }
 
 
+// Ship an executable to a remote worker that can't see it on a shared path.
+// The worker is told the content hash first and only asks for the bytes if its
+// cache doesn't already hold them.
+void send_executable_to_worker(long worker_id, char *exe_path) {
+    msgbuf_t msg;
+    memset(&msg, 0, sizeof(msgbuf_t));
+    msg.mtype = worker_id;
+
+    // Only executables under test are served, never arbitrary paths
+    int fd = -1;
+    for (int i = 0; i < num_executables && fd == -1; i++) {
+        if (strcmp(results[i].exe_path, exe_path) == 0) {
+            fd = open(exe_path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+    struct stat st;
+    char hash[HASH_HEX_LEN + 1];
+    if (fd == -1 || fstat(fd, &st) == -1 || hash_file(fd, hash) == -1) {
+        fprintf(stderr, "Worker %ld requested unavailable executable %s\n", worker_id, exe_path);
+        snprintf(msg.mtext, MESSAGE_SIZE, "NOFILE");
+    } else {
+        snprintf(msg.mtext, MESSAGE_SIZE, "FILE %s %lld", hash, (long long) st.st_size);
+    }
+    if (transport_send(&transport, &msg) == -1) {
+        perror("Failed to send message to worker");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(msg.mtext, "NOFILE") == 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+
+    if (transport_recv(&transport, &msg, worker_id, 0) == -1) {
+        perror("Failed to receive message from worker");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(msg.mtext, "SEND") == 0) {
+        log_info("executable_sent", "worker=%ld exe=%s bytes=%lld", worker_id, exe_path, (long long) st.st_size);
+        if (transport_send_file(&transport, worker_id, fd, st.st_size) == -1) {
+            perror("Failed to send executable to worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+}
+
+
 // TODO: Receive ACK from all workers using message queue (mtype = BROADCAST_MTYPE)
 void receive_ack_from_workers(int msqid, int num_workers) {
-    printf("Waiting for ACK from workers\n");
     int received = 0;
     while (received < num_workers) {
         msgbuf_t msg;
         memset(&msg, 0, sizeof(msgbuf_t));
-        if (msgrcv(msqid, &msg, sizeof(msg), BROADCAST_MTYPE + 1, 0) == -1) {
+        if (transport_recv(&transport, &msg, BROADCAST_MTYPE + 1, 0) == -1) {
             perror("Failed to receive message from worker");
             exit(EXIT_FAILURE);
         }
-        printf("Received: %s\n", msg.mtext);
+        log_debug("handshake_message", "text=%s", msg.mtext);
+        long worker_id;
+        char exe_path[MESSAGE_SIZE];
         if (strcmp(msg.mtext, "ACK") == 0) {
             received++;
+        } else if (sscanf(msg.mtext, "FETCH %ld %s", &worker_id, exe_path) == 2) {
+            send_executable_to_worker(worker_id, exe_path);
         }
-        printf("received: %d / %d\n", received, num_workers);
+        log_debug("acks_received", "received=%d workers=%d", received, num_workers);
     }
 }
 
 
 // TODO: Send SYNACK to all workers using message queue (mtype = BROADCAST_MTYPE)
 void send_synack_to_workers(int msqid, int num_workers) {
-    printf("Sending SYNACK to workers\n");
+    log_info("synack_sent", "workers=%d", num_workers);
     for (int i = 0; i < num_workers; i++) {
         msgbuf_t msg;
         memset(&msg, 0, sizeof(msgbuf_t));
         msg.mtype = BROADCAST_MTYPE;
         snprintf(msg.mtext, MESSAGE_SIZE, "SYNACK");
-        if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
+        if (transport_send(&transport, &msg) == -1) {
             perror("Failed to send message to worker");
             exit(EXIT_FAILURE);
         }
@@ -86,6 +256,16 @@ void send_synack_to_workers(int msqid, int num_workers) {
 }
 
 
+// Order pair indexes by expected runtime, longest first (ties keep directory order)
+int compare_expected(const void *a, const void *b) {
+    int pair_a = *(const int *) a, pair_b = *(const int *) b;
+    if (pair_expected_ms[pair_a] != pair_expected_ms[pair_b]) {
+        return pair_expected_ms[pair_a] < pair_expected_ms[pair_b] ? 1 : -1;
+    }
+    return pair_a - pair_b;
+}
+
+
 // Wait for all workers to finish and collect their results from message queue
 void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
     int received = 0;
@@ -99,13 +279,14 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
     }
 
     while (received < pairs_to_test) {
+        int received_before = received;
         for (int i = 0; i < num_workers; i++) {
             if (worker_done[i] == 1) {
                 continue;
             }
 
-            // Check if worker has finished
-            pid_t retpid = waitpid(workers[i], NULL, WNOHANG);
+            // Check if worker has finished (remote workers are never waited for)
+            pid_t retpid = workers[i] == -1 ? 0 : waitpid(workers[i], NULL, WNOHANG);
             
             int msgflg;
             if (retpid > 0)
@@ -122,16 +303,20 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
 
             // TODO: Receive results from worker and store them in the results struct.
             //       If message is "DONE", set worker_done[i] to 1 and break out of loop.
-            //       Messages will have the format ("%s %d %d", executable_path, parameter, status)
+            //       Messages will have the format ("%s %d %d %lld", executable_path, parameter index, status, runtime_ms)
             //       so consider using sscanf() to parse the message.
             while (1) {
                 msgbuf_t msg;
                 memset(&msg, 0, sizeof(msgbuf_t));
-                if (msgrcv(msqid, &msg, sizeof(msg), i + 1, msgflg) == -1) {
+                if (transport_recv(&transport, &msg, i + 1, msgflg) == -1) {
                     if (errno == ENOMSG) {
                         break;
                     }
-                    perror("Failed to receive message from worker");
+                    if (errno == ECONNRESET) {
+                        fprintf(stderr, "Worker %d disconnected before finishing\n", i + 1);
+                    } else {
+                        perror("Failed to receive message from worker");
+                    }
                     exit(1);
                 }
 
@@ -141,24 +326,34 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
                 }
 
                 char exe_path[MESSAGE_SIZE];
-                int param, status;
-                sscanf(msg.mtext, "%s %d %d", exe_path, &param, &status);
-                printf("Received: %s %d %d\n", exe_path, param, status);
+                int k = -1, status;
+                long long runtime_ms = 0;
+                sscanf(msg.mtext, "%s %d %d %lld", exe_path, &k, &status, &runtime_ms);
+                if (k < 0 || k >= total_params) {
+                    fprintf(stderr, "Worker %d sent a result for unknown parameter index %d\n", i + 1, k);
+                    exit(1);
+                }
+                log_debug("result_received", "worker=%d exe=%s param=%s status=%s", i + 1, exe_path, argv_params[k], get_status_message(status));
                 for (int j = 0; j < num_executables; j++) {
                     if (strcmp(results[j].exe_path, exe_path) == 0) {
-                        for (int k = 0; k < total_params; k++) {
-                            if (results[j].params_tested[k] == param) {
-                                results[j].status[k] = status;
-                                printf("Stored: %s %d %d\n", exe_path, param, status);
-                                break;
-                            }
+                        results[j].status[k] = status;
+                        if (status == SKIPPED) {
+                            results[j].failfast.skipped++;
                         }
+                        history_record(&history, get_exe_name(exe_path), argv_params[k], runtime_ms, status);
+                        journal_record(&journal, get_exe_name(exe_path), argv_params[k], status);
+                        metrics_record(&metrics, i + 1, status, runtime_ms);
                         break;
                     }
                 }
                 received++;
             }
         }
+
+        // Nothing arrived this round -> sleep until a socket has data
+        if (received == received_before) {
+            transport_wait(&transport, 100);
+        }
     }
 
     free(worker_done);
@@ -166,15 +361,34 @@ void wait_for_workers(int msqid, int pairs_to_test, char **argv_params) {
 
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        printf("Usage: %s <testdir> <p1> <p2> ... <pn>\n", argv[0]);
+    int first_arg = parse_grader_options(argc, argv, &options);
+    // Parameters come after <testdir>, from --params=SPEC, or both
+    if (argc - first_arg < (options.params_spec != NULL ? 1 : 2)) {
+        printf("Usage: %s [options] <testdir> <p1> <p2> ... <pn>\n"
+               "       %s [options] --params=FIRST..LAST[:STEP]|random:COUNT:SEED[:MAX]|@FILE <testdir> [<p1> ...]\n",
+               argv[0], argv[0]);
         return 1;
     }
 
-    char *testdir = argv[1];
-    total_params = argc - 2;
+    char *testdir = argv[first_arg];
+    char **params = load_params(options.params_spec, argv + first_arg + 1, argc - first_arg - 1, &total_params);
+
+    long long run_start_ms = monotonic_ms();
+    history_load(&history, options.history_path, options.prior_ms);
+
+    // With --resume, pairs journaled by the unfinished run are not tested again
+    journal_open(&journal, options.journal_path, options.resume, params, total_params);
 
-    char **executable_paths = get_student_executables(testdir, &num_executables);
+    // Local workers save their children's stderr here (see capture.h)
+    capture_open(&capture, options.stderr_path, options.stderr_keep, options.stderr_budget, 1);
+    host_pool_open(&host_pool, options.host_pool && options.concurrency == 0 && options.listen_address == NULL,
+                   options.host_slots, 1, 1);
+
+    exe_table_t executables;
+    num_executables = get_student_executables(testdir, &executables, options.exec_only);
+    for (int i = 0; i < num_executables; i++) {
+        journal_note_executable(&journal, get_exe_name(exe_table_path(&executables, i)));
+    }
 
     // Construct summary struct
     results = (autograder_results_t *) malloc(num_executables * sizeof(autograder_results_t));
@@ -183,14 +397,16 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     for (int i = 0; i < num_executables; i++) {
-        results[i].exe_path = executable_paths[i];
-        results[i].params_tested = (int *) malloc((total_params) * sizeof(int));
+        results[i].exe_path = exe_table_path(&executables, i);
+        results[i].exe_fd = -1;  // Executables are only launched by the workers
+        memset(&results[i].failfast, 0, sizeof(failfast_state_t));
+        results[i].params_tested = (char **) malloc((total_params) * sizeof(char *));
         if (results[i].params_tested == NULL) {
             fprintf(stderr, "Error occurred at line %d in file %s: malloc failed\n", __LINE__, __FILE__);
             exit(EXIT_FAILURE);
         }
         for (int j = 0; j < total_params; j++) {
-            results[i].params_tested[j] = atoi(argv[j + 2]);
+            results[i].params_tested[j] = params[j];
         }
         results[i].status = (int *) malloc((total_params) * sizeof(int));
         if (results[i].status == NULL) {
@@ -199,75 +415,194 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    num_workers = get_batch_size();
+    num_workers = options.num_workers > 0 ? options.num_workers : get_batch_size();
+    // Together, local workers grow to the same ceiling as autograder (one child each at least)
+    worker_capacity = MAX_CONCURRENCY_FACTOR * get_batch_size() / num_workers;
+    if (worker_capacity < 1) {
+        worker_capacity = 1;
+    }
+    metrics_start(&metrics, options.metrics_path, num_workers + 1);
+    log_open(options.log_path, options.log_level, "mq_autograder");
+    trace_open(options.trace_path, "mq_autograder");
+    metrics_set_total(&metrics, (long long) num_executables * total_params);
+
+    // Pair p is executable p % num_executables on parameter p / num_executables.
+    // Only those the journal can't restore are sent to workers.
+    int *pair_order = (int *) malloc(num_executables * total_params * sizeof(int));
+    pair_expected_ms = (long long *) malloc(num_executables * total_params * sizeof(long long));
+    if (pair_order == NULL || pair_expected_ms == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int num_pairs_to_test = 0;
+    for (int p = 0; p < num_executables * total_params; p++) {
+        if (!journal_restore(&journal, &results[p % num_executables], p / num_executables, params[p / num_executables],
+                             total_params, &options)) {
+            pair_order[num_pairs_to_test++] = p;
+        } else {
+            metrics_record(&metrics, 0, results[p % num_executables].status[p / num_executables], -1);
+        }
+    }
+
     // Check if some workers won't be used -> don't spawn them
-    if (num_workers > num_executables * total_params) {
-        num_workers = num_executables * total_params;
+    if (num_workers > num_pairs_to_test) {
+        num_workers = num_pairs_to_test;
     }
     workers = (pid_t *) malloc(num_workers * sizeof(pid_t));
-    if (workers == NULL) {
+    int *capacities = (int *) malloc(num_workers * sizeof(int));
+    int *quotas = (int *) malloc(num_workers * sizeof(int));
+    long long *credits = (long long *) calloc(num_workers, sizeof(long long));
+    if (workers == NULL || capacities == NULL || quotas == NULL || credits == NULL) {
         fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
         exit(EXIT_FAILURE);
     }
 
-    // Create a unique key for message queue
-    key_t key = IPC_PRIVATE;
+    int msqid = -1;
+    if (options.listen_address != NULL) {
+        // Workers connect over the network and announce their capacity
+        transport_listen(&transport, options.listen_address, num_workers, capacities);
+    } else {
+        int ipc = transport_type_from_name(options.ipc);
+        if (ipc == -1) {
+            fprintf(stderr, "Unknown IPC backend: %s (sysv, posix, seqpacket or shm)\n", options.ipc);
+            exit(EXIT_FAILURE);
+        }
+        if (ipc == TRANSPORT_SYSV) {
+            // Create a unique key for message queue
+            key_t key = IPC_PRIVATE;
+
+            // TODO: Create a message queue
+            msqid = msgget(key, 0666 | IPC_CREAT);
+            transport_open_sysv(&transport, msqid);
+            journal_note_queue(&journal, msqid);
+        } else {
+            transport_open_local(&transport, ipc, num_workers);
+        }
 
-    // TODO: Create a message queue
-    int msqid = msgget(key, 0666 | IPC_CREAT);
+        // Local workers are identical
+        for (int i = 0; i < num_workers; i++) {
+            capacities[i] = 1;
+        }
+    }
 
-    int num_pairs_to_test = num_executables * total_params;
+    // Split the pairs between workers in proportion to their capacity
+    long long total_capacity = 0;
+    for (int i = 0; i < num_workers; i++) {
+        total_capacity += capacities[i];
+    }
+    int assigned = 0;
+    for (int i = 0; i < num_workers; i++) {
+        quotas[i] = (int) ((long long) num_pairs_to_test * capacities[i] / total_capacity);
+        assigned += quotas[i];
+    }
+    for (int i = 0; assigned < num_pairs_to_test; i++, assigned++) {
+        quotas[i]++;
+    }
     
     // Spawn workers and send them the total number of (executable, parameter) pairs they will test
     for (int i = 0; i < num_workers; i++) {
-        int leftover = num_pairs_to_test % num_workers - i > 0 ? 1 : 0;
-        int pairs_per_worker = num_pairs_to_test / num_workers + leftover;
-
         // TODO: Spawn worker and send it the number of pairs it will test via message queue
-        launch_worker(msqid, pairs_per_worker, i + 1);
+        long long trace_start = trace_begin();
+        launch_worker(quotas[i], i + 1);
+        trace_end("launch worker", "mq_autograder", trace_start, 0, NULL);
     }
 
-    // Send (executable, parameter) pairs to workers
-    int sent = 0;
-    for (int i = 0; i < total_params; i++) {
-        for (int j = 0; j < num_executables; j++) {
-            msgbuf_t msg;
-            memset(&msg, 0, sizeof(msgbuf_t));
-            long worker_id = sent % num_workers + 1;
-            
-            // TODO: Send (executable, parameter) pair to worker via message queue (mtype = worker_id)
-            msg.mtype = worker_id;
-            snprintf(msg.mtext, MESSAGE_SIZE, "%s %s", executable_paths[j], argv[i + 2]);
-            if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
-                perror("Failed to send message to worker");
-                exit(EXIT_FAILURE);
+    // With runtime history, send the pairs longest-expected-first so workers start
+    // known hangers early. Without, every pair gets the prior -> directory order.
+    long long *default_order_ms = (long long *) malloc(num_pairs_to_test * sizeof(long long));
+    long long *scheduled_ms = (long long *) malloc(num_pairs_to_test * sizeof(long long));
+    if (default_order_ms == NULL || scheduled_ms == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < num_pairs_to_test; k++) {
+        int p = pair_order[k];
+        pair_expected_ms[p] = history_expected_ms(&history, get_exe_name(exe_table_path(&executables, p % num_executables)),
+                                                  params[p / num_executables]);
+        default_order_ms[k] = pair_expected_ms[p];
+    }
+    if (history.num_loaded > 0) {
+        qsort(pair_order, num_pairs_to_test, sizeof(int), compare_expected);
+        for (int k = 0; k < num_pairs_to_test; k++) {
+            scheduled_ms[k] = pair_expected_ms[pair_order[k]];
+        }
+        // Workers run independently, so model their children as free-running slots
+        int slots = 0;
+        for (int k = 0; k < num_workers; k++) {
+            slots += options.concurrency > 0 ? options.concurrency : (workers[k] == -1 ? capacities[k] : 1);
+        }
+        report_makespan(default_order_ms, scheduled_ms, num_pairs_to_test, slots, 0);
+    }
+
+    // Send (executable, parameter) pairs to workers. Smooth weighted round-robin
+    // keeps each worker's pairs spread over all parameters (plain round-robin when
+    // the quotas are equal).
+    long long dispatch_start = trace_begin();
+    for (int p = 0; p < num_pairs_to_test; p++) {
+        int i = pair_order[p] / num_executables;
+        int j = pair_order[p] % num_executables;
+        msgbuf_t msg;
+        memset(&msg, 0, sizeof(msgbuf_t));
+        int chosen = 0;
+        for (int k = 0; k < num_workers; k++) {
+            credits[k] += quotas[k];
+            if (credits[k] > credits[chosen]) {
+                chosen = k;
             }
-            sent++;
+        }
+        credits[chosen] -= num_pairs_to_test;
+        long worker_id = chosen + 1;
+        metrics_assign(&metrics, worker_id, 1);
+        
+        // TODO: Send (executable, parameter) pair to worker via message queue (mtype = worker_id)
+        msg.mtype = worker_id;
+        // Pairs the history expects to time out are flagged, so they don't throttle the worker
+        int expected_timeout = history_status(&history, get_exe_name(exe_table_path(&executables, j)), params[i]) == STUCK_OR_INFINITE;
+        snprintf(msg.mtext, MESSAGE_SIZE, "%s %d %s %d", exe_table_path(&executables, j), i, params[i], expected_timeout);
+        if (transport_send(&transport, &msg) == -1) {
+            perror("Failed to send message to worker");
+            exit(EXIT_FAILURE);
         }
     }
 
+    trace_end("dispatch", "mq_autograder", dispatch_start, 0, NULL);
+
     // TODO: Wait for ACK from workers to tell all workers to start testing (synchronization)
+    long long handshake_start = trace_begin();
     receive_ack_from_workers(msqid, num_workers);
 
     // TODO: Send message to workers to allow them to start testing
     send_synack_to_workers(msqid, num_workers);
+    trace_end("handshake", "mq_autograder", handshake_start, 0, NULL);
 
     // TODO: Wait for all workers to finish and collect their results from message queue
-    wait_for_workers(msqid, num_pairs_to_test, argv + 2);
+    long long collect_start = trace_begin();
+    wait_for_workers(msqid, num_pairs_to_test, params);
+    trace_end("collect", "mq_autograder", collect_start, 0, NULL);
 
 
     // TODO: Remove ALL output files (output/<executable>.<input>)
-    for (int i = 0; i < num_executables; i++) {
+    //       Remote workers remove their own, possibly on another machine.
+    long long cleanup_start = trace_begin();
+    for (int i = 0; i < num_executables && transport.type != TRANSPORT_SOCKET; i++) {
         for (int j = 0; j < total_params; j++) {
             char output_path[PATH_MAX];
-            snprintf(output_path, MESSAGE_SIZE, "output/%s.%s", get_exe_name(results[i].exe_path), argv[j + 2]);
-            if (unlink(output_path) == -1) {
+            snprintf(output_path, MESSAGE_SIZE, "output/%s.%s", get_exe_name(results[i].exe_path), params[j]);
+            if (unlink(output_path) == -1 && errno != ENOENT) {  // Skipped pairs have no output
                 perror("Failed to remove output file");
                 exit(EXIT_FAILURE);
             }
         }
     }
 
+    trace_end("cleanup", "mq_autograder", cleanup_start, 0, NULL);
+
+    metrics_stop(&metrics);
+    capture_close(&capture);
+    host_pool_close(&host_pool);
+    history_save(&history, monotonic_ms() - run_start_ms);
+
+    long long score_start = trace_begin();
     write_results_to_file(results, num_executables, total_params);
 
     // You can use this to debug your scores function
@@ -275,23 +610,40 @@ int main(int argc, char *argv[]) {
 
     // Print each score to scores.txt
     write_scores_to_file(results, num_executables, "results.txt");
+    trace_end("score", "mq_autograder", score_start, 0, NULL);
 
-    // TODO: Remove the message queue
-    if (msgctl(msqid, IPC_RMID, NULL) == -1) {
-        perror("Failed to remove message queue");
-        exit(1);
-    }
+    long long report_start = trace_begin();
+    write_report_to_file(options.report_path, results, num_executables, total_params, params);
+    trace_end("report", "mq_autograder", report_start, 0, NULL);
+
+    // Every pair made it into results.txt -> nothing to resume
+    journal_close(&journal, 1);
+
+    // TODO: Remove the message queue (or close the worker connections)
+    transport_close(&transport);
+
+    // Local workers saved their spans as they exited (remote ones keep theirs)
+    trace_write(workers, num_workers);
 
     // Free the results struct and its fields
     for (int i = 0; i < num_executables; i++) {
-        free(results[i].exe_path);
         free(results[i].params_tested);
         free(results[i].status);
     }
 
     free(results);
-    free(executable_paths);
+    exe_table_free(&executables);
     free(workers);
-    
+    free(capacities);
+    free(pair_order);
+    free(pair_expected_ms);
+    free(default_order_ms);
+    free(scheduled_ms);
+    free(quotas);
+    free(credits);
+    if (options.params_spec != NULL) {
+        free(params);
+    }
+
     return 0;
 }
\ No newline at end of file
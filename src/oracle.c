@@ -0,0 +1,185 @@
+#include "oracle.h"
+
+#define ORACLE_READ_SIZE 65536
+
+
+static oracle_expected_t *find_expected(oracle_t *oracle, char *param) {
+    for (int i = 0; i < oracle->num_expected; i++) {
+        if (strcmp(oracle->expected[i].param, param) == 0) {
+            return &oracle->expected[i];
+        }
+    }
+    return NULL;
+}
+
+
+// Replace expected->data by its tokens joined with single spaces
+static void normalize_expected(oracle_expected_t *expected) {
+    char *normalized = (char *) malloc(expected->len + 1);
+    if (normalized == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    size_t len = 0;
+    int pending_space = 0;
+    for (size_t i = 0; i < expected->len; i++) {
+        if (isspace((unsigned char) expected->data[i])) {
+            pending_space = len > 0;
+            continue;
+        }
+        if (pending_space) {
+            normalized[len++] = ' ';
+            pending_space = 0;
+        }
+        normalized[len++] = expected->data[i];
+    }
+    if (expected->mapped) {
+        munmap(expected->data, expected->len);
+    }
+    expected->data = normalized;
+    expected->len = len;
+    expected->mapped = 0;
+}
+
+
+void oracle_open(oracle_t *oracle, char *dir, int ignore_whitespace, char **params, int num_params) {
+    memset(oracle, 0, sizeof(oracle_t));
+    oracle->dir = dir;
+    oracle->ignore_whitespace = ignore_whitespace;
+    if (dir == NULL) {
+        return;
+    }
+    oracle->expected = (oracle_expected_t *) calloc(num_params, sizeof(oracle_expected_t));
+    if (oracle->expected == NULL) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_params; i++) {
+        if (find_expected(oracle, params[i]) != NULL) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, params[i]);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            fprintf(stderr, "No expected output for parameter %s: ", params[i]);
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+
+        oracle_expected_t *expected = &oracle->expected[oracle->num_expected++];
+        expected->param = params[i];
+        expected->len = st.st_size;
+        if (expected->len > 0) {
+            expected->data = mmap(NULL, expected->len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (expected->data == MAP_FAILED) {
+                perror("Failed to map expected output");
+                exit(EXIT_FAILURE);
+            }
+            expected->mapped = 1;
+        }
+        close(fd);
+        if (ignore_whitespace) {
+            normalize_expected(expected);
+        }
+    }
+}
+
+
+void oracle_stream_begin(oracle_t *oracle, oracle_stream_t *stream, char *param) {
+    memset(stream, 0, sizeof(oracle_stream_t));
+    stream->expected = find_expected(oracle, param);
+    stream->ignore_whitespace = oracle->ignore_whitespace;
+    if (stream->expected == NULL) {
+        fprintf(stderr, "No expected output for parameter %s\n", param);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Match n more bytes of output (whitespace already normalized)
+static int match(oracle_stream_t *stream, const char *buf, size_t n) {
+    if (n > stream->expected->len - stream->pos || memcmp(stream->expected->data + stream->pos, buf, n) != 0) {
+        stream->mismatch = 1;
+        return 0;
+    }
+    stream->pos += n;
+    return 1;
+}
+
+
+int oracle_stream_feed(oracle_stream_t *stream, const char *buf, size_t len) {
+    if (stream->mismatch) {
+        return 0;
+    }
+    if (!stream->ignore_whitespace) {
+        return match(stream, buf, len);
+    }
+
+    // Compare whole runs of non-whitespace at once; a run of whitespace between
+    // two of them matches the single space normalize_expected() left there
+    size_t i = 0;
+    while (i < len) {
+        if (isspace((unsigned char) buf[i])) {
+            stream->pending_space = stream->started;
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while (end < len && !isspace((unsigned char) buf[end])) {
+            end++;
+        }
+        if (stream->pending_space && !match(stream, " ", 1)) {
+            return 0;
+        }
+        if (!match(stream, buf + i, end - i)) {
+            return 0;
+        }
+        stream->pending_space = 0;
+        stream->started = 1;
+        i = end;
+    }
+    return 1;
+}
+
+
+int oracle_stream_end(oracle_stream_t *stream) {
+    return !stream->mismatch && stream->pos == stream->expected->len ? CORRECT : INCORRECT;
+}
+
+
+int oracle_compare_fd(oracle_t *oracle, char *param, int fd) {
+    oracle_stream_t stream;
+    oracle_stream_begin(oracle, &stream, param);
+    char buffer[ORACLE_READ_SIZE];
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Read Failed");
+            exit(EXIT_FAILURE);
+        }
+        if (!oracle_stream_feed(&stream, buffer, bytes_read)) {
+            break;
+        }
+    }
+    return oracle_stream_end(&stream);
+}
+
+
+void oracle_close(oracle_t *oracle) {
+    for (int i = 0; i < oracle->num_expected; i++) {
+        if (oracle->expected[i].mapped) {
+            munmap(oracle->expected[i].data, oracle->expected[i].len);
+        } else {
+            free(oracle->expected[i].data);
+        }
+    }
+    free(oracle->expected);
+    oracle->expected = NULL;
+    oracle->num_expected = 0;
+}
@@ -0,0 +1,353 @@
+#include "report.h"
+
+#define REPORT_BAR_WIDTH 40
+
+typedef struct {
+    int correct;          // Executables passing the parameter
+    int param_idx;
+} param_rank_t;
+
+typedef struct {
+    int first;            // First executable of the cluster (in results order)
+    int size;
+} cluster_t;
+
+
+static void *allocate(size_t nmemb, size_t size, int line) {
+    void *ptr = calloc(nmemb, size);
+    if (ptr == NULL && nmemb > 0) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", line);
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+
+static int popcount_words(const uint64_t *words, int num_words) {
+    int count = 0;
+    for (int w = 0; w < num_words; w++) {
+        count += __builtin_popcountll(words[w]);
+    }
+    return count;
+}
+
+
+// Transpose the 64 x 64 bit matrix a in place: bit c of a[r] becomes bit r of a[c]
+static void transpose64(uint64_t a[64]) {
+    uint64_t mask = 0x00000000FFFFFFFFULL;
+    for (int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+        for (int k = 0; k < 64; k = (k + j + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k + j]) & mask;
+            a[k] ^= t << j;
+            a[k + j] ^= t;
+        }
+    }
+}
+
+
+void report_build(report_t *report, autograder_results_t *results, int num_executables, int total_params) {
+    memset(report, 0, sizeof(report_t));
+    report->num_executables = num_executables;
+    report->total_params = total_params;
+    report->exe_words = (num_executables + 63) / 64;
+    report->row_words = (total_params + 63) / 64;
+    report->columns = (uint64_t *) allocate((size_t) REPORT_OUTCOMES * total_params * report->exe_words, sizeof(uint64_t), __LINE__);
+    report->rows = (uint64_t *) allocate((size_t) num_executables * REPORT_STATUS_BITS * report->row_words, sizeof(uint64_t), __LINE__);
+    size_t exe_words = report->exe_words, row_words = report->row_words;
+
+    // Rows: the only pass over the statuses, one executable after the other
+    for (int e = 0; e < num_executables; e++) {
+        int *status = results[e].status;
+        uint64_t *row = report->rows + (size_t) e * row_words * REPORT_STATUS_BITS;
+        for (int start = 0; start < total_params; start += 64) {
+            int len = total_params - start < 64 ? total_params - start : 64;
+            uint64_t planes[REPORT_STATUS_BITS] = {0, 0, 0};
+            for (int j = 0; j < len; j++) {
+                uint64_t s = (uint64_t) status[start + j];
+                planes[0] |= (s & 1) << j;
+                planes[1] |= ((s >> 1) & 1) << j;
+                planes[2] |= ((s >> 2) & 1) << j;
+            }
+            memcpy(row + start / 64 * REPORT_STATUS_BITS, planes, sizeof(planes));
+        }
+    }
+
+    // Columns: per 64 executables x 64 parameters, the mask of each outcome in
+    // the rows, transposed. Parameters outermost, so the stores of consecutive
+    // blocks go to consecutive words of each column.
+    uint64_t block[64];
+    for (size_t w = 0; w < row_words; w++) {
+        int num_params = total_params - (int) w * 64 < 64 ? total_params - (int) w * 64 : 64;
+        for (int first = 0; first < num_executables; first += 64) {
+            int num_rows = num_executables - first < 64 ? num_executables - first : 64;
+            for (int o = 0; o < REPORT_OUTCOMES; o++) {
+                uint64_t status = CORRECT + o;
+                memset(block, 0, sizeof(block));
+                for (int k = 0; k < num_rows; k++) {
+                    const uint64_t *planes = report->rows + ((size_t) (first + k) * row_words + w) * REPORT_STATUS_BITS;
+                    block[k] = ((status & 1) ? planes[0] : ~planes[0]) & ((status & 2) ? planes[1] : ~planes[1])
+                               & ((status & 4) ? planes[2] : ~planes[2]);
+                }
+                transpose64(block);
+                uint64_t *column = report->columns + ((size_t) o * total_params + w * 64) * exe_words + first / 64;
+                for (int j = 0; j < num_params; j++) {
+                    column[j * exe_words] = block[j];
+                }
+            }
+        }
+    }
+}
+
+
+// Parameters passed by executable e: status == CORRECT (001) in its row planes
+static int count_correct(report_t *report, int e) {
+    const uint64_t *row = report->rows + (size_t) e * report->row_words * REPORT_STATUS_BITS;
+    int correct = 0;
+    for (int w = 0; w < report->row_words; w++, row += REPORT_STATUS_BITS) {
+        correct += __builtin_popcountll(row[0] & ~row[1] & ~row[2]);
+    }
+    return correct;
+}
+
+
+static size_t hash_row(const uint64_t *row, int num_words) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int w = 0; w < num_words; w++) {
+        hash = (hash ^ row[w]) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+
+static int compare_ranks(const void *a, const void *b) {
+    const param_rank_t *x = (const param_rank_t *) a, *y = (const param_rank_t *) b;
+    if (x->correct != y->correct) {
+        return x->correct - y->correct;
+    }
+    return x->param_idx - y->param_idx;
+}
+
+
+static int compare_clusters(const void *a, const void *b) {
+    const cluster_t *x = (const cluster_t *) a, *y = (const cluster_t *) b;
+    if (x->size != y->size) {
+        return y->size - x->size;
+    }
+    return x->first - y->first;
+}
+
+
+static double percent(int count, int total) {
+    return total > 0 ? 100.0 * count / total : 0;
+}
+
+
+static void write_outcomes(report_t *report, FILE *file, char **params, int *counts) {
+    int num_executables = report->num_executables, total_params = report->total_params;
+    int width = 5;  // "param"
+    for (int j = 0; j < total_params; j++) {
+        int len = strlen(params[j]);
+        if (len > width) {
+            width = len;
+        }
+    }
+
+    fprintf(file, "Outcomes per parameter (%% of executables)\n%-*s", width, "param");
+    for (int o = 0; o < REPORT_OUTCOMES; o++) {
+        fprintf(file, " %10s", get_status_message(CORRECT + o));
+    }
+    fprintf(file, "\n%-*s", width, "all");
+    for (int o = 0; o < REPORT_OUTCOMES; o++) {
+        long long total = 0;
+        for (int j = 0; j < total_params; j++) {
+            total += counts[o * total_params + j];
+        }
+        fprintf(file, " %9.1f%%", num_executables > 0 ? 100.0 * total / ((long long) num_executables * total_params) : 0);
+    }
+    fprintf(file, "\n");
+    for (int j = 0; j < total_params; j++) {
+        fprintf(file, "%-*s", width, params[j]);
+        for (int o = 0; o < REPORT_OUTCOMES; o++) {
+            fprintf(file, " %9.1f%%", percent(counts[o * total_params + j], num_executables));
+        }
+        fprintf(file, "\n");
+    }
+}
+
+
+static void write_histogram(report_t *report, FILE *file, int *correct) {
+    int bins[REPORT_SCORE_BINS] = {0};
+    int highest = 0;
+    for (int e = 0; e < report->num_executables; e++) {
+        int bin = report->total_params > 0 ? correct[e] * REPORT_SCORE_BINS / report->total_params : 0;
+        if (bin == REPORT_SCORE_BINS) {
+            bin--;  // 1.0 goes with 0.9
+        }
+        if (++bins[bin] > highest) {
+            highest = bins[bin];
+        }
+    }
+
+    fprintf(file, "\nScores\n");
+    for (int b = 0; b < REPORT_SCORE_BINS; b++) {
+        char bar[REPORT_BAR_WIDTH + 1];
+        int bar_len = highest > 0 ? (int) ((long long) bins[b] * REPORT_BAR_WIDTH / highest) : 0;
+        memset(bar, '#', bar_len);
+        bar[bar_len] = '\0';
+        fprintf(file, "[%3.1f, %3.1f%c %-*s %d\n", (double) b / REPORT_SCORE_BINS, (double) (b + 1) / REPORT_SCORE_BINS,
+                b == REPORT_SCORE_BINS - 1 ? ']' : ')', REPORT_BAR_WIDTH, bar, bins[b]);
+    }
+}
+
+
+static void write_hardest(report_t *report, FILE *file, char **params, int *counts) {
+    int total_params = report->total_params;
+    param_rank_t *ranks = (param_rank_t *) allocate(total_params, sizeof(param_rank_t), __LINE__);
+    for (int j = 0; j < total_params; j++) {
+        ranks[j].correct = counts[j];  // Outcome 0 is CORRECT
+        ranks[j].param_idx = j;
+    }
+    qsort(ranks, total_params, sizeof(param_rank_t), compare_ranks);
+
+    fprintf(file, "\nHardest parameters\n");
+    for (int k = 0; k < total_params && k < REPORT_HARDEST; k++) {
+        int j = ranks[k].param_idx;
+        // Most common way to fail it
+        int failure = 1;
+        for (int o = 2; o < REPORT_OUTCOMES; o++) {
+            if (counts[o * total_params + j] > counts[failure * total_params + j]) {
+                failure = o;
+            }
+        }
+        fprintf(file, "%s: %.1f%% correct", params[j], percent(ranks[k].correct, report->num_executables));
+        if (counts[failure * total_params + j] > 0) {
+            fprintf(file, ", mostly %s (%.1f%%)", get_status_message(CORRECT + failure),
+                    percent(counts[failure * total_params + j], report->num_executables));
+        }
+        fprintf(file, "\n");
+    }
+    free(ranks);
+}
+
+
+static void write_clusters(report_t *report, FILE *file, autograder_results_t *results, int *correct) {
+    int num_executables = report->num_executables;
+    int vector_words = REPORT_STATUS_BITS * report->row_words;
+
+    // Group identical outcome vectors: open-addressed table of first executables + 1
+    size_t num_buckets = 64;
+    while (num_buckets < 2 * (size_t) num_executables) {
+        num_buckets *= 2;
+    }
+    int *buckets = (int *) allocate(num_buckets, sizeof(int), __LINE__);
+    int *next = (int *) allocate(num_executables, sizeof(int), __LINE__);   // Next member, -1 at the end
+    int *last = (int *) allocate(num_executables, sizeof(int), __LINE__);   // Of a first member: the cluster's last
+    int *size = (int *) allocate(num_executables, sizeof(int), __LINE__);   // Of a first member: the cluster's size
+    int num_vectors = 0;
+    for (int e = 0; e < num_executables; e++) {
+        const uint64_t *row = report->rows + (size_t) e * vector_words;
+        size_t slot = hash_row(row, vector_words) & (num_buckets - 1);
+        next[e] = -1;
+        while (buckets[slot] != 0) {
+            int first = buckets[slot] - 1;
+            if (memcmp(report->rows + (size_t) first * vector_words, row, vector_words * sizeof(uint64_t)) == 0) {
+                next[last[first]] = e;
+                last[first] = e;
+                size[first]++;
+                break;
+            }
+            slot = (slot + 1) & (num_buckets - 1);
+        }
+        if (buckets[slot] == 0) {
+            buckets[slot] = e + 1;
+            last[e] = e;
+            size[e] = 1;
+            num_vectors++;
+        }
+    }
+
+    cluster_t *clusters = (cluster_t *) allocate(num_vectors, sizeof(cluster_t), __LINE__);
+    int num_clusters = 0, clustered = 0;
+    for (int e = 0; e < num_executables; e++) {
+        if (size[e] > 1) {
+            clusters[num_clusters].first = e;
+            clusters[num_clusters++].size = size[e];
+            clustered += size[e];
+        }
+    }
+    qsort(clusters, num_clusters, sizeof(cluster_t), compare_clusters);
+
+    fprintf(file, "\nIdentical outcome vectors: %d distinct among %d executables, %d cluster(s) of 2 or more (%d executables)\n",
+            num_vectors, num_executables, num_clusters, clustered);
+    for (int c = 0; c < num_clusters && c < REPORT_CLUSTERS; c++) {
+        int first = clusters[c].first;
+        fprintf(file, "%d executables, score %5.3f:", clusters[c].size,
+                report->total_params > 0 ? (double) correct[first] / report->total_params : 0);
+        int named = 0;
+        for (int e = first; e != -1 && named < REPORT_CLUSTER_NAMES; e = next[e], named++) {
+            fprintf(file, " %s", get_exe_name(results[e].exe_path));
+        }
+        if (clusters[c].size > named) {
+            fprintf(file, " (and %d more)", clusters[c].size - named);
+        }
+        fprintf(file, "\n");
+    }
+
+    free(clusters);
+    free(buckets);
+    free(next);
+    free(last);
+    free(size);
+}
+
+
+void report_write(report_t *report, char *path, autograder_results_t *results, char **params) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to open report file");
+        return;
+    }
+    int num_executables = report->num_executables, total_params = report->total_params;
+    fprintf(file, "%d executables, %d parameters\n\n", num_executables, total_params);
+
+    // counts[o * total_params + j]: executables with outcome CORRECT + o on parameter j
+    int *counts = (int *) allocate((size_t) REPORT_OUTCOMES * total_params, sizeof(int), __LINE__);
+    for (int o = 0; o < REPORT_OUTCOMES; o++) {
+        for (int j = 0; j < total_params; j++) {
+            const uint64_t *column = report->columns + ((size_t) o * total_params + j) * report->exe_words;
+            counts[o * total_params + j] = popcount_words(column, report->exe_words);
+        }
+    }
+    int *correct = (int *) allocate(num_executables, sizeof(int), __LINE__);
+    for (int e = 0; e < num_executables; e++) {
+        correct[e] = count_correct(report, e);
+    }
+
+    write_outcomes(report, file, params, counts);
+    write_histogram(report, file, correct);
+    write_hardest(report, file, params, counts);
+    write_clusters(report, file, results, correct);
+
+    free(counts);
+    free(correct);
+    fclose(file);
+}
+
+
+void report_free(report_t *report) {
+    free(report->columns);
+    free(report->rows);
+    memset(report, 0, sizeof(report_t));
+}
+
+
+void write_report_to_file(char *path, autograder_results_t *results, int num_executables, int total_params, char **params) {
+    if (path == NULL) {
+        return;
+    }
+    report_t report;
+    report_build(&report, results, num_executables, total_params);
+    report_write(&report, path, results, params);
+    report_free(&report);
+}
@@ -0,0 +1,434 @@
+#include "utils.h"
+#include "history.h"
+#include "journal.h"
+#include "metrics.h"
+#include "oracle.h"
+#include "log.h"
+#include "capture.h"
+#include "host_pool.h"
+#include "report.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+/*
+Same job as mq_autograder without worker processes: a pool of threads (one per
+child slot) takes pairs off a shared queue, and each thread forks, times and
+reaps its own children through pidfds, then stores their statuses straight into
+the results table. No ./worker exec, no ACK/SYNACK handshake, no messages.
+
+The queue is the array of pairs to test, in schedule order (longest expected
+first with runtime history), and a cursor threads advance with fetch-and-add.
+
+With --expected, children write to a pipe instead of output/ and their thread
+compares the output as it arrives, killing the child at the first mismatch.
+*/
+
+// Stores the results of the autograder (see utils.h for details)
+autograder_results_t *results;
+
+int num_executables;      // Number of executables in test directory
+int total_params;         // Total number of parameters to test
+char **params;            // The parameters, as given on the command line
+int num_threads;          // Number of supervisor threads (one child each)
+
+grader_options_t options; // Command line options (see utils.h)
+runtime_history_t history; // Runtimes of previous runs, updated with this one (see history.h)
+journal_t journal;         // Every classified pair, to resume an unfinished run (see journal.h)
+metrics_t metrics;         // Live progress for --metrics: slot 0 for restored pairs, then one per thread
+oracle_t oracle;           // Expected outputs with --expected (see oracle.h)
+capture_t capture;         // Children's stderr, saved to --stderr=FILE (see capture.h)
+host_pool_t host_pool;     // Slots for children shared with the other graders on this host (see host_pool.h)
+
+// Pair p is executable p % num_executables on parameter p / num_executables
+int *pair_order;           // Pairs to test, in the order threads take them
+int num_pairs_to_test;
+atomic_int next_pair;      // Index in pair_order of the next pair to take
+long long *pair_expected_ms;
+
+// Guards what all threads update: the fail-fast states in results and the history.
+// Each status is written by the one thread that ran its pair.
+pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+cpu_set_t *cpu_domains;   // --pin: thread i (and its children) run on domain i
+int num_cpu_domains;
+
+
+// Order pair indexes by expected runtime, longest first (ties keep directory order)
+int compare_expected(const void *a, const void *b) {
+    int pair_a = *(const int *) a, pair_b = *(const int *) b;
+    if (pair_expected_ms[pair_a] != pair_expected_ms[pair_b]) {
+        return pair_expected_ms[pair_a] < pair_expected_ms[pair_b] ? 1 : -1;
+    }
+    return pair_a - pair_b;
+}
+
+
+// Fork the executable on param with STDOUT redirected to output_path, or to
+// the write end of out_pipe if output_path is NULL, and STDERR to stderr_fd
+pid_t launch_child(char *exe_path, char *param, char *output_path, int *out_pipe, int stderr_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        capture_redirect(stderr_fd);
+        // exec_solution() ties the child to the forking thread (PR_SET_PDEATHSIG),
+        // which reaps it before exiting -> only killed if the autograder dies
+        int fd = output_path != NULL ? open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : out_pipe[1];
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+            perror("Failed to redirect output");
+            _exit(EXIT_FAILURE);
+        }
+        close(fd);
+        limit_output_size(options.output_limit);
+        char *exec_argv[] = {get_exe_name(exe_path), param, NULL};
+        exec_solution(-1, exe_path, exec_argv);
+        perror("Failed to execute program");
+        _exit(EXIT_FAILURE);
+    } else if (pid == -1) {
+        perror("Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+
+// Wait for the child behind pidfd, killing it after TIMEOUT_SECS, and classify it.
+// With the oracle, its output is compared while it runs from out_fd (the read
+// end of its stdout pipe), otherwise read from output_path once it exits.
+int supervise_child(int pidfd, char *output_path, int out_fd, char *param) {
+    struct pollfd pfds[2] = { { .fd = pidfd, .events = POLLIN }, { .fd = out_fd, .events = POLLIN } };
+    long long deadline_ms = monotonic_ms() + TIMEOUT_SECS * 1000LL;
+    oracle_stream_t answer;
+    long long output_bytes = 0;
+    int verdict = 0;  // Status decided before the child exited (killed by us), 0 if none
+    if (out_fd != -1) {
+        oracle_stream_begin(&oracle, &answer, param);
+    }
+
+    while (1) {
+        long long left_ms = deadline_ms - monotonic_ms();
+        int ready = poll(pfds, out_fd != -1 ? 2 : 1, (int) (left_ms > 0 ? left_ms : 0));
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        } else if (ready == -1) {
+            perror("poll failed");
+            exit(EXIT_FAILURE);
+        }
+        if (ready == 0) {
+            verdict = STUCK_OR_INFINITE;
+        } else if (out_fd != -1 && pfds[1].revents) {
+            char buffer[BUFSIZ];
+            ssize_t bytes_read = read(out_fd, buffer, sizeof(buffer));
+            if (bytes_read == -1 && errno != EINTR) {
+                perror("Read Failed");
+                exit(EXIT_FAILURE);
+            }
+            if (bytes_read == 0) {
+                pfds[1].fd = -1;  // EOF, wait for the exit
+            } else if (bytes_read > 0) {
+                // RLIMIT_FSIZE doesn't cover pipes -> enforce --output-limit here
+                output_bytes += bytes_read;
+                if (!oracle_stream_feed(&answer, buffer, bytes_read)) {
+                    verdict = INCORRECT;
+                } else if (options.output_limit > 0 && output_bytes > options.output_limit) {
+                    verdict = OUTPUT_LIMIT;
+                }
+            }
+            if (verdict == 0) {
+                continue;
+            }
+        } else if (!pfds[0].revents) {
+            continue;
+        }
+        break;
+    }
+    if (verdict != 0 && syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0) == -1 && errno != ESRCH) {
+        perror("Kill Failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Reaps exactly this child: the other threads' children are left alone
+    siginfo_t info;
+    memset(&info, 0, sizeof(siginfo_t));
+    while (waitid(P_PIDFD, pidfd, &info, WEXITED) == -1) {
+        if (errno != EINTR) {
+            perror("waitid failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (verdict != 0 && (info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED)) {
+        return verdict;  // Our SIGKILL (or the child died of something else first)
+    }
+    if (info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED) {
+        return get_signal_status(info.si_status);
+    }
+    if (out_fd != -1) {
+        // Exited: whatever it wrote last is still in the pipe
+        char buffer[BUFSIZ];
+        ssize_t bytes_read;
+        while (pfds[1].fd != -1 && (bytes_read = read(out_fd, buffer, sizeof(buffer))) > 0
+               && oracle_stream_feed(&answer, buffer, bytes_read)) {
+        }
+        return oracle_stream_end(&answer);
+    }
+    int fd = open(output_path, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open output file");
+        exit(EXIT_FAILURE);
+    }
+    char output[MAX_INT_CHARS + 1];
+    ssize_t bytes_read = read(fd, output, MAX_INT_CHARS);
+    if (bytes_read == -1) {
+        perror("Read Failed");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    output[bytes_read] = '\0';
+    return get_output_status(output);
+}
+
+
+// Store the status of pair p, found by thread slot
+void store_status(int p, int status, long long runtime_ms, int slot) {
+    autograder_results_t *result = &results[p % num_executables];
+    char *param = params[p / num_executables];
+    result->status[p / num_executables] = status;
+
+    pthread_mutex_lock(&results_lock);
+    if (status == SKIPPED) {
+        result->failfast.skipped++;
+    } else {
+        failfast_record(&result->failfast, status, total_params, &options);
+    }
+    history_record(&history, get_exe_name(result->exe_path), param, runtime_ms, status);
+    pthread_mutex_unlock(&results_lock);
+
+    journal_record(&journal, get_exe_name(result->exe_path), param, status);
+    metrics_record(&metrics, slot, status, status == SKIPPED ? -1 : runtime_ms);
+}
+
+
+void *supervisor_thread(void *arg) {
+    int slot = (int) (long) arg;
+
+    // Children inherit the thread's affinity
+    pin_to_cpu_domain(cpu_domains, num_cpu_domains, slot - 1);
+    int stderr_fd = capture_create_fd(&capture);
+
+    int k;
+    while ((k = atomic_fetch_add(&next_pair, 1)) < num_pairs_to_test) {
+        int p = pair_order[k];
+        autograder_results_t *result = &results[p % num_executables];
+        char *param = params[p / num_executables];
+
+        pthread_mutex_lock(&results_lock);
+        int stopped = result->failfast.stopped;
+        pthread_mutex_unlock(&results_lock);
+        if (stopped) {
+            store_status(p, SKIPPED, 0, slot);
+            continue;
+        }
+
+        char output_path[PATH_MAX];
+        snprintf(output_path, sizeof(output_path), "output/%s.%s", get_exe_name(result->exe_path), param);
+        // Close-on-exec so the other threads' children don't hold the pipe open
+        int out_pipe[2] = {-1, -1};
+        if (oracle.dir != NULL && pipe2(out_pipe, O_CLOEXEC) == -1) {
+            perror("pipe failed");
+            exit(EXIT_FAILURE);
+        }
+        metrics_assign(&metrics, slot, 1);
+        host_pool_acquire_thread(&host_pool);
+        long long start_ms = monotonic_ms();
+        pid_t pid = launch_child(result->exe_path, param, oracle.dir != NULL ? NULL : output_path, out_pipe, stderr_fd);
+        int pidfd = syscall(SYS_pidfd_open, pid, 0);
+        if (pidfd == -1) {
+            perror("pidfd_open failed");
+            exit(EXIT_FAILURE);
+        }
+        if (out_pipe[1] != -1) {
+            close(out_pipe[1]);
+        }
+        int status = supervise_child(pidfd, output_path, out_pipe[0], param);
+        close(pidfd);
+        if (out_pipe[0] != -1) {
+            close(out_pipe[0]);
+        }
+        store_status(p, status, monotonic_ms() - start_ms, slot);
+        host_pool_release(&host_pool, 1);
+        capture_collect(&capture, stderr_fd, result->exe_path, param);
+        log_debug("pair_done", "thread=%d exe=%s param=%s status=%s", slot, result->exe_path, param, get_status_message(status));
+    }
+    if (stderr_fd != -1) {
+        close(stderr_fd);
+    }
+    return NULL;
+}
+
+
+int main(int argc, char *argv[]) {
+    int first_arg = parse_grader_options(argc, argv, &options);
+    // Parameters come after <testdir>, from --params=SPEC, or both
+    if (argc - first_arg < (options.params_spec != NULL ? 1 : 2)) {
+        printf("Usage: %s [options] <testdir> <p1> <p2> ... <pn>\n"
+               "       %s [options] --params=FIRST..LAST[:STEP]|random:COUNT:SEED[:MAX]|@FILE <testdir> [<p1> ...]\n",
+               argv[0], argv[0]);
+        return 1;
+    }
+
+    char *testdir = argv[first_arg];
+    params = load_params(options.params_spec, argv + first_arg + 1, argc - first_arg - 1, &total_params);
+
+    log_open(options.log_path, options.log_level, "thread_autograder");
+
+    long long run_start_ms = monotonic_ms();
+    history_load(&history, options.history_path, options.prior_ms);
+
+    // With --resume, pairs journaled by the unfinished run are not tested again
+    journal_open(&journal, options.journal_path, options.resume, params, total_params);
+
+    oracle_open(&oracle, options.expected_dir, options.ignore_whitespace, params, total_params);
+    capture_open(&capture, options.stderr_path, options.stderr_keep, options.stderr_budget, 1);
+    host_pool_open(&host_pool, options.host_pool && options.concurrency == 0, options.host_slots, 1, 1);
+
+    exe_table_t executables;
+    num_executables = get_student_executables(testdir, &executables, options.exec_only);
+    for (int i = 0; i < num_executables; i++) {
+        journal_note_executable(&journal, get_exe_name(exe_table_path(&executables, i)));
+    }
+    if (mkdir("output", 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create output directory");
+        exit(EXIT_FAILURE);
+    }
+
+    // Construct summary struct
+    results = (autograder_results_t *) malloc(num_executables * sizeof(autograder_results_t));
+    if (results == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_executables; i++) {
+        results[i].exe_path = exe_table_path(&executables, i);
+        results[i].exe_fd = -1;
+        memset(&results[i].failfast, 0, sizeof(failfast_state_t));
+        results[i].params_tested = (char **) malloc(total_params * sizeof(char *));
+        results[i].status = (int *) malloc(total_params * sizeof(int));
+        if (results[i].params_tested == NULL || results[i].status == NULL) {
+            fprintf(stderr, "Error occurred at line %d in file %s: malloc failed\n", __LINE__, __FILE__);
+            exit(EXIT_FAILURE);
+        }
+        for (int j = 0; j < total_params; j++) {
+            results[i].params_tested[j] = params[j];
+        }
+    }
+
+    // One thread per child slot: --concurrency, --workers, or the CPUs we may use
+    num_threads = options.concurrency > 0 ? options.concurrency : options.num_workers > 0 ? options.num_workers : get_batch_size();
+    metrics_start(&metrics, options.metrics_path, num_threads + 1);
+    metrics_set_total(&metrics, (long long) num_executables * total_params);
+
+    // Only the pairs the journal can't restore are queued
+    pair_order = (int *) malloc(num_executables * total_params * sizeof(int));
+    pair_expected_ms = (long long *) malloc(num_executables * total_params * sizeof(long long));
+    if (pair_order == NULL || pair_expected_ms == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < num_executables * total_params; p++) {
+        if (!journal_restore(&journal, &results[p % num_executables], p / num_executables, params[p / num_executables],
+                             total_params, &options)) {
+            pair_order[num_pairs_to_test++] = p;
+        } else {
+            metrics_record(&metrics, 0, results[p % num_executables].status[p / num_executables], -1);
+        }
+    }
+    if (num_threads > num_pairs_to_test) {
+        num_threads = num_pairs_to_test;
+    }
+
+    // With runtime history, start known hangers first so their timeouts overlap the rest
+    long long *default_order_ms = (long long *) malloc(num_pairs_to_test * sizeof(long long));
+    long long *scheduled_ms = (long long *) malloc(num_pairs_to_test * sizeof(long long));
+    if (default_order_ms == NULL || scheduled_ms == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < num_pairs_to_test; k++) {
+        int p = pair_order[k];
+        pair_expected_ms[p] = history_expected_ms(&history, get_exe_name(exe_table_path(&executables, p % num_executables)),
+                                                  params[p / num_executables]);
+        default_order_ms[k] = pair_expected_ms[p];
+    }
+    if (history.num_loaded > 0) {
+        qsort(pair_order, num_pairs_to_test, sizeof(int), compare_expected);
+        for (int k = 0; k < num_pairs_to_test; k++) {
+            scheduled_ms[k] = pair_expected_ms[pair_order[k]];
+        }
+        report_makespan(default_order_ms, scheduled_ms, num_pairs_to_test, num_threads, 0);
+    }
+
+    num_cpu_domains = get_cpu_domains(options.pin, &cpu_domains);
+    pthread_t *threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&next_pair, 0);
+    for (int i = 0; i < num_threads; i++) {
+        int err = pthread_create(&threads[i], NULL, supervisor_thread, (void *) (long) (i + 1));
+        if (err != 0) {
+            fprintf(stderr, "Failed to create thread: %s\n", strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Remove ALL output files (output/<executable>.<input>)
+    for (int i = 0; i < num_executables; i++) {
+        for (int j = 0; j < total_params; j++) {
+            char output_path[PATH_MAX];
+            snprintf(output_path, PATH_MAX, "output/%s.%s", get_exe_name(results[i].exe_path), params[j]);
+            if (unlink(output_path) == -1 && errno != ENOENT) {  // Skipped pairs have no output
+                perror("Failed to remove output file");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    metrics_stop(&metrics);
+    history_save(&history, monotonic_ms() - run_start_ms);
+
+    write_results_to_file(results, num_executables, total_params);
+
+    // Print each score to scores.txt
+    write_scores_to_file(results, num_executables, "results.txt");
+    write_report_to_file(options.report_path, results, num_executables, total_params, params);
+
+    // Every pair made it into results.txt -> nothing to resume
+    journal_close(&journal, 1);
+    oracle_close(&oracle);
+    capture_close(&capture);
+    host_pool_close(&host_pool);
+
+    // Free the results struct and its fields
+    for (int i = 0; i < num_executables; i++) {
+        free(results[i].params_tested);
+        free(results[i].status);
+    }
+
+    free(results);
+    exe_table_free(&executables);
+    free(threads);
+    free(cpu_domains);
+    free(pair_order);
+    free(pair_expected_ms);
+    free(default_order_ms);
+    free(scheduled_ms);
+    if (options.params_spec != NULL) {
+        free(params);
+    }
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "trace.h"
+#include <sys/syscall.h>
+
+trace_t tracer;
+
+
+void trace_open(char *path, char *process_name) {
+    memset(&tracer, 0, sizeof(trace_t));
+    snprintf(tracer.process_name, sizeof(tracer.process_name), "%s", process_name);
+    if (path == NULL) {
+        return;
+    }
+    tracer.events = (trace_event_t *) malloc(TRACE_MAX_EVENTS * sizeof(trace_event_t));
+    if (tracer.events == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&tracer.num_events, 0);
+    tracer.path = path;
+}
+
+
+long long trace_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+void trace_end(const char *name, const char *category, long long start_us, int tid, const char *detail) {
+    if (start_us == 0) {
+        return;
+    }
+    long long end_us = trace_now_us();
+    int slot = atomic_fetch_add_explicit(&tracer.num_events, 1, memory_order_relaxed);
+    if (slot >= TRACE_MAX_EVENTS) {
+        return;
+    }
+    trace_event_t *event = &tracer.events[slot];
+    event->name = name;
+    event->category = category;
+    event->start_us = start_us;
+    event->duration_us = end_us - start_us;
+    event->tid = tid != 0 ? tid : (int) syscall(SYS_gettid);
+    snprintf(event->detail, TRACE_DETAIL_SIZE, "%s", detail != NULL ? detail : "");
+}
+
+
+void trace_end_pair(const char *name, const char *category, long long start_us, int tid, const char *exe, const char *param) {
+    if (start_us == 0) {
+        return;
+    }
+    char detail[TRACE_DETAIL_SIZE];
+    snprintf(detail, sizeof(detail), "%s %s", exe, param);
+    trace_end(name, category, start_us, tid, detail);
+}
+
+
+// Write s as the contents of a JSON string
+static void write_json_string(FILE *out, const char *s) {
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+}
+
+
+// One JSON object per line (no separators) for this process: its name, then its spans
+static void write_events(FILE *out) {
+    int pid = (int) getpid();
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"", pid);
+    write_json_string(out, tracer.process_name);
+    fprintf(out, "\"}}\n");
+
+    int num_events = atomic_load(&tracer.num_events);
+    if (num_events > TRACE_MAX_EVENTS) {
+        fprintf(stderr, "Trace: %d spans dropped (more than %d)\n", num_events - TRACE_MAX_EVENTS, TRACE_MAX_EVENTS);
+        num_events = TRACE_MAX_EVENTS;
+    }
+    for (int i = 0; i < num_events; i++) {
+        trace_event_t *event = &tracer.events[i];
+        fprintf(out, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, \"pid\": %d, \"tid\": %d",
+                event->name, event->category, event->start_us, event->duration_us, pid, event->tid);
+        if (event->detail[0] != '\0') {
+            fprintf(out, ", \"args\": {\"detail\": \"");
+            write_json_string(out, event->detail);
+            fprintf(out, "\"}");
+        }
+        fprintf(out, "}\n");
+    }
+}
+
+
+void trace_save_part() {
+    if (tracer.path == NULL) {
+        return;
+    }
+    char part_path[PATH_MAX];
+    snprintf(part_path, sizeof(part_path), "%s.%d", tracer.path, (int) getpid());
+    FILE *out = fopen(part_path, "w");
+    if (out == NULL) {
+        perror("Failed to save trace");
+        return;
+    }
+    write_events(out);
+    fclose(out);
+}
+
+
+// Append the lines of part to out as elements of the traceEvents array
+static void append_part(FILE *out, FILE *part, int *first) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &capacity, part)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            fprintf(out, "%s%s", *first ? "" : ",\n", line);
+            *first = 0;
+        }
+    }
+    free(line);
+}
+
+
+void trace_write(pid_t *part_pids, int num_parts) {
+    if (tracer.path == NULL) {
+        return;
+    }
+    // Own spans go through a part too, so every part is joined the same way
+    trace_save_part();
+
+    FILE *out = fopen(tracer.path, "w");
+    if (out == NULL) {
+        perror("Failed to write trace");
+        return;
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    int first = 1;
+    for (int i = -1; i < num_parts; i++) {
+        pid_t pid = i == -1 ? getpid() : part_pids[i];
+        if (pid <= 0) {
+            continue;
+        }
+        if (i != -1) {
+            // The part is saved just before the process exits
+            while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+        }
+        char part_path[PATH_MAX];
+        snprintf(part_path, sizeof(part_path), "%s.%d", tracer.path, (int) pid);
+        FILE *part = fopen(part_path, "r");
+        if (part == NULL) {
+            continue;  // Died without saving
+        }
+        append_part(out, part, &first);
+        fclose(part);
+        unlink(part_path);
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    printf("Trace written to %s\n", tracer.path);
+}
@@ -0,0 +1,951 @@
+#include "transport.h"
+#include "trace.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <mqueue.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Frame: 4-byte big-endian mtype followed by the MESSAGE_SIZE bytes of mtext
+#define FRAME_SIZE (4 + MESSAGE_SIZE)
+
+#define POSIX_MQ_MAXMSG 64  // Falls back to the default limit (fs.mqueue.msg_max, 10) if refused
+#define SHM_RING_SLOTS 64   // Frames per shared-memory ring (power of two)
+
+
+/*
+Shared-memory backend: the memfd holds a shm_region_t followed by two rings per
+worker, rings[2 (i - 1)] from mq_autograder to worker i and rings[2 (i - 1) + 1]
+back. Each ring has exactly one producer and one consumer, which only publish
+head (producer) and tail (consumer) with atomic stores.
+
+A side that finds its ring empty (or full) announces itself in *_waiting and
+sleeps on a futex; the other side only pays for FUTEX_WAKE when it sees that
+flag. Rings towards worker i wake on their head. Rings towards mq_autograder all
+bump one doorbell instead, so it can sleep until any worker has sent something.
+*/
+typedef struct {
+    _Atomic uint32_t head;              // Frames written
+    _Atomic uint32_t consumer_waiting;  // Consumer sleeps on the ring's bell
+    char head_pad[56];                  // Producer and consumer fields on separate cache lines
+    _Atomic uint32_t tail;              // Frames read
+    _Atomic uint32_t producer_waiting;  // Producer sleeps on tail (ring full)
+    char tail_pad[56];
+    unsigned char frames[SHM_RING_SLOTS][FRAME_SIZE];
+} shm_ring_t;
+
+typedef struct {
+    _Atomic uint32_t doorbell;          // Frames sent to mq_autograder by all workers
+    _Atomic uint32_t parent_waiting;    // mq_autograder sleeps on doorbell
+    char pad[56];
+    shm_ring_t rings[];
+} shm_region_t;
+
+
+int transport_type_from_name(char *name) {
+    if (strcmp(name, "sysv") == 0) {
+        return TRANSPORT_SYSV;
+    } else if (strcmp(name, "posix") == 0) {
+        return TRANSPORT_POSIX_MQ;
+    } else if (strcmp(name, "seqpacket") == 0) {
+        return TRANSPORT_SEQPACKET;
+    } else if (strcmp(name, "shm") == 0) {
+        return TRANSPORT_SHM;
+    }
+    return -1;
+}
+
+
+static void init_transport(transport_t *transport, int type) {
+    memset(transport, 0, sizeof(transport_t));
+    transport->type = type;
+    transport->listen_fd = -1;
+    transport->server_fd = -1;
+    transport->server_send_fd = -1;
+    transport->shm_fd = -1;
+}
+
+
+void transport_open_sysv(transport_t *transport, int msqid) {
+    init_transport(transport, TRANSPORT_SYSV);
+    transport->msqid = msqid;
+}
+
+
+// Write/read exactly len bytes, retrying short transfers and EINTR. Sockets are
+// written with MSG_NOSIGNAL: a peer that went away is EPIPE, not a SIGPIPE
+// killing mq_autograder or the worker.
+static int write_all(int fd, const void *buf, size_t len, int is_socket) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = is_socket ? send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL)
+                              : write(fd, (const char *) buf + done, len - done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char *) buf + done, len - done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+
+static void encode_frame(unsigned char *frame, msgbuf_t *msg) {
+    unsigned long mtype = (unsigned long) msg->mtype;
+    frame[0] = mtype >> 24;
+    frame[1] = mtype >> 16;
+    frame[2] = mtype >> 8;
+    frame[3] = mtype;
+    memcpy(frame + 4, msg->mtext, MESSAGE_SIZE);
+}
+
+static void decode_frame(unsigned char *frame, msgbuf_t *msg) {
+    msg->mtype = ((long) frame[0] << 24) | ((long) frame[1] << 16) | ((long) frame[2] << 8) | frame[3];
+    memcpy(msg->mtext, frame + 4, MESSAGE_SIZE);
+    msg->mtext[MESSAGE_SIZE - 1] = '\0';
+}
+
+
+// One frame per write()/read(): on SOCK_SEQPACKET each frame is one packet
+static int send_frame(int fd, msgbuf_t *msg) {
+    unsigned char frame[FRAME_SIZE];
+    encode_frame(frame, msg);
+    return write_all(fd, frame, FRAME_SIZE, 1);
+}
+
+static int recv_frame(int fd, msgbuf_t *msg) {
+    unsigned char frame[FRAME_SIZE];
+    if (read_all(fd, frame, FRAME_SIZE) == -1) {
+        return -1;
+    }
+    decode_frame(frame, msg);
+    return 0;
+}
+
+
+// Returns 1 if peer worker_id (mq_autograder for a worker) is still running.
+// Workers are checked with WNOWAIT: mq_autograder reaps them itself.
+static int peer_alive(transport_t *transport, long worker_id) {
+    if (transport->worker_id != 0) {
+        return transport->parent_pid == 0 || getppid() == transport->parent_pid;
+    }
+    if (transport->worker_pids == NULL || worker_id < 1 || worker_id > transport->num_conns ||
+        transport->worker_pids[worker_id - 1] == -1) {
+        return 1;  // Remote, or not forked yet
+    }
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, transport->worker_pids[worker_id - 1], &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+        return 0;  // Reaped already
+    }
+    return info.si_pid == 0;
+}
+
+
+// Send/receive one frame on a channel fd: a socket, or a POSIX queue (an fd on
+// Linux, so it can be polled like one)
+static int channel_send(transport_t *transport, int fd, long peer, msgbuf_t *msg) {
+    if (transport->type != TRANSPORT_POSIX_MQ) {
+        return send_frame(fd, msg);
+    }
+    unsigned char frame[FRAME_SIZE];
+    encode_frame(frame, msg);
+    // A full queue waits for the peer, as long as it lives
+    while (1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TRANSPORT_PEER_CHECK_MS / 1000;
+        if (mq_timedsend(fd, (char *) frame, FRAME_SIZE, 0, &deadline) == 0) {
+            return 0;
+        }
+        if (errno == ETIMEDOUT && !peer_alive(transport, peer)) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (errno != EINTR && errno != ETIMEDOUT) {
+            return -1;
+        }
+    }
+}
+
+static int channel_recv(transport_t *transport, int fd, msgbuf_t *msg) {
+    if (transport->type != TRANSPORT_POSIX_MQ) {
+        return recv_frame(fd, msg);
+    }
+    unsigned char frame[FRAME_SIZE];
+    while (mq_receive(fd, (char *) frame, FRAME_SIZE, NULL) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    decode_frame(frame, msg);
+    return 0;
+}
+
+
+static void futex_wait(_Atomic uint32_t *word, uint32_t expected, int timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    // Shared mapping -> no FUTEX_PRIVATE_FLAG. EAGAIN (word changed), EINTR and
+    // ETIMEDOUT all just send the caller back to check its ring.
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+// Sleep on bell for up to timeout_ms unless it moved past seen (the value read
+// before the caller found nothing to do)
+static void bell_wait(_Atomic uint32_t *bell, _Atomic uint32_t *waiting, uint32_t seen, int timeout_ms) {
+    atomic_store(waiting, 1);
+    if (atomic_load(bell) == seen) {
+        futex_wait(bell, seen, timeout_ms);
+    }
+    atomic_store(waiting, 0);
+}
+
+
+static shm_ring_t *shm_ring(transport_t *transport, long worker_id, int to_parent) {
+    return &((shm_region_t *) transport->shm)->rings[2 * (worker_id - 1) + to_parent];
+}
+
+
+// Append msg to ring (waiting for space while peer lives), then ring bell: the
+// ring's own head, or the doorbell shared by all rings towards mq_autograder.
+// Returns -1 with errno = ECONNRESET if peer died with the ring full.
+static int ring_push(transport_t *transport, long peer, shm_ring_t *ring, msgbuf_t *msg,
+                     _Atomic uint32_t *bell, _Atomic uint32_t *waiting) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int alive = 1;
+    while (1) {
+        uint32_t tail = atomic_load(&ring->tail);
+        if (head - tail < SHM_RING_SLOTS) {
+            break;
+        }
+        if (!alive) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        bell_wait(&ring->tail, &ring->producer_waiting, tail, TRANSPORT_PEER_CHECK_MS);
+        alive = peer_alive(transport, peer);  // Checked before looking at tail again
+    }
+    encode_frame(ring->frames[head % SHM_RING_SLOTS], msg);
+    atomic_store(&ring->head, head + 1);
+    if (bell != &ring->head) {
+        atomic_fetch_add(bell, 1);
+    }
+    if (atomic_load(waiting)) {
+        futex_wake(bell);
+    }
+    return 0;
+}
+
+
+// Take the oldest frame off ring into msg. Returns 0 if the ring is empty.
+static int ring_pop(shm_ring_t *ring, msgbuf_t *msg) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == atomic_load(&ring->head)) {
+        return 0;
+    }
+    decode_frame(ring->frames[tail % SHM_RING_SLOTS], msg);
+    atomic_store(&ring->tail, tail + 1);
+    if (atomic_load(&ring->producer_waiting)) {
+        futex_wake(&ring->tail);
+    }
+    return 1;
+}
+
+
+static int shm_send(transport_t *transport, long worker_id, msgbuf_t *msg) {
+    shm_region_t *region = (shm_region_t *) transport->shm;
+    if (transport->worker_id != 0) {
+        return ring_push(transport, 0, shm_ring(transport, worker_id, 1), msg, &region->doorbell, &region->parent_waiting);
+    }
+    shm_ring_t *ring = shm_ring(transport, worker_id, 0);
+    return ring_push(transport, worker_id, ring, msg, &ring->head, &ring->consumer_waiting);
+}
+
+
+// Receive like transport_recv(): the worker from its ring, mq_autograder from
+// worker mtype's ring or from any (BROADCAST_MTYPE + 1). Liveness is only
+// checked after a wait, before the rings, so everything a dead peer sent is
+// still read.
+static int shm_recv(transport_t *transport, msgbuf_t *msg, long mtype, int flags) {
+    shm_region_t *region = (shm_region_t *) transport->shm;
+    int alive = 1;
+    while (1) {
+
+        _Atomic uint32_t *bell = &region->doorbell;
+        _Atomic uint32_t *waiting = &region->parent_waiting;
+        if (transport->worker_id != 0) {
+            shm_ring_t *ring = shm_ring(transport, transport->worker_id, 0);
+            bell = &ring->head;
+            waiting = &ring->consumer_waiting;
+        }
+        uint32_t seen = atomic_load(bell);
+
+        if (transport->worker_id != 0) {
+            if (ring_pop(shm_ring(transport, transport->worker_id, 0), msg)) {
+                return 0;
+            }
+        } else if (mtype >= 1 && mtype <= transport->num_conns) {
+            if (ring_pop(shm_ring(transport, mtype, 1), msg)) {
+                return 0;
+            }
+        } else {
+            for (int i = 1; i <= transport->num_conns; i++) {
+                if (ring_pop(shm_ring(transport, i, 1), msg)) {
+                    return 0;
+                }
+            }
+        }
+
+        if (flags & IPC_NOWAIT) {
+            errno = ENOMSG;
+            return -1;
+        }
+        if (!alive) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        bell_wait(bell, waiting, seen, TRANSPORT_PEER_CHECK_MS);
+        if (transport->worker_id != 0 || (mtype >= 1 && mtype <= transport->num_conns)) {
+            alive = peer_alive(transport, transport->worker_id != 0 ? 0 : mtype);
+        } else {
+            for (int i = 1; i <= transport->num_conns && alive; i++) {
+                alive = peer_alive(transport, i);
+            }
+        }
+    }
+}
+
+
+void transport_open_local(transport_t *transport, int type, int num_workers) {
+    init_transport(transport, type);
+    transport->num_conns = num_workers;
+    if (num_workers == 0) {
+        return;
+    }
+    transport->worker_pids = (pid_t *) malloc(num_workers * sizeof(pid_t));
+    if (transport->worker_pids == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__ - 2, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        transport->worker_pids[i] = -1;
+    }
+
+    if (type == TRANSPORT_SHM) {
+        transport->shm_size = sizeof(shm_region_t) + 2 * num_workers * sizeof(shm_ring_t);
+        transport->shm_fd = memfd_create("autograder-ipc", MFD_CLOEXEC);
+        if (transport->shm_fd == -1 || ftruncate(transport->shm_fd, transport->shm_size) == -1) {
+            perror("Failed to create shared memory");
+            exit(EXIT_FAILURE);
+        }
+        transport->shm = mmap(NULL, transport->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, transport->shm_fd, 0);
+        if (transport->shm == MAP_FAILED) {
+            perror("Failed to map shared memory");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    transport->conn_fds = (int *) malloc(num_workers * sizeof(int));
+    transport->send_fds = type == TRANSPORT_POSIX_MQ ? (int *) malloc(num_workers * sizeof(int)) : NULL;
+    transport->worker_fds = type == TRANSPORT_SEQPACKET ? (int *) malloc(num_workers * sizeof(int)) : NULL;
+    if (transport->conn_fds == NULL || (type == TRANSPORT_POSIX_MQ && transport->send_fds == NULL)
+        || (type == TRANSPORT_SEQPACKET && transport->worker_fds == NULL)) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+
+    if (type == TRANSPORT_SEQPACKET) {
+        for (int i = 0; i < num_workers; i++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1) {
+                perror("Failed to create socketpair");
+                exit(EXIT_FAILURE);
+            }
+            transport->conn_fds[i] = pair[0];
+            transport->worker_fds[i] = pair[1];
+        }
+        return;
+    }
+
+    // POSIX queues: <prefix>-<id>-in towards worker id, <prefix>-<id>-out back
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "/autograder-%d", (int) getpid());
+    transport->mq_prefix = strdup(prefix);
+    for (int i = 0; i < num_workers; i++) {
+        for (int to_parent = 0; to_parent <= 1; to_parent++) {
+            char name[96];
+            snprintf(name, sizeof(name), "%s-%d-%s", prefix, i + 1, to_parent ? "out" : "in");
+            struct mq_attr attr = { .mq_maxmsg = POSIX_MQ_MAXMSG, .mq_msgsize = FRAME_SIZE };
+            mqd_t queue = mq_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600, &attr);
+            if (queue == (mqd_t) -1 && errno == EINVAL) {
+                attr.mq_maxmsg = 10;
+                queue = mq_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600, &attr);
+            }
+            if (queue == (mqd_t) -1) {
+                perror("Failed to create POSIX message queue");
+                exit(EXIT_FAILURE);
+            }
+            if (to_parent) {
+                transport->conn_fds[i] = queue;
+            } else {
+                transport->send_fds[i] = queue;
+            }
+        }
+    }
+}
+
+
+void transport_prepare_worker(transport_t *transport, long worker_id, char *spec, size_t len) {
+    int fd = -1;
+    if (transport->type == TRANSPORT_SYSV) {
+        snprintf(spec, len, "%d", transport->msqid);
+    } else if (transport->type == TRANSPORT_POSIX_MQ) {
+        snprintf(spec, len, "posix:%s", transport->mq_prefix);
+    } else if (transport->type == TRANSPORT_SEQPACKET) {
+        fd = transport->worker_fds[worker_id - 1];
+        snprintf(spec, len, "seqpacket:%d", fd);
+    } else if (transport->type == TRANSPORT_SHM) {
+        fd = transport->shm_fd;
+        snprintf(spec, len, "shm:%d", fd);
+    }
+    // Every channel was created close-on-exec -> only keep this worker's
+    if (fd != -1 && fcntl(fd, F_SETFD, 0) == -1) {
+        perror("fcntl failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void close_worker_end(transport_t *transport, long worker_id) {
+    if (transport->type == TRANSPORT_SEQPACKET && transport->worker_fds[worker_id - 1] != -1) {
+        close(transport->worker_fds[worker_id - 1]);
+        transport->worker_fds[worker_id - 1] = -1;
+    }
+}
+
+
+void transport_release_worker(transport_t *transport, long worker_id, pid_t pid) {
+    close_worker_end(transport, worker_id);
+    if (transport->worker_pids != NULL) {
+        transport->worker_pids[worker_id - 1] = pid;
+    }
+}
+
+
+void transport_attach(transport_t *transport, char *spec, long worker_id) {
+    if (strncmp(spec, "posix:", 6) == 0) {
+        init_transport(transport, TRANSPORT_POSIX_MQ);
+        char name[96];
+        snprintf(name, sizeof(name), "%s-%ld-in", spec + 6, worker_id);
+        transport->server_fd = mq_open(name, O_RDONLY | O_CLOEXEC);
+        snprintf(name, sizeof(name), "%s-%ld-out", spec + 6, worker_id);
+        transport->server_send_fd = mq_open(name, O_WRONLY | O_CLOEXEC);
+        if (transport->server_fd == -1 || transport->server_send_fd == -1) {
+            perror("Failed to open POSIX message queue");
+            exit(EXIT_FAILURE);
+        }
+        // Both ends are open now -> the names would only leak if mq_autograder crashed
+        mq_unlink(name);
+        snprintf(name, sizeof(name), "%s-%ld-in", spec + 6, worker_id);
+        mq_unlink(name);
+    } else if (strncmp(spec, "seqpacket:", 10) == 0) {
+        init_transport(transport, TRANSPORT_SEQPACKET);
+        transport->server_fd = atoi(spec + 10);
+        // Not for the student programs this worker runs
+        if (fcntl(transport->server_fd, F_SETFD, FD_CLOEXEC) == -1) {
+            perror("Invalid seqpacket channel");
+            exit(EXIT_FAILURE);
+        }
+    } else if (strncmp(spec, "shm:", 4) == 0) {
+        init_transport(transport, TRANSPORT_SHM);
+        int fd = atoi(spec + 4);
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("Invalid shared memory channel");
+            exit(EXIT_FAILURE);
+        }
+        transport->shm_size = st.st_size;
+        transport->shm = mmap(NULL, transport->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (transport->shm == MAP_FAILED) {
+            perror("Failed to map shared memory");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    } else {
+        transport_open_sysv(transport, atoi(spec));
+    }
+    transport->worker_id = worker_id;
+    transport->parent_pid = getppid();
+}
+
+
+// Resolve "tcp:<host>:<port>" or "unix:<path>" into a socket address
+static int resolve_address(char *address, int passive, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *) addr;
+        if (strlen(address + 5) >= sizeof(un->sun_path)) {
+            fprintf(stderr, "Unix socket path too long: %s\n", address + 5);
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address + 5);
+        *addr_len = sizeof(struct sockaddr_un);
+        return 0;
+    }
+
+    if (strncmp(address, "tcp:", 4) == 0) {
+        char host[256];
+        char *port = strrchr(address + 4, ':');
+        if (port == NULL || port - (address + 4) >= (long) sizeof(host)) {
+            fprintf(stderr, "Invalid address (expected tcp:<host>:<port>): %s\n", address);
+            return -1;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int) (port - (address + 4)), address + 4);
+
+        struct addrinfo hints, *info;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        int err = getaddrinfo(host, port + 1, &hints, &info);
+        if (err != 0) {
+            fprintf(stderr, "Failed to resolve %s: %s\n", address, gai_strerror(err));
+            return -1;
+        }
+        memcpy(addr, info->ai_addr, info->ai_addrlen);
+        *addr_len = info->ai_addrlen;
+        freeaddrinfo(info);
+        return 0;
+    }
+
+    fprintf(stderr, "Invalid address (expected tcp:<host>:<port> or unix:<path>): %s\n", address);
+    return -1;
+}
+
+
+// Small frames are latency bound -> disable Nagle on TCP connections
+static void set_nodelay(int fd, struct sockaddr_storage *addr) {
+    if (addr->ss_family != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+}
+
+
+void transport_listen(transport_t *transport, char *address, int num_workers, int *capacities) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    init_transport(transport, TRANSPORT_SOCKET);
+
+    if (resolve_address(address, 1, &addr, &addr_len) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if (addr.ss_family == AF_UNIX) {
+        transport->unix_path = strdup(((struct sockaddr_un *) &addr)->sun_path);
+        unlink(transport->unix_path);  // Left over from an earlier run
+    }
+
+    transport->listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (transport->listen_fd == -1) {
+        perror("Failed to create socket");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    setsockopt(transport->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(transport->listen_fd, (struct sockaddr *) &addr, addr_len) == -1) {
+        perror("Failed to bind socket");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(transport->listen_fd, num_workers) == -1) {
+        perror("Failed to listen on socket");
+        exit(EXIT_FAILURE);
+    }
+
+    transport->conn_fds = (int *) malloc(num_workers * sizeof(int));
+    if (transport->conn_fds == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Waiting for %d workers on %s\n", num_workers, address);
+    while (transport->num_conns < num_workers) {
+        int fd = accept4(transport->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to accept worker");
+            exit(EXIT_FAILURE);
+        }
+        set_nodelay(fd, &addr);
+
+        msgbuf_t msg;
+        int capacity;
+        if (recv_frame(fd, &msg) == -1 || sscanf(msg.mtext, "HELLO %d", &capacity) != 1 || capacity < 1) {
+            fprintf(stderr, "Rejected connection without a valid HELLO\n");
+            close(fd);
+            continue;
+        }
+
+        long worker_id = transport->num_conns + 1;
+        memset(&msg, 0, sizeof(msgbuf_t));
+        msg.mtype = worker_id;
+        snprintf(msg.mtext, MESSAGE_SIZE, "WORKER %ld", worker_id);
+        if (send_frame(fd, &msg) == -1) {
+            perror("Failed to send worker id");
+            close(fd);
+            continue;
+        }
+
+        transport->conn_fds[transport->num_conns++] = fd;
+        capacities[worker_id - 1] = capacity;
+        printf("Worker %ld connected with capacity %d\n", worker_id, capacity);
+    }
+}
+
+
+long transport_connect(transport_t *transport, char *address, int capacity) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    init_transport(transport, TRANSPORT_SOCKET);
+
+    if (resolve_address(address, 0, &addr, &addr_len) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    transport->server_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (transport->server_fd == -1) {
+        perror("Failed to create socket");
+        exit(EXIT_FAILURE);
+    }
+    if (connect(transport->server_fd, (struct sockaddr *) &addr, addr_len) == -1) {
+        perror("Failed to connect to autograder");
+        exit(EXIT_FAILURE);
+    }
+    set_nodelay(transport->server_fd, &addr);
+
+    msgbuf_t msg;
+    memset(&msg, 0, sizeof(msgbuf_t));
+    msg.mtype = BROADCAST_MTYPE + 1;
+    snprintf(msg.mtext, MESSAGE_SIZE, "HELLO %d", capacity);
+    long worker_id;
+    if (send_frame(transport->server_fd, &msg) == -1 || recv_frame(transport->server_fd, &msg) == -1 ||
+        sscanf(msg.mtext, "WORKER %ld", &worker_id) != 1) {
+        perror("Failed to register with autograder");
+        exit(EXIT_FAILURE);
+    }
+    transport->worker_id = worker_id;
+    return worker_id;
+}
+
+
+static int send_message(transport_t *transport, msgbuf_t *msg) {
+    if (transport->type == TRANSPORT_SYSV) {
+        return msgsnd(transport->msqid, msg, MESSAGE_SIZE, 0);
+    }
+
+    // Worker side: everything goes to mq_autograder
+    if (transport->worker_id != 0) {
+        if (transport->type == TRANSPORT_SHM) {
+            return shm_send(transport, transport->worker_id, msg);
+        }
+        return channel_send(transport, transport->server_send_fd != -1 ? transport->server_send_fd : transport->server_fd, 0, msg);
+    }
+
+    // mq_autograder side: mtype names the worker, broadcasts go to each worker in turn
+    int conn;
+    if (msg->mtype == BROADCAST_MTYPE) {
+        conn = transport->next_broadcast++ % transport->num_conns;
+    } else if (msg->mtype >= 1 && msg->mtype <= transport->num_conns) {
+        conn = msg->mtype - 1;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    if (transport->type == TRANSPORT_SHM) {
+        return shm_send(transport, conn + 1, msg);
+    }
+    return channel_send(transport, transport->send_fds != NULL ? transport->send_fds[conn] : transport->conn_fds[conn], conn + 1, msg);
+}
+
+
+// Poll pfds for up to timeout_ms (-1: until one is ready, waking every
+// TRANSPORT_PEER_CHECK_MS to check peer, -1 for every worker). Returns the
+// number ready, 0 on timeout, -1 with errno = ECONNRESET once a checked peer
+// died with nothing left to read.
+static int poll_peer(transport_t *transport, struct pollfd *pfds, int nfds, long peer, int timeout_ms) {
+    int alive = 1;
+    while (1) {
+        int wait_ms = timeout_ms >= 0 ? timeout_ms : alive ? TRANSPORT_PEER_CHECK_MS : 0;
+        int ret;
+        do {
+            ret = poll(pfds, nfds, wait_ms);
+        } while (ret == -1 && errno == EINTR);
+        if (ret != 0 || timeout_ms >= 0) {
+            return ret;
+        }
+        if (!alive) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        // Checked before polling once more, so what a dead peer sent is still read
+        for (int i = 1; i <= (peer == -1 ? transport->num_conns : 1) && alive; i++) {
+            alive = peer_alive(transport, peer == -1 ? i : peer);
+        }
+    }
+}
+
+
+// Returns 1 if fd (from peer) has data (or EOF) to read within timeout_ms, -1
+// if peer is gone
+static int socket_ready(transport_t *transport, int fd, long peer, int timeout_ms) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ret = poll_peer(transport, &pfd, 1, peer, timeout_ms);
+    return ret == -1 ? -1 : ret > 0;
+}
+
+
+static int recv_message(transport_t *transport, msgbuf_t *msg, long mtype, int flags) {
+    if (transport->type == TRANSPORT_SYSV) {
+        return msgrcv(transport->msqid, msg, MESSAGE_SIZE, mtype, flags);
+    }
+    if (transport->type == TRANSPORT_SHM) {
+        return shm_recv(transport, msg, mtype, flags);
+    }
+
+    int timeout_ms = (flags & IPC_NOWAIT) ? 0 : -1;
+
+    // Worker side: messages arrive in protocol order on the one connection
+    if (transport->worker_id != 0) {
+        int ready = socket_ready(transport, transport->server_fd, 0, timeout_ms);
+        if (ready != 1) {
+            errno = ready == -1 ? ECONNRESET : ENOMSG;
+            return -1;
+        }
+        return channel_recv(transport, transport->server_fd, msg);
+    }
+
+    // mq_autograder side: a specific worker's connection...
+    if (mtype >= 1 && mtype <= transport->num_conns) {
+        int ready = socket_ready(transport, transport->conn_fds[mtype - 1], mtype, timeout_ms);
+        if (ready != 1) {
+            errno = ready == -1 ? ECONNRESET : ENOMSG;
+            return -1;
+        }
+        return channel_recv(transport, transport->conn_fds[mtype - 1], msg);
+    }
+
+    // ...or whichever worker speaks first (ACK/FETCH, mtype BROADCAST_MTYPE + 1)
+    struct pollfd *pfds = (struct pollfd *) malloc(transport->num_conns * sizeof(struct pollfd));
+    if (pfds == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < transport->num_conns; i++) {
+        pfds[i].fd = transport->conn_fds[i];
+        pfds[i].events = POLLIN;
+    }
+    int ret = poll_peer(transport, pfds, transport->num_conns, -1, timeout_ms);
+
+    int ready = -1;
+    for (int i = 0; ret > 0 && i < transport->num_conns && ready == -1; i++) {
+        if (pfds[i].revents) {
+            ready = i;
+        }
+    }
+    free(pfds);
+    if (ready == -1) {
+        errno = ret == -1 ? ECONNRESET : ENOMSG;
+        return -1;
+    }
+    return channel_recv(transport, transport->conn_fds[ready], msg);
+}
+
+
+int transport_send(transport_t *transport, msgbuf_t *msg) {
+    long long trace_start = trace_begin();
+    int ret = send_message(transport, msg);
+    trace_end("send", "ipc", trace_start, 0, msg->mtext);
+    return ret;
+}
+
+
+int transport_recv(transport_t *transport, msgbuf_t *msg, long mtype, int flags) {
+    long long trace_start = trace_begin();
+    int ret = recv_message(transport, msg, mtype, flags);
+    if (ret != -1) {
+        // Polls that found nothing (IPC_NOWAIT) would only bury the messages
+        trace_end("recv", "ipc", trace_start, 0, msg->mtext);
+    }
+    return ret;
+}
+
+
+void transport_wait(transport_t *transport, int timeout_ms) {
+    if (transport->type == TRANSPORT_SYSV || transport->num_conns == 0) {
+        return;
+    }
+    if (transport->type == TRANSPORT_SHM) {
+        shm_region_t *region = (shm_region_t *) transport->shm;
+        uint32_t seen = atomic_load(&region->doorbell);
+        for (int i = 1; i <= transport->num_conns; i++) {
+            shm_ring_t *ring = shm_ring(transport, i, 1);
+            if (atomic_load(&ring->head) != atomic_load(&ring->tail)) {
+                return;
+            }
+        }
+        bell_wait(&region->doorbell, &region->parent_waiting, seen, timeout_ms);
+        return;
+    }
+
+    struct pollfd *pfds = (struct pollfd *) malloc(transport->num_conns * sizeof(struct pollfd));
+    if (pfds == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < transport->num_conns; i++) {
+        pfds[i].fd = transport->conn_fds[i];
+        pfds[i].events = POLLIN;
+    }
+    poll(pfds, transport->num_conns, timeout_ms);
+    free(pfds);
+}
+
+
+int transport_send_file(transport_t *transport, long mtype, int fd, off_t size) {
+    if (transport->type != TRANSPORT_SOCKET || mtype < 1 || mtype > transport->num_conns) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    char buffer[BUFSIZ];
+    off_t sent = 0;
+    while (sent < size) {
+        ssize_t n = pread(fd, buffer, sizeof(buffer), sent);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                errno = EIO;  // File shrank after its size was announced
+            }
+            return -1;
+        }
+        if (write_all(transport->conn_fds[mtype - 1], buffer, n, 1) == -1) {
+            return -1;
+        }
+        sent += n;
+    }
+    return 0;
+}
+
+
+int transport_recv_file(transport_t *transport, int fd, off_t size) {
+    if (transport->type != TRANSPORT_SOCKET || transport->server_fd == -1) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    char buffer[BUFSIZ];
+    off_t received = 0;
+    while (received < size) {
+        size_t chunk = size - received < (off_t) sizeof(buffer) ? size - received : sizeof(buffer);
+        if (read_all(transport->server_fd, buffer, chunk) == -1 || write_all(fd, buffer, chunk, 0) == -1) {
+            return -1;
+        }
+        received += chunk;
+    }
+    return 0;
+}
+
+
+void transport_close(transport_t *transport) {
+    if (transport->type == TRANSPORT_SYSV) {
+        // Only mq_autograder closes the SysV transport -> remove the queue
+        if (msgctl(transport->msqid, IPC_RMID, NULL) == -1) {
+            perror("Failed to remove message queue");
+            exit(1);
+        }
+        return;
+    }
+    if (transport->type == TRANSPORT_SHM) {
+        munmap(transport->shm, transport->shm_size);
+        if (transport->shm_fd != -1) {
+            close(transport->shm_fd);
+        }
+        free(transport->worker_pids);
+        return;
+    }
+
+    for (int i = 0; transport->conn_fds != NULL && i < transport->num_conns; i++) {
+        close(transport->conn_fds[i]);
+        if (transport->send_fds != NULL) {
+            close(transport->send_fds[i]);
+        }
+        close_worker_end(transport, i + 1);
+    }
+    free(transport->conn_fds);
+    free(transport->worker_pids);
+    free(transport->send_fds);
+    free(transport->worker_fds);
+    if (transport->server_send_fd != -1) {
+        close(transport->server_send_fd);
+    }
+    if (transport->mq_prefix != NULL) {
+        // Only mq_autograder remembers the prefix -> remove the queues
+        for (int i = 1; transport->worker_id == 0 && i <= transport->num_conns; i++) {
+            char name[96];
+            snprintf(name, sizeof(name), "%s-%d-in", transport->mq_prefix, i);
+            mq_unlink(name);
+            snprintf(name, sizeof(name), "%s-%d-out", transport->mq_prefix, i);
+            mq_unlink(name);
+        }
+        free(transport->mq_prefix);
+    }
+    if (transport->listen_fd != -1) {
+        close(transport->listen_fd);
+    }
+    if (transport->server_fd != -1) {
+        close(transport->server_fd);
+    }
+    if (transport->unix_path != NULL) {
+        unlink(transport->unix_path);
+        free(transport->unix_path);
+    }
+}
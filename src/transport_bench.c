@@ -0,0 +1,146 @@
+#include "transport.h"
+
+/*
+Compare the local transports mq_autograder can use (--ipc=NAME) on the messages
+it actually exchanges: a dispatch ("<executable> <param>", mtype = worker id)
+answered by a result ("<executable> <param> <status> <runtime_ms>", mtype
+BROADCAST_MTYPE + 1), between this process and one forked echo worker.
+
+    > make transport_bench && ./transport_bench [round_trips]
+
+Reports the median and 99th percentile round trip, then pairs/sec with WINDOW
+dispatches in flight (what a worker sees while it collects a batch).
+*/
+
+#define DEFAULT_ROUND_TRIPS 20000
+#define WINDOW 8
+
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void send_or_die(transport_t *transport, long mtype, char *text) {
+    msgbuf_t msg;
+    memset(&msg, 0, sizeof(msgbuf_t));
+    msg.mtype = mtype;
+    snprintf(msg.mtext, MESSAGE_SIZE, "%s", text);
+    if (transport_send(transport, &msg) == -1) {
+        perror("Failed to send message");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+static void recv_or_die(transport_t *transport, long mtype, msgbuf_t *msg) {
+    if (transport_recv(transport, msg, mtype, 0) == -1) {
+        perror("Failed to receive message");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Worker side: answer every dispatch with a result until STOP
+static void echo_worker(char *channel) {
+    transport_t transport;
+    transport_attach(&transport, channel, 1);
+    msgbuf_t msg;
+    while (1) {
+        recv_or_die(&transport, 1, &msg);
+        if (strcmp(msg.mtext, "STOP") == 0) {
+            _exit(0);
+        }
+        char result[MESSAGE_SIZE];
+        snprintf(result, sizeof(result), "%.60s 1 42", msg.mtext);
+        send_or_die(&transport, BROADCAST_MTYPE + 1, result);
+    }
+}
+
+
+static void bench(char *name, int round_trips) {
+    int type = transport_type_from_name(name);
+    transport_t transport;
+    if (type == TRANSPORT_SYSV) {
+        transport_open_sysv(&transport, msgget(IPC_PRIVATE, 0600 | IPC_CREAT));
+        if (transport.msqid == -1) {
+            perror("Failed to create message queue");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        transport_open_local(&transport, type, 1);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        char channel[PATH_MAX];
+        transport_prepare_worker(&transport, 1, channel, sizeof(channel));
+        echo_worker(channel);
+    }
+    transport_release_worker(&transport, 1, pid);
+
+    long long *samples = (long long *) malloc(round_trips * sizeof(long long));
+    if (samples == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    msgbuf_t msg;
+
+    // Latency: one dispatch in flight
+    for (int i = 0; i < round_trips; i++) {
+        long long start = now_ns();
+        send_or_die(&transport, 1, "solutions/sol_17 3");
+        recv_or_die(&transport, BROADCAST_MTYPE + 1, &msg);
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, round_trips, sizeof(long long), compare_ns);
+
+    // Throughput: keep WINDOW dispatches in flight
+    long long start = now_ns();
+    int sent = 0;
+    for (; sent < WINDOW && sent < round_trips; sent++) {
+        send_or_die(&transport, 1, "solutions/sol_17 3");
+    }
+    for (int received = 0; received < round_trips; received++) {
+        recv_or_die(&transport, BROADCAST_MTYPE + 1, &msg);
+        if (sent < round_trips) {
+            send_or_die(&transport, 1, "solutions/sol_17 3");
+            sent++;
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    send_or_die(&transport, 1, "STOP");
+    waitpid(pid, NULL, 0);
+    transport_close(&transport);
+
+    printf("%-10s %10.1f %10.1f %14.0f\n", name, samples[round_trips / 2] / 1000.0,
+           samples[(int) (round_trips * 0.99)] / 1000.0, round_trips / seconds);
+    free(samples);
+}
+
+
+int main(int argc, char **argv) {
+    int round_trips = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUND_TRIPS;
+    if (round_trips <= 0) {
+        fprintf(stderr, "Usage: %s [round_trips]\n", argv[0]);
+        return 1;
+    }
+    printf("%-10s %10s %10s %14s\n", "ipc", "p50 (us)", "p99 (us)", "pairs/sec");
+    char *backends[] = {"sysv", "posix", "seqpacket", "shm"};
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        bench(backends[i], round_trips);
+    }
+    return 0;
+}
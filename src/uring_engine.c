@@ -0,0 +1,340 @@
+#include "uring_engine.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+// Added in Linux 6.7, after the last opcode older <linux/io_uring.h> headers know
+#define URING_OP_WAITID 50
+
+// user_data tags for completions (low bits hold the child's batch index)
+#define TAG_WAITID       (1ULL << 32)
+#define TAG_LINK_TIMEOUT (2ULL << 32)
+#define TAG_OPENAT       (3ULL << 32)
+#define TAG_READ         (4ULL << 32)
+#define TAG_CLOSE        (5ULL << 32)
+#define TAG_UNLINKAT     (6ULL << 32)
+#define TAG_MASK         (0xffULL << 32)
+
+// Shared submission/completion rings mapped from the kernel
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned to_submit;         // SQEs queued since the last io_uring_enter()
+    void *rings;                // SQ and CQ rings (one mapping)
+    size_t rings_size, sqes_size;
+} ring = { .fd = -1 };
+
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int uring_enter(unsigned to_submit, unsigned min_complete) {
+    int ret;
+    do {
+        ret = (int) syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+
+// Returns 1 if every opcode the engine relies on is supported by the kernel
+static int uring_probe_opcodes() {
+    static const int needed[] = {
+        URING_OP_WAITID, IORING_OP_LINK_TIMEOUT, IORING_OP_OPENAT,
+        IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_UNLINKAT
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *) calloc(1, len);
+    if (probe == NULL) {
+        return 0;
+    }
+
+    int supported = 0;
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = 1;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+            if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+                supported = 0;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+
+int uring_engine_init(int max_batch) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // Up to three SQEs per child (READ + CLOSE + UNLINKAT) -> every step of a batch
+    // fits in one submission and linked SQEs are never split across submissions
+    unsigned entries = 1;
+    while (entries < 3 * (unsigned) max_batch) {
+        entries *= 2;
+    }
+
+    ring.fd = uring_setup(entries, &params);
+    if (ring.fd == -1) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !uring_probe_opcodes()) {
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    // With IORING_FEAT_SINGLE_MMAP the SQ and CQ rings share one mapping
+    ring.rings_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring.rings_size) {
+        ring.rings_size = cq_size;
+    }
+    ring.rings = mmap(NULL, ring.rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring.fd, IORING_OFF_SQ_RING);
+    if (ring.rings == MAP_FAILED) {
+        perror("Failed to map io_uring");
+        exit(EXIT_FAILURE);
+    }
+
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = (struct io_uring_sqe *) mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        perror("Failed to map io_uring SQEs");
+        exit(EXIT_FAILURE);
+    }
+
+    char *sq = (char *) ring.rings;
+    ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring.cq_head = (unsigned *) (sq + params.cq_off.head);
+    ring.cq_tail = (unsigned *) (sq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *) (sq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (sq + params.cq_off.cqes);
+    ring.sq_entries = params.sq_entries;
+    ring.to_submit = 0;
+    return 0;
+}
+
+
+void uring_engine_cleanup() {
+    if (ring.fd == -1) {
+        return;
+    }
+    munmap(ring.sqes, ring.sqes_size);
+    munmap(ring.rings, ring.rings_size);
+    close(ring.fd);
+    ring.fd = -1;
+}
+
+
+// Submit everything queued so far and wait for at least min_complete completions
+static void uring_submit_and_wait(unsigned min_complete) {
+    if (uring_enter(ring.to_submit, min_complete) == -1) {
+        perror("io_uring_enter failed");
+        exit(EXIT_FAILURE);
+    }
+    ring.to_submit = 0;
+}
+
+
+// Get a zeroed SQE, flushing the submission queue first if it is full
+static struct io_uring_sqe *uring_get_sqe(unsigned long long user_data) {
+    unsigned tail = *ring.sq_tail;
+    if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) == ring.sq_entries) {
+        uring_submit_and_wait(0);
+    }
+
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    return sqe;
+}
+
+
+// Pop the next completion, or return 0 if there is none
+static int uring_next_cqe(struct io_uring_cqe *cqe) {
+    unsigned head = *ring.cq_head;
+    if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *cqe = ring.cqes[head & *ring.cq_mask];
+    __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+static struct io_uring_sqe *uring_prep_waitid(pid_t pid, siginfo_t *info, unsigned long long user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(user_data);
+    sqe->opcode = URING_OP_WAITID;
+    sqe->fd = pid;
+    sqe->len = P_PID;
+    sqe->file_index = WEXITED;
+    sqe->addr2 = (unsigned long) info;
+    return sqe;
+}
+
+
+void uring_monitor_batch(pid_t *pids, char **output_paths, int num_children,
+                         int timeout_secs, int remove_outputs, int *statuses, long long *exit_ms) {
+    siginfo_t *infos = (siginfo_t *) calloc(num_children, sizeof(siginfo_t));
+    int *fds = (int *) malloc(num_children * sizeof(int));
+    char (*outputs)[MAX_INT_CHARS + 1] = malloc(num_children * sizeof(*outputs));
+    if (infos == NULL || fds == NULL || outputs == NULL) {
+        fprintf(stderr, "Error occurred at line %d in %s: malloc failed\n", __LINE__, __FILE__);
+        exit(EXIT_FAILURE);
+    }
+
+    // Every child shares the batch deadline, like the SIGALRM timer of the classic engine
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct __kernel_timespec deadline = { .tv_sec = now.tv_sec + timeout_secs, .tv_nsec = now.tv_nsec };
+
+    // 1. Reap every child, linking each WAITID to the deadline
+    for (int j = 0; j < num_children; j++) {
+        struct io_uring_sqe *sqe = uring_prep_waitid(pids[j], &infos[j], TAG_WAITID | j);
+        sqe->flags = IOSQE_IO_LINK;
+
+        sqe = uring_get_sqe(TAG_LINK_TIMEOUT | j);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = (unsigned long) &deadline;
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    }
+
+    // Each LINK_TIMEOUT completes too (-ETIME or -ECANCELED), possibly after its
+    // WAITID: wait for all of them, or they would turn up among the opens below
+    int reaped = 0;
+    int timeouts_done = 0;
+    while (reaped < num_children || timeouts_done < num_children) {
+        uring_submit_and_wait(1);
+
+        struct io_uring_cqe cqe;
+        while (uring_next_cqe(&cqe)) {
+            int j = (int) (cqe.user_data & ~TAG_MASK);
+            if ((cqe.user_data & TAG_MASK) == TAG_LINK_TIMEOUT) {
+                timeouts_done++;  // Carries no information otherwise
+                continue;
+            }
+            if ((cqe.user_data & TAG_MASK) != TAG_WAITID) {
+                continue;
+            }
+            if (cqe.res == 0) {
+                reaped++;
+                if (exit_ms != NULL) {
+                    exit_ms[j] = monotonic_ms();
+                }
+            } else if (cqe.res == -ECANCELED) {
+                // Deadline passed -> kill the child and reap it without a timeout
+                if (kill(pids[j], SIGKILL) == -1) {
+                    perror("Kill Failed");
+                    exit(EXIT_FAILURE);
+                }
+                uring_prep_waitid(pids[j], &infos[j], TAG_WAITID | j);
+            } else {
+                errno = -cqe.res;
+                perror("waitid failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    // 2. Open the output files of the children that exited normally
+    int pending = 0;
+    for (int j = 0; j < num_children; j++) {
+        fds[j] = -1;
+        if (infos[j].si_code == CLD_EXITED) {
+            struct io_uring_sqe *sqe = uring_get_sqe(TAG_OPENAT | j);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long) output_paths[j];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            pending++;
+        } else {
+            statuses[j] = get_signal_status(infos[j].si_status);
+        }
+    }
+    while (pending > 0) {
+        uring_submit_and_wait(1);
+
+        struct io_uring_cqe cqe;
+        while (uring_next_cqe(&cqe)) {
+            int j = (int) (cqe.user_data & ~TAG_MASK);
+            if ((cqe.user_data & TAG_MASK) != TAG_OPENAT) {
+                continue;  // Nothing else is in flight in this phase
+            }
+            if (cqe.res < 0) {
+                errno = -cqe.res;
+                fprintf(stderr, "Error occurred at line %d in %s: open failed\n", __LINE__, __FILE__);
+                exit(EXIT_FAILURE);
+            }
+            fds[j] = cqe.res;
+            pending--;
+        }
+    }
+
+    // 3. Read (then close) the output files and unlink the whole batch's outputs
+    for (int j = 0; j < num_children; j++) {
+        if (fds[j] != -1) {
+            struct io_uring_sqe *sqe = uring_get_sqe(TAG_READ | j);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[j];
+            sqe->addr = (unsigned long) outputs[j];
+            sqe->len = MAX_INT_CHARS;
+            sqe->flags = IOSQE_IO_HARDLINK;  // A short read would sever a soft link and cancel the CLOSE
+            pending++;
+
+            sqe = uring_get_sqe(TAG_CLOSE | j);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fds[j];
+            pending++;
+        }
+        if (remove_outputs) {
+            struct io_uring_sqe *sqe = uring_get_sqe(TAG_UNLINKAT | j);
+            sqe->opcode = IORING_OP_UNLINKAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long) output_paths[j];
+            pending++;
+        }
+    }
+    while (pending > 0) {
+        uring_submit_and_wait(1);
+
+        struct io_uring_cqe cqe;
+        while (uring_next_cqe(&cqe)) {
+            int j = (int) (cqe.user_data & ~TAG_MASK);
+            unsigned long long tag = cqe.user_data & TAG_MASK;
+            if (tag != TAG_READ && tag != TAG_CLOSE && tag != TAG_UNLINKAT) {
+                continue;
+            }
+            if (cqe.res < 0) {
+                errno = -cqe.res;
+                perror(tag == TAG_READ ? "Read Failed" : tag == TAG_CLOSE ? "close failed" : "Failed to unlink file");
+                exit(EXIT_FAILURE);
+            }
+            if (tag == TAG_READ) {
+                outputs[j][cqe.res] = '\0';
+                statuses[j] = get_output_status(outputs[j]);
+            }
+            pending--;
+        }
+    }
+
+    free(outputs);
+    free(fds);
+    free(infos);
+}
@@ -8,6 +8,8 @@ const char* get_status_message(int status) {
         case INCORRECT: return "incorrect";
         case SEGFAULT: return "crash";
         case STUCK_OR_INFINITE: return "stuck/inf";
+        case OUTPUT_LIMIT: return "out-limit";
+        case SKIPPED: return "skipped";
         default: return "unknown";
     }
 }
@@ -18,151 +20,975 @@ char *get_exe_name(char *path) {
 }
 
 
-char **get_student_executables(char *solution_dir, int *num_executables) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat st;
+int failfast_record(failfast_state_t *state, int status, int total, grader_options_t *options) {
+    state->finished++;
+    if (status == CORRECT) {
+        state->correct++;
+    }
+    if (status == SEGFAULT || status == STUCK_OR_INFINITE || status == OUTPUT_LIMIT) {
+        state->consecutive_failures++;
+    } else {
+        state->consecutive_failures = 0;
+    }
 
-    // Open the directory
-    dir = opendir(solution_dir);
-    if (!dir) {
-        perror("Failed to open directory");
-        exit(EXIT_FAILURE);
+    if (options->stop_after > 0 && state->consecutive_failures >= options->stop_after) {
+        state->stopped = 1;
+    }
+    // Best case: every pair not tested yet is correct
+    int best_correct = state->correct + (total - state->finished);
+    if (options->min_score > 0 && total > 0 && (double) best_correct / total < options->min_score) {
+        state->stopped = 1;
     }
+    return state->stopped;
+}
 
-    // Count the number of executables
-    *num_executables = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        // Ignore hidden files
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", solution_dir, entry->d_name);
 
-        if (stat(path, &st) == 0) {
-            if (S_ISREG(st.st_mode) && entry->d_name[0] != '.')
-                (*num_executables)++;
+long long monotonic_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+int get_signal_status(int signum) {
+    if (signum == SIGKILL) {
+        return STUCK_OR_INFINITE;
+    } else if (signum == SIGXFSZ) {
+        return OUTPUT_LIMIT;
+    }
+    return SEGFAULT;  // SIGSEGV, SIGABRT, SIGBUS, SIGFPE, ...: a crash
+}
+
+
+int get_output_status(char *output) {
+    char *end;
+    long answer = strtol(output, &end, 10);
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
+    // Unknown output is just a wrong answer
+    return end != output && *end == '\0' && answer == 0 ? CORRECT : INCORRECT;
+}
+
+
+// The grader (or worker) that parsed its options: exec_solution() checks that
+// it is still the parent
+static pid_t grader_pid;
+
+
+int parse_grader_options(int argc, char *argv[], grader_options_t *options) {
+    grader_pid = getpid();
+    memset(options, 0, sizeof(grader_options_t));
+    options->history_path = DEFAULT_HISTORY_FILE;
+    options->prior_ms = DEFAULT_PRIOR_MS;
+    options->journal_path = DEFAULT_JOURNAL_FILE;
+    options->ipc = "sysv";
+    options->output_limit = DEFAULT_OUTPUT_LIMIT;
+    options->stderr_path = DEFAULT_STDERR_FILE;
+    options->host_pool = 1;
+    options->host_pool_split = 1;
+    options->stderr_keep = DEFAULT_STDERR_KEEP;
+    options->stderr_budget = DEFAULT_STDERR_BUDGET;
+
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            return i + 1;
+        } else if (strcmp(argv[i], "--exec-only") == 0) {
+            options->exec_only = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            options->watch = 1;
+        } else if (strcmp(argv[i], "--engine=uring") == 0) {
+            options->use_uring = 1;
+        } else if (strcmp(argv[i], "--engine=classic") == 0) {
+            options->use_uring = 0;
+        } else if (strncmp(argv[i], "--listen=", 9) == 0) {
+            options->listen_address = argv[i] + 9;
+        } else if (strncmp(argv[i], "--connect=", 10) == 0) {
+            options->connect_address = argv[i] + 10;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            options->num_workers = atoi(argv[i] + 10);
+            if (options->num_workers <= 0) {
+                fprintf(stderr, "Invalid worker count: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--concurrency=", 14) == 0) {
+            options->concurrency = atoi(argv[i] + 14);
+            if (options->concurrency <= 0) {
+                fprintf(stderr, "Invalid concurrency: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--history=", 10) == 0) {
+            options->history_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "--no-history") == 0) {
+            options->history_path = NULL;
+        } else if (strncmp(argv[i], "--journal=", 10) == 0) {
+            options->journal_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "--no-journal") == 0) {
+            options->journal_path = NULL;
+        } else if (strncmp(argv[i], "--metrics=", 10) == 0) {
+            options->metrics_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--output-limit=", 15) == 0) {
+            options->output_limit = atoll(argv[i] + 15);
+        } else if (strncmp(argv[i], "--expected=", 11) == 0) {
+            options->expected_dir = argv[i] + 11;
+        } else if (strcmp(argv[i], "--ignore-whitespace") == 0) {
+            options->ignore_whitespace = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            options->trace_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--no-host-pool") == 0) {
+            options->host_pool = 0;
+        } else if (strncmp(argv[i], "--host-slots=", 13) == 0) {
+            options->host_slots = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--host-pool-split=", 18) == 0) {
+            options->host_pool_split = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--stderr=", 9) == 0) {
+            options->stderr_path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--inherit-stderr") == 0) {
+            options->stderr_path = NULL;
+        } else if (strncmp(argv[i], "--stderr-keep=", 14) == 0) {
+            options->stderr_keep = atoll(argv[i] + 14);
+        } else if (strncmp(argv[i], "--stderr-budget=", 16) == 0) {
+            options->stderr_budget = atoll(argv[i] + 16);
+        } else if (strncmp(argv[i], "--log=", 6) == 0) {
+            options->log_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--log-level=", 12) == 0) {
+            options->log_level = argv[i] + 12;
+        } else if (strncmp(argv[i], "--ipc=", 6) == 0) {
+            options->ipc = argv[i] + 6;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            options->resume = 1;
+        } else if (strncmp(argv[i], "--stop-after=", 13) == 0) {
+            options->stop_after = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--min-score=", 12) == 0) {
+            options->min_score = atof(argv[i] + 12);
+        } else if (strncmp(argv[i], "--prior-ms=", 11) == 0) {
+            options->prior_ms = atoll(argv[i] + 11);
+        } else if (strcmp(argv[i], "--pin=core") == 0) {
+            options->pin = PIN_CORE;
+        } else if (strcmp(argv[i], "--pin=l3") == 0) {
+            options->pin = PIN_L3;
+        } else if (strncmp(argv[i], "--report=", 9) == 0) {
+            options->report_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--params=", 9) == 0) {
+            options->params_spec = argv[i] + 9;
+        } else if (strncmp(argv[i], "--capacity=", 11) == 0) {
+            options->capacity = atoi(argv[i] + 11);
+            if (options->capacity <= 0) {
+                fprintf(stderr, "Invalid capacity: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
         } else {
-            perror("Failed to get file status");
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
             exit(EXIT_FAILURE);
         }
     }
+    return i;
+}
 
-    // Allocate memory for the array of strings
-    char **executables = (char **) malloc(*num_executables * sizeof(char *));
-    if (!executables) {
-        perror("Failed to allocate memory");
-        exit(EXIT_FAILURE);
+
+// A --params=SPEC source: "FIRST..LAST[:STEP]", "random:COUNT:SEED[:MAX]" or "@FILE"
+typedef struct {
+    long long first;           // Range: first value, then every step up to last
+    long long last;
+    long long step;
+    unsigned long long seed;   // Random: COUNT distinct values in 1..max
+    long long max;
+    long long stride;          // Coprime with max, so seed + i * stride visits each value once
+    char *contents;            // File: its contents, whitespace turned into NULs
+    size_t contents_len;
+    long long count;
+} param_spec_t;
+
+
+static long long gcd(long long a, long long b) {
+    while (b != 0) {
+        long long t = a % b;
+        a = b;
+        b = t;
     }
+    return a;
+}
 
-    // Reset the directory stream
-    rewinddir(dir);
 
-    // Read the file names
-    int i = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        // Ignore hidden files
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "%s/%s", solution_dir, entry->d_name);
-
-        if (stat(path, &st) == 0) {
-            if (S_ISREG(st.st_mode) && entry->d_name[0] != '.') {
-                int len_executable = strlen(solution_dir) + strlen(entry->d_name) + 2;
-                executables[i] = (char *) malloc((len_executable) * sizeof(char));
-                if (!executables[i]) {
-                    perror("Failed to allocate memory");
+// Parse spec into source, reading the file of "@FILE". Exits on a bad spec.
+static void parse_param_spec(char *spec, param_spec_t *source) {
+    memset(source, 0, sizeof(param_spec_t));
+    if (spec[0] == '@') {
+        int fd = open(spec + 1, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            perror(spec + 1);
+            exit(EXIT_FAILURE);
+        }
+        // Read until EOF: st_size is only a first guess (0 for a pipe or /dev/stdin).
+        // A spare byte lets a file that didn't change reach EOF without growing.
+        size_t capacity = st.st_size > 0 ? (size_t) st.st_size + 2 : BUFSIZ;
+        source->contents = (char *) malloc(capacity);
+        if (source->contents == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        for (;;) {
+            if (source->contents_len + 1 == capacity) {
+                capacity *= 2;
+                source->contents = (char *) realloc(source->contents, capacity);
+                if (source->contents == NULL) {
+                    fprintf(stderr, "Error occurred at line %d: realloc failed\n", __LINE__ - 2);
                     exit(EXIT_FAILURE);
                 }
-                snprintf(executables[i], len_executable, "%s/%s", solution_dir, entry->d_name);
-                i++;
+            }
+            ssize_t bytes_read = read(fd, source->contents + source->contents_len, capacity - 1 - source->contents_len);
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_read == -1) {
+                perror(spec + 1);
+                exit(EXIT_FAILURE);
+            }
+            if (bytes_read == 0) {
+                break;
+            }
+            source->contents_len += bytes_read;
+        }
+        close(fd);
+        source->contents[source->contents_len] = '\0';
+        // Parameters are separated by any whitespace
+        int in_param = 0;
+        for (size_t i = 0; i < source->contents_len; i++) {
+            if (isspace((unsigned char) source->contents[i])) {
+                source->contents[i] = '\0';
+                in_param = 0;
+            } else if (!in_param) {
+                source->count++;
+                in_param = 1;
             }
         }
+        return;
     }
 
-    // Close the directory
-    closedir(dir);
+    if (strncmp(spec, "random:", 7) == 0) {
+        source->max = 1000000;
+        int fields = sscanf(spec + 7, "%lld:%llu:%lld", &source->count, &source->seed, &source->max);
+        if (fields < 2 || source->count < 0 || source->max <= 0 || source->count > source->max) {
+            fprintf(stderr, "Invalid parameters: %s (random:COUNT:SEED[:MAX], COUNT <= MAX)\n", spec);
+            exit(EXIT_FAILURE);
+        }
+        // splitmix64 of the seed picks where to start and how far to jump
+        unsigned long long z = source->seed + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        source->seed = z % source->max;
+        source->stride = (long long) ((z >> 17) % source->max) | 1;
+        while (gcd(source->stride, source->max) != 1) {
+            source->stride++;
+        }
+        return;
+    }
 
-    // Return the array of strings (remember to free the memory later)
-    return executables;
+    source->step = 1;
+    int fields = sscanf(spec, "%lld..%lld:%lld", &source->first, &source->last, &source->step);
+    long long span;
+    // LAST - FIRST must not overflow, and a span of LLONG_MAX would have one value too many
+    if (fields < 2 || source->step == 0 || __builtin_sub_overflow(source->last, source->first, &span)
+        || (source->step == -1 && span == LLONG_MIN) || span / source->step < 0 || span / source->step == LLONG_MAX) {
+        fprintf(stderr, "Invalid parameters: %s (FIRST..LAST[:STEP], random:COUNT:SEED[:MAX] or @FILE)\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    source->count = span / source->step + 1;
 }
 
 
-// TODO: Implement this function
-int get_batch_size() {
-    int batch_size = 0;
-    int bytes_read;  // bytes_read
-    int pipe_fd[2];  // create a pipe for outputs
+// Format the i-th value of a range or random source into buf (of size n, or NULL
+// to measure). Returns its length.
+static int format_spec_param(param_spec_t *source, long long i, char *buf, size_t n) {
+    long long value;
+    if (source->max > 0) {
+        // i * stride reaches MAX^2: wider than 64 bits once MAX is above 2^32
+        value = 1 + (long long) ((source->seed + (unsigned __int128) i * source->stride) % source->max);
+    } else {
+        value = source->first + i * source->step;
+    }
+    return snprintf(buf, n, "%lld", value);
+}
 
-    if (pipe(pipe_fd) == -1) {
-        fprintf(stderr, "Error occurred at line %d: pipe failed\n", __LINE__ - 1);
+
+char **load_params(char *spec, char **argv_params, int num_argv_params, int *total_params) {
+    *total_params = num_argv_params;
+    if (spec == NULL) {
+        return argv_params;
+    }
+    param_spec_t source;
+    parse_param_spec(spec, &source);
+    if (source.count > INT_MAX / 2 - num_argv_params) {
+        fprintf(stderr, "Too many parameters: %s\n", spec);
         exit(EXIT_FAILURE);
     }
+    int num_params = num_argv_params + (int) source.count;
 
-    pid_t pid = fork();
+    // Pointers, then the strings of a range or generator, in one allocation
+    size_t strings_len = source.contents_len + 1;
+    if (source.contents == NULL) {
+        strings_len = 0;
+        for (long long i = 0; i < source.count; i++) {
+            strings_len += format_spec_param(&source, i, NULL, 0) + 1;
+        }
+    }
+    char **params = (char **) malloc(num_params * sizeof(char *) + strings_len);
+    if (params == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(params, argv_params, num_argv_params * sizeof(char *));
 
-    if (pid == 0) {  // child process
-        if (close(pipe_fd[0]) == -1) {  // Closing read end, won't need it.
-            fprintf(stderr, "Error occurred at line %d: close failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
+    char *strings = (char *) (params + num_params);
+    if (source.contents != NULL) {
+        memcpy(strings, source.contents, source.contents_len + 1);
+        free(source.contents);
+        int k = num_argv_params;
+        for (size_t i = 0; i < source.contents_len; i++) {
+            if (strings[i] != '\0' && (i == 0 || strings[i - 1] == '\0')) {
+                params[k++] = strings + i;
+            }
         }
-        if (dup2(pipe_fd[1], STDOUT_FILENO) == -1) {  // redirecting stdout to pipe
-            fprintf(stderr, "Error occured at line %d: dup2 failed\n", __LINE__ - 1);
-            exit(EXIT_FAILURE);
+    } else {
+        for (long long i = 0; i < source.count; i++) {
+            params[num_argv_params + i] = strings;
+            strings += format_spec_param(&source, i, strings, 32) + 1;
         }
-        execlp("grep", "grep", "-c", "^processor", "/proc/cpuinfo", NULL);
-        fprintf(stderr, "Error occured at line %d: Failed to run execlp", __LINE__ - 1);
+    }
+    *total_params = num_params;
+    return params;
+}
+
+
+void exe_table_init(exe_table_t *table) {
+    memset(table, 0, sizeof(exe_table_t));
+}
+
+
+// FNV-1a hash of path
+static size_t hash_path(const char *path) {
+    size_t hash = 2166136261u;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    return hash;
+}
+
+
+// Double the hash table and re-insert every index
+static void grow_buckets(exe_table_t *table) {
+    int num_buckets = table->num_buckets ? table->num_buckets * 2 : 128;
+    int *buckets = (int *) calloc(num_buckets, sizeof(int));
+    if (buckets == NULL) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
-    } else if (pid > 0) {  // Parent process
-        if (close(pipe_fd[1]) == -1) {  // close off write
-            perror("Close Failed");
-            exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < table->num_executables; i++) {
+        size_t slot = hash_path(exe_table_path(table, i)) & (num_buckets - 1);
+        while (buckets[slot] != 0) {
+            slot = (slot + 1) & (num_buckets - 1);
         }
-        char reader[BUFSIZ];
-        if ((bytes_read = read(pipe_fd[0], reader, BUFSIZ)) == -1) {  // read from pipe
-            perror("read failed");
+        buckets[slot] = i + 1;
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->num_buckets = num_buckets;
+}
+
+
+int exe_table_intern(exe_table_t *table, const char *path) {
+    if (2 * (table->num_executables + 1) > table->num_buckets) {
+        grow_buckets(table);
+    }
+    size_t slot = hash_path(path) & (table->num_buckets - 1);
+    while (table->buckets[slot] != 0) {
+        int index = table->buckets[slot] - 1;
+        if (strcmp(exe_table_path(table, index), path) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & (table->num_buckets - 1);
+    }
+
+    size_t len = strlen(path) + 1;
+    if (table->block == NULL || table->block_len + len > table->block_size) {
+        // Start a new block, chained to the full one so exe_table_free() finds it
+        size_t block_size = sizeof(char *) + len > EXE_TABLE_BLOCK ? sizeof(char *) + len : EXE_TABLE_BLOCK;
+        char *block = (char *) malloc(block_size);
+        if (block == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
-        reader[bytes_read] = '\0';  // adding string term character to end of batch_size;
-        if (close(pipe_fd[0]) == -1) {  // closing read end of pipe.
-            perror("close failed");
+        memcpy(block, &table->block, sizeof(char *));
+        table->block = block;
+        table->block_len = sizeof(char *);
+        table->block_size = block_size;
+    }
+    // Grow the paths geometrically instead of counting entries up front
+    if (table->num_executables == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 64;
+        char **paths = (char **) realloc(table->paths, capacity * sizeof(char *));
+        if (paths == NULL) {
+            perror("Failed to allocate memory");
             exit(EXIT_FAILURE);
         }
+        table->paths = paths;
+        table->capacity = capacity;
+    }
+    memcpy(table->block + table->block_len, path, len);
+    table->paths[table->num_executables] = table->block + table->block_len;
+    table->block_len += len;
+    table->buckets[slot] = ++table->num_executables;
+    return table->num_executables - 1;
+}
+
+
+void exe_table_free(exe_table_t *table) {
+    while (table->block != NULL) {
+        char *previous;
+        memcpy(&previous, table->block, sizeof(char *));
+        free(table->block);
+        table->block = previous;
+    }
+    free(table->paths);
+    free(table->buckets);
+    memset(table, 0, sizeof(exe_table_t));
+}
+
+
+void open_executable_scanner(executable_scanner_t *scanner, char *solution_dir, int exec_only) {
+    memset(scanner, 0, sizeof(executable_scanner_t));
+    scanner->solution_dir = solution_dir;
+    scanner->exec_only = exec_only;
+    exe_table_init(&scanner->table);
+
+    scanner->dir = opendir(solution_dir);
+    if (!scanner->dir) {
+        perror("Failed to open directory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Decide whether a directory entry is a (possibly executable) regular file. d_type
+// answers this without a syscall on most filesystems; fstatat() relative to the
+// directory fd is only needed when d_type is unknown, for symlinks, or to read the
+// execute bits.
+static int is_student_executable(executable_scanner_t *scanner, struct dirent *entry) {
+    struct stat st;
+
+    // Ignore hidden files
+    if (entry->d_name[0] == '.') {
+        return 0;
+    }
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK && entry->d_type != DT_REG) {
+        return 0;
+    }
+    if (entry->d_type == DT_REG && !scanner->exec_only) {
+        return 1;
+    }
+
+    if (fstatat(dirfd(scanner->dir), entry->d_name, &st, 0) == -1) {
+        if (errno == ENOENT) {  // Removed (or dangling symlink) since readdir()
+            return 0;
+        }
+        perror("Failed to get file status");
+        exit(EXIT_FAILURE);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    return !scanner->exec_only || (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+}
+
 
-        pid_t wait_result;
-        do {
-            wait_result = wait(NULL);
-            if (wait_result == -1 && errno != EINTR) {
-                perror("wait failed");
+int scan_executables(executable_scanner_t *scanner, int max_new) {
+    struct dirent *entry;
+    int found = 0;
+
+    while (scanner->dir && (max_new <= 0 || found < max_new)) {
+        errno = 0;
+        if ((entry = readdir(scanner->dir)) == NULL) {
+            if (errno != 0) {
+                perror("Failed to read directory");
                 exit(EXIT_FAILURE);
             }
-        } while (wait_result == -1 && errno == EINTR);
+            // End of the directory stream
+            closedir(scanner->dir);
+            scanner->dir = NULL;
+            break;
+        }
+
+        if (!is_student_executable(scanner, entry)) {
+            continue;
+        }
+
+        char executable[PATH_MAX];
+        snprintf(executable, sizeof(executable), "%s/%s", scanner->solution_dir, entry->d_name);
+        exe_table_intern(&scanner->table, executable);
+        found++;
+    }
+    return found;
+}
+
+
+int accept_student_executable(char *solution_dir, char *name, int exec_only) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    // Ignore hidden files (and temporary files being copied in, usually hidden)
+    if (name[0] == '.') {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%s", solution_dir, name);
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    return !exec_only || (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+}
+
+
+void close_executable_scanner(executable_scanner_t *scanner) {
+    if (scanner->dir) {
+        closedir(scanner->dir);
+        scanner->dir = NULL;
+    }
+}
+
+
+int get_student_executables(char *solution_dir, exe_table_t *table, int exec_only) {
+    executable_scanner_t scanner;
+
+    // Single pass over the directory
+    open_executable_scanner(&scanner, solution_dir, exec_only);
+    scan_executables(&scanner, 0);
+    close_executable_scanner(&scanner);
+
+    // The table is the caller's now (remember to exe_table_free() it later)
+    *table = scanner.table;
+    return table->num_executables;
+}
+
+
+extern char **environ;
+
+
+void raise_open_file_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("Failed to get open file limit");
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("Failed to raise open file limit");
+    }
+}
+
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+// Fold one 64-byte block into the SHA-256 state
+static void sha256_block(unsigned int *state, const unsigned char *block) {
+    unsigned int w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (unsigned int) block[4 * i] << 24 | (unsigned int) block[4 * i + 1] << 16
+               | (unsigned int) block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        unsigned int s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned int s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+    unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        unsigned int t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        unsigned int t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+int hash_file(int fd, char *hex) {
+    unsigned int state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    unsigned char buf[65536 + 64];  // Room for the padding after a partial block
+    size_t pending = 0;             // Bytes at the start of buf not hashed yet (less than a block)
+    unsigned long long length = 0;
+    ssize_t n;
+    while ((n = pread(fd, buf + pending, 65536 - pending, length)) > 0) {
+        length += n;
+        pending += n;
+        size_t whole = pending - pending % 64;
+        for (size_t i = 0; i < whole; i += 64) {
+            sha256_block(state, buf + i);
+        }
+        memmove(buf, buf + whole, pending - whole);
+        pending -= whole;
+    }
+    if (n == -1) {
+        return -1;
+    }
+
+    // Padding: 0x80, zeros, then the length in bits (big-endian) to end a block
+    size_t padded = pending < 56 ? 64 : 128;
+    memset(buf + pending, 0, padded - pending);
+    buf[pending] = 0x80;
+    for (int i = 0; i < 8; i++) {
+        buf[padded - 1 - i] = (unsigned char) ((length * 8) >> (8 * i));
+    }
+    for (size_t i = 0; i < padded; i += 64) {
+        sha256_block(state, buf + i);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        snprintf(hex + 8 * i, 9, "%08x", state[i]);
+    }
+    return 0;
+}
+
+
+int open_executable(char *executable_path) {
+    // O_RDONLY rather than O_PATH: posix_fadvise() needs a readable fd. Running
+    // out of fds (or an unreadable executable) just means launching by path.
+    return open(executable_path, O_RDONLY | O_CLOEXEC);
+}
+
+
+void prefetch_executable(int exe_fd) {
+    if (exe_fd == -1) {
+        return;
+    }
+    // WILLNEED only queues readahead and returns, so the I/O overlaps the running batch
+    posix_fadvise(exe_fd, 0, 0, POSIX_FADV_WILLNEED);
+}
+
+
+void exec_solution(int exe_fd, char *executable_path, char *const exec_argv[]) {
+    if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1) {
+        perror("prctl failed");
+    }
+    // The grader died before prctl() -> nobody would ever kill us
+    if (grader_pid != 0 && getppid() != grader_pid) {
+        _exit(1);
+    }
+    if (exe_fd != -1) {
+        fexecve(exe_fd, exec_argv, environ);
+        // Scripts can't be run from a close-on-exec fd (ENOENT) -> retry by path
+        if (errno != ENOENT) {
+            return;
+        }
+    }
+    execv(executable_path, exec_argv);
+}
+
+
+void limit_output_size(long long max_bytes) {
+    if (max_bytes <= 0) {
+        return;
+    }
+    struct rlimit limit = { (rlim_t) max_bytes, (rlim_t) max_bytes };
+    if (setrlimit(RLIMIT_FSIZE, &limit) == -1) {
+        perror("Failed to limit output size");
+    }
+    // SIGXFSZ must kill the child, not just fail its write()
+    signal(SIGXFSZ, SIG_DFL);
+}
+
+
+// Smallest CPU quota (quota / period, rounded up) in path or any of its ancestors
+// under root. format_v2 selects cgroup v2 "cpu.max" over v1 "cpu.cfs_quota_us".
+// Returns -1 if no quota applies.
+static int read_cgroup_cpu_quota(char *root, char *path, int format_v2) {
+    int quota_cpus = -1;
+    char dir[PATH_MAX];
+    snprintf(dir, PATH_MAX, "%s%s", root, path);
+
+    while (1) {
+        char file[PATH_MAX + 32];
+        long long quota = -1, period = 0;
+        FILE *fp;
+        if (format_v2) {
+            snprintf(file, sizeof(file), "%s/cpu.max", dir);
+            if ((fp = fopen(file, "r")) != NULL) {
+                // "max 100000" means no quota -> fscanf fails on the first field
+                if (fscanf(fp, "%lld %lld", &quota, &period) != 2) {
+                    quota = -1;
+                }
+                fclose(fp);
+            }
+        } else {
+            snprintf(file, sizeof(file), "%s/cpu.cfs_quota_us", dir);
+            if ((fp = fopen(file, "r")) != NULL) {
+                if (fscanf(fp, "%lld", &quota) != 1) {
+                    quota = -1;
+                }
+                fclose(fp);
+            }
+            snprintf(file, sizeof(file), "%s/cpu.cfs_period_us", dir);
+            if ((fp = fopen(file, "r")) != NULL) {
+                if (fscanf(fp, "%lld", &period) != 1) {
+                    period = 0;
+                }
+                fclose(fp);
+            }
+        }
+        if (quota > 0 && period > 0) {
+            int cpus = (int) ((quota + period - 1) / period);
+            if (quota_cpus == -1 || cpus < quota_cpus) {
+                quota_cpus = cpus;
+            }
+        }
+
+        // Move up one level, stopping after the mount root
+        if (strlen(dir) <= strlen(root)) {
+            break;
+        }
+        char *slash = strrchr(dir + strlen(root), '/');
+        if (slash == NULL) {
+            break;
+        }
+        *slash = '\0';
+    }
+    return quota_cpus;
+}
+
+
+// CPU quota of this process's cgroup in CPUs, -1 if unlimited
+static int get_cgroup_cpu_limit() {
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    int limit = -1;
+    char line[PATH_MAX + 64];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+
+        // Lines are "<id>:<controllers>:<path>"
+        char *controllers = strchr(line, ':');
+        char *path = controllers == NULL ? NULL : strchr(controllers + 1, ':');
+        if (path == NULL) {
+            continue;
+        }
+        *controllers++ = '\0';
+        *path++ = '\0';
+
+        int cpus = -1;
+        if (strcmp(line, "0") == 0 && *controllers == '\0') {
+            cpus = read_cgroup_cpu_quota("/sys/fs/cgroup", path, 1);
+        } else {
+            // v1 hierarchy including the cpu controller, e.g. "cpu,cpuacct"
+            char *controller = strtok(controllers, ",");
+            while (controller != NULL && strcmp(controller, "cpu") != 0) {
+                controller = strtok(NULL, ",");
+            }
+            if (controller != NULL) {
+                cpus = read_cgroup_cpu_quota("/sys/fs/cgroup/cpu", path, 0);
+                if (cpus == -1) {
+                    cpus = read_cgroup_cpu_quota("/sys/fs/cgroup/cpu,cpuacct", path, 0);
+                }
+            }
+        }
+        if (cpus != -1 && (limit == -1 || cpus < limit)) {
+            limit = cpus;
+        }
+    }
+    fclose(fp);
+    return limit;
+}
 
-        batch_size = atoi(reader);
+
+int get_batch_size() {
+    // CPUs this process may run on...
+    int batch_size;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) {
+        batch_size = CPU_COUNT(&allowed);
     } else {
-        perror("fork failed");
-        exit(EXIT_FAILURE);
+        batch_size = (int) sysconf(_SC_NPROCESSORS_ONLN);
     }
-    return batch_size;
+
+    // ...capped by the CPU time the cgroup may use
+    int quota_cpus = get_cgroup_cpu_limit();
+    if (quota_cpus != -1 && quota_cpus < batch_size) {
+        batch_size = quota_cpus;
+    }
+    return batch_size > 0 ? batch_size : 1;
 }
 
 
-// TODO: Implement this function
-void create_input_files(char **argv_params, int num_parameters) {
-    for (int i = 0; i < num_parameters; ++i) {
-        size_t len_input_file = strlen("input/") + strlen(argv_params[i]) + strlen(".in") + 1;  // +1 for the null terminator
-        char *input_file = (char *) malloc(len_input_file);  // +1 for the null terminator
-        if (input_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
+// Parse a sysfs CPU list ("0-3,8,10-11") from path into set. Returns -1 if
+// the file can't be read.
+static int read_cpu_list(char *path, cpu_set_t *set) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char list[BUFSIZ];
+    if (fgets(list, sizeof(list), fp) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    CPU_ZERO(set);
+    char *saveptr;
+    for (char *range = strtok_r(list, ",\n", &saveptr); range != NULL; range = strtok_r(NULL, ",\n", &saveptr)) {
+        int first, last;
+        int fields = sscanf(range, "%d-%d", &first, &last);
+        if (fields < 1) {
+            continue;
+        }
+        if (fields == 1) {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return 0;
+}
+
+
+int get_cpu_domains(int pin, cpu_set_t **domains) {
+    cpu_set_t allowed;
+    *domains = NULL;
+    if (pin == PIN_NONE || sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        return 0;
+    }
+    *domains = (cpu_set_t *) malloc(CPU_COUNT(&allowed) * sizeof(cpu_set_t));
+    if (*domains == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+
+    // Group the allowed CPUs into domains in order of their lowest CPU
+    int num_domains = 0;
+    cpu_set_t assigned;
+    CPU_ZERO(&assigned);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &assigned)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        if (pin == PIN_L3) {
+            snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", cpu);
+        } else {
+            snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        }
+
+        // Without topology information every CPU is its own domain
+        cpu_set_t domain;
+        if (read_cpu_list(path, &domain) == -1) {
+            CPU_ZERO(&domain);
         }
-        snprintf(input_file, len_input_file, "input/%s.in", argv_params[i]);
-        FILE *file = fopen(input_file, "w");
-        if (!file) {
-            perror("Failed to open file");
+        CPU_SET(cpu, &domain);
+        CPU_AND(&(*domains)[num_domains], &domain, &allowed);
+        CPU_OR(&assigned, &assigned, &(*domains)[num_domains]);
+        num_domains++;
+    }
+    return num_domains;
+}
+
+
+void pin_to_cpu_domain(cpu_set_t *domains, int num_domains, int index) {
+    if (num_domains == 0) {
+        return;
+    }
+    // More workers / slots than domains -> share them round-robin
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &domains[index % num_domains]) == -1) {
+        perror("Failed to pin to CPU domain");
+    }
+}
+
+
+int create_input_memfd(char *name, const void *data, size_t len) {
+    // Longer names fail with EINVAL -> cut them (long parameters)
+    char short_name[MEMFD_NAME_MAX + 1];
+    snprintf(short_name, sizeof(short_name), "%s", name);
+    int fd = memfd_create(short_name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        perror("Failed to create memfd");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t bytes_written = write(fd, (const char *) data + written, len - written);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write memfd");
             exit(EXIT_FAILURE);
         }
-        fprintf(file, "%s", argv_params[i]);
-        fclose(file);
-        free(input_file);
+        written += bytes_written;
+    }
+
+    // Sealed -> children can't modify the input seen by the rest of the run
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        perror("Failed to seal memfd");
+        exit(EXIT_FAILURE);
     }
+    return fd;
+}
+
+
+// TODO: Implement this function
+int *create_input_files(char **argv_params, int num_parameters) {
+    int *input_fds = (int *) malloc(num_parameters * sizeof(int));
+    if (input_fds == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_parameters; ++i) {
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "input/%s.in", argv_params[i]);  // Only shows up in /proc/<pid>/fd
+        input_fds[i] = create_input_memfd(name, argv_params[i], strlen(argv_params[i]));
+    }
+    return input_fds;
+}
+
+
+int open_input_fd(int input_fd) {
+    // dup() would share the file offset with every other child reading this input.
+    // Reopening through /proc gives a new open file description at offset 0.
+    char proc_path[PATH_MAX];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", input_fd);
+    return open(proc_path, O_RDONLY);
 }
 
 
@@ -210,45 +1036,35 @@ void cancel_timer() {
 
 
 // TODO: Implement this function
-void remove_input_files(char **argv_params, int num_parameters) {
+void remove_input_files(int *input_fds, int num_parameters) {
     for (int i = 0; i < num_parameters; ++i) {
-        size_t len_input_file = strlen("input/") + strlen(argv_params[i]) + strlen(".in") + 1;  // +1 for the null terminator
-        char *input_file = (char *) malloc(len_input_file);  // +1 for the null terminator
-        if (input_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
-        }
-        snprintf(input_file, len_input_file, "input/%s.in", argv_params[i]);
-        if (unlink(input_file) == -1) {
-            perror("Failed to unlink file");
-            free(input_file);
+        if (close(input_fds[i]) == -1) {
+            perror("Failed to close input memfd");
             exit(EXIT_FAILURE);
         }
-        free(input_file);
     }
+    free(input_fds);
 }
 
 
 // TODO: Implement this function
-void remove_output_files(autograder_results_t *results, int tested, int current_batch_size, char *param) {
-    for (int i = 0; i < current_batch_size; ++i) {
-        char *exe_name = get_exe_name(results[tested - current_batch_size + i].exe_path);
-        size_t len_output_file = strlen("output/") + strlen(exe_name) + strlen(param) + 2;  // +1 for the null terminator
-        char *output_file = (char *) malloc(len_output_file);
-        if (output_file == NULL) {
-            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
-        }
-        snprintf(output_file, len_output_file, "output/%s.%s", exe_name, param);
-
-        if (unlink(output_file) == -1) {
-            perror("Failed to unlink file");
-            free(output_file);
-            exit(EXIT_FAILURE);
-        }
+void remove_output_file(char *exe_path, char *param) {
+    char *exe_name = get_exe_name(exe_path);
+    size_t len_output_file = strlen("output/") + strlen(exe_name) + strlen(param) + 2;  // +1 for the null terminator
+    char *output_file = (char *) malloc(len_output_file);
+    if (output_file == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(output_file, len_output_file, "output/%s.%s", exe_name, param);
 
+    if (unlink(output_file) == -1) {
+        perror("Failed to unlink file");
         free(output_file);
+        exit(EXIT_FAILURE);
     }
+
+    free(output_file);
 }
 
 
@@ -265,6 +1081,41 @@ int get_longest_len_executable(autograder_results_t *results, int num_executable
 }
 
 
+// Room for one row of results.txt. Every row labels column j with the same
+// parameter string, so the first row gives the widths of all of them.
+static size_t results_row_size(autograder_results_t *results, int num_executables, int longest_len, int total_params) {
+    size_t size = longest_len + 3;
+    for (int j = 0; j < total_params; j++) {
+        size += (num_executables > 0 ? strlen(results[0].params_tested[j]) : 0) + MAX_INT_CHARS + 14;
+    }
+    return size;
+}
+
+
+// One row of results.txt (see write_results_to_file()), newline included. Returns its length.
+static int format_results_row(char *row, size_t size, autograder_results_t *result, int total_params, int longest_len) {
+    int len = snprintf(row, size, "%-*s:", longest_len, get_exe_name(result->exe_path));  // Write the program path
+    for (int j = 0; j < total_params; j++) {
+        // Write the pi value for the program, then its status
+        len += snprintf(row + len, size - len, "%5s (%9s) ", result->params_tested[j], get_status_message(result->status[j]));
+    }
+    len += snprintf(row + len, size - len, "\n");
+    return len;
+}
+
+
+// One row of scores.txt (see write_scores_to_file()), newline included. Returns its length.
+static int format_scores_row(char *row, size_t size, autograder_results_t *result, int longest_len, double score) {
+    int len = snprintf(row, size, "%-*s: %5.3f", longest_len, get_exe_name(result->exe_path), score);
+    if (result->failfast.skipped > 0) {
+        // Fail-fast skips count as not correct
+        len += snprintf(row + len, size - len, " (%d skipped)", result->failfast.skipped);
+    }
+    len += snprintf(row + len, size - len, "\n");
+    return len;
+}
+
+
 void write_results_to_file(autograder_results_t *results, int num_executables, int total_params) {
     FILE *file = fopen("results.txt", "w");
     if (!file) {
@@ -298,19 +1149,17 @@ void write_results_to_file(autograder_results_t *results, int num_executables, i
     }
 
     // Write results to file
+    size_t row_size = results_row_size(results, num_executables, longest_len, total_params);
+    char *row = (char *) malloc(row_size);
+    if (row == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
     for (int i = 0; i < num_executables; i++) {
-        char *exe_name = get_exe_name(results[i].exe_path);
-
-        char format[20];
-        snprintf(format, sizeof(format), "%%-%ds:", longest_len);
-        fprintf(file, format, exe_name);  // Write the program path
-        for (int j = 0; j < total_params; j++) {
-            fprintf(file, "%5d (", results[i].params_tested[j]);  // Write the pi value for the program
-            const char* message = get_status_message(results[i].status[j]);
-            fprintf(file, "%9s) ", message);  // Write each status
-        }
-        fprintf(file, "\n");
+        format_results_row(row, row_size, &results[i], total_params, longest_len);
+        fputs(row, file);
     }
+    free(row);
 
     fclose(file);
 }
@@ -366,7 +1215,6 @@ double get_score(char *results_file, char *executable_name) {
 void write_scores_to_file(autograder_results_t *results, int num_executables, char *results_file) {
     for (int i = 0; i < num_executables; i++) {
         double student_score = get_score(results_file, results[i].exe_path);
-        char *student_exe = get_exe_name(results[i].exe_path);
 
         char score_file[] = "scores.txt";
 
@@ -383,11 +1231,94 @@ void write_scores_to_file(autograder_results_t *results, int num_executables, ch
 
         int longest_len = get_longest_len_executable(results, num_executables);
 
-        char format[20];
-        sprintf(format, "%%-%ds: ", longest_len);
-        fprintf(score_fp, format, student_exe);
-        fprintf(score_fp, "%5.3f\n", student_score);
+        char row[PATH_MAX + 64];
+        format_scores_row(row, sizeof(row), &results[i], longest_len, student_score);
+        fputs(row, score_fp);
 
         fclose(score_fp);
     }
 }
+
+
+// Replace rows[k] of path by texts[k] in place. Returns -1, writing nothing, if
+// path doesn't have num_lines lines or a new row isn't as long as the old one.
+static int rewrite_rows(char *path, int num_lines, int *rows, char **texts, int num_rows) {
+    int fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    char *contents = NULL;
+    off_t *line_starts = (off_t *) malloc((num_lines + 1) * sizeof(off_t));
+    if (line_starts == NULL || fstat(fd, &st) == -1 || (contents = (char *) malloc(st.st_size + 1)) == NULL) {
+        perror("Failed to read results");
+        exit(EXIT_FAILURE);
+    }
+    int ok = read(fd, contents, st.st_size) == st.st_size;
+
+    // Where each line starts (line_starts[num_lines] is the end of the file)
+    int lines = 0;
+    line_starts[0] = 0;
+    for (off_t pos = 0; ok && pos < st.st_size; pos++) {
+        if (contents[pos] == '\n') {
+            if (++lines > num_lines) {
+                ok = 0;
+                break;
+            }
+            line_starts[lines] = pos + 1;
+        }
+    }
+    ok = ok && lines == num_lines;
+    for (int k = 0; ok && k < num_rows; k++) {
+        ok = line_starts[rows[k] + 1] - line_starts[rows[k]] == (off_t) strlen(texts[k]);
+    }
+    for (int k = 0; ok && k < num_rows; k++) {
+        if (pwrite(fd, texts[k], strlen(texts[k]), line_starts[rows[k]]) == -1) {
+            perror("Failed to update results");
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(contents);
+    free(line_starts);
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+
+int update_result_rows(autograder_results_t *results, int num_executables, int total_params, int *rows, int num_rows) {
+    int longest_len = get_longest_len_executable(results, num_executables);
+    size_t row_size = results_row_size(results, num_executables, longest_len, total_params);
+    char **texts = (char **) malloc(num_rows * sizeof(char *));
+    if (texts == NULL) {
+        fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < num_rows; k++) {
+        texts[k] = (char *) malloc(row_size);
+        if (texts[k] == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 2);
+            exit(EXIT_FAILURE);
+        }
+        format_results_row(texts[k], row_size, &results[rows[k]], total_params, longest_len);
+    }
+    int ret = rewrite_rows("results.txt", num_executables, rows, texts, num_rows);
+
+    // Same score as get_score() would read back from the row
+    for (int k = 0; ret == 0 && k < num_rows; k++) {
+        autograder_results_t *result = &results[rows[k]];
+        int correct = 0;
+        for (int j = 0; j < total_params; j++) {
+            correct += result->status[j] == CORRECT;
+        }
+        format_scores_row(texts[k], row_size, result, longest_len, (double) correct / total_params);
+    }
+    if (ret == 0) {
+        ret = rewrite_rows("scores.txt", num_executables, rows, texts, num_rows);
+    }
+
+    for (int k = 0; k < num_rows; k++) {
+        free(texts[k]);
+    }
+    free(texts);
+    return ret;
+}
@@ -0,0 +1,359 @@
+#include "utils.h"
+#include <sys/ptrace.h>
+#include <math.h>
+
+/*
+Microbenchmarks of the utils.c functions whose cost grows with the number of
+submissions, each measured on its own on generated input:
+
+    scan        get_student_executables() on a directory of n files
+    scan -x     the same with --exec-only (one fstatat() per file)
+    results     write_results_to_file() on n executables x BENCH_PARAMS parameters
+    scores      write_scores_to_file() on the results.txt of n executables
+    get_score   get_score() of the last executable in a results.txt of n rows
+
+    > make utils_bench && ./utils_bench [max_n] [repetitions]
+
+n goes through the powers of ten from 100 to max_n (default 10000; 1000000
+creates a million files and takes minutes). Each size gets one warm-up call,
+then repetitions timed calls (default 5). The report for each size gives:
+- the median, minimum and relative standard deviation;
+- the median per entry, which stays flat for linear work and grows tenfold
+  per row for quadratic work;
+- the allocations utils.c made during one call (malloc, calloc and realloc,
+  wrapped at link time);
+- the syscalls of one call, counted under ptrace in a forked child less those
+  of an empty call ("-" if ptrace isn't allowed, or the call is over budget).
+A benchmark stops growing once a call takes longer than BENCH_BUDGET_NS.
+
+Everything is generated in a temporary directory under /tmp, removed at the end.
+*/
+
+#define DEFAULT_MAX_N 10000
+#define DEFAULT_REPETITIONS 5
+#define MAX_REPETITIONS 1000
+#define BENCH_PARAMS 8
+#define BENCH_BUDGET_NS 1000000000LL
+
+typedef struct {
+    char *name;
+    void (*setup)(int n);   // Build the input for n entries (untimed)
+    void (*prepare)(void);  // Run before every call (untimed), NULL if nothing to do
+    void (*call)(void);     // What is measured
+} benchmark_t;
+
+static long long allocations;  // malloc, calloc and realloc calls so far
+static int num_files;          // Files in solutions/ so far
+static int num_results;
+static autograder_results_t *results;
+static unsigned long long random_state;
+static volatile double score_sink;
+static char *bench_params[BENCH_PARAMS] = {"1", "2", "3", "4", "5", "6", "7", "8"};
+
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+
+// xorshift64: the same input on every run
+static unsigned long long next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+
+// Grow or shrink solutions/ to n executable files sol_1 .. sol_n
+static void setup_files(int n) {
+    char path[PATH_MAX];
+    for (; num_files < n; num_files++) {
+        snprintf(path, sizeof(path), "solutions/sol_%d", num_files + 1);
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0755);
+        if (fd == -1) {
+            perror("Failed to create file");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+    for (; num_files > n; num_files--) {
+        snprintf(path, sizeof(path), "solutions/sol_%d", num_files);
+        unlink(path);
+    }
+}
+
+
+static void free_results(void) {
+    for (int i = 0; i < num_results; i++) {
+        free(results[i].exe_path);
+        free(results[i].params_tested);
+        free(results[i].status);
+    }
+    free(results);
+    results = NULL;
+    num_results = 0;
+}
+
+
+// n executables sol_1 .. sol_n with random statuses on parameters 1 .. BENCH_PARAMS
+static void setup_results(int n) {
+    free_results();
+    results = (autograder_results_t *) calloc(n, sizeof(autograder_results_t));
+    if (results == NULL) {
+        fprintf(stderr, "Error occurred at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    random_state = 88172645463325252ULL;
+    for (int i = 0; i < n; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "solutions/sol_%d", i + 1);
+        results[i].exe_path = strdup(path);
+        results[i].exe_fd = -1;
+        results[i].params_tested = (char **) malloc(BENCH_PARAMS * sizeof(char *));
+        results[i].status = (int *) malloc(BENCH_PARAMS * sizeof(int));
+        if (results[i].exe_path == NULL || results[i].params_tested == NULL || results[i].status == NULL) {
+            fprintf(stderr, "Error occurred at line %d: malloc failed\n", __LINE__ - 4);
+            exit(EXIT_FAILURE);
+        }
+        for (int j = 0; j < BENCH_PARAMS; j++) {
+            results[i].params_tested[j] = bench_params[j];
+            results[i].status[j] = CORRECT + next_random() % (MAX_STATUS - CORRECT + 1);
+        }
+    }
+    num_results = n;
+}
+
+
+// setup_results(), plus its results.txt (sorted by executable number)
+static void setup_results_file(int n) {
+    setup_results(n);
+    write_results_to_file(results, num_results, BENCH_PARAMS);
+}
+
+
+// Shuffle the results (the same way every time), as the graders hand them over
+static void shuffle_results(void) {
+    random_state = 2463534242ULL;
+    for (int i = num_results - 1; i > 0; i--) {
+        int j = next_random() % (i + 1);
+        autograder_results_t temp = results[i];
+        results[i] = results[j];
+        results[j] = temp;
+    }
+}
+
+
+static void call_scan(void) {
+    exe_table_t table;
+    get_student_executables("solutions", &table, 0);
+    exe_table_free(&table);
+}
+
+
+static void call_scan_exec_only(void) {
+    exe_table_t table;
+    get_student_executables("solutions", &table, 1);
+    exe_table_free(&table);
+}
+
+
+static void call_write_results(void) {
+    write_results_to_file(results, num_results, BENCH_PARAMS);
+}
+
+
+static void call_write_scores(void) {
+    write_scores_to_file(results, num_results, "results.txt");
+}
+
+
+static void call_get_score(void) {
+    score_sink = get_score("results.txt", results[num_results - 1].exe_path);
+}
+
+
+static void call_nothing(void) {
+}
+
+
+// Syscalls made by one call, in a child traced with ptrace (-1 if not allowed).
+// Includes those of stopping and exiting the child: subtract an empty call's.
+static long long count_syscalls(void (*call)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+            _exit(1);
+        }
+        raise(SIGSTOP);  // Wait until the parent traces syscalls
+        call();
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFSTOPPED(status)) {
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+    long long syscalls = 0;
+    int entering = 0;
+    int signal = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) signal) == -1) {
+            perror("ptrace failed");
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            break;
+        }
+        signal = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            // Syscall stops alternate between entry and exit
+            entering = !entering;
+            syscalls += entering;
+        } else {
+            signal = WSTOPSIG(status);  // Deliver it
+        }
+    }
+    return syscalls;
+}
+
+
+// Time bench on n entries and print its row. Returns the median call time.
+static long long run(benchmark_t *bench, int n, int repetitions, long long baseline_syscalls) {
+    long long samples[MAX_REPETITIONS];
+    bench->setup(n);
+
+    // Warm-up: one call over the budget is all this size gets
+    if (bench->prepare) {
+        bench->prepare();
+    }
+    long long allocated = allocations;
+    long long start = now_ns();
+    bench->call();
+    samples[0] = now_ns() - start;
+    long long call_allocations = allocations - allocated;
+    if (samples[0] > BENCH_BUDGET_NS) {
+        repetitions = 1;
+    } else {
+        for (int r = 0; r < repetitions; r++) {
+            if (bench->prepare) {
+                bench->prepare();
+            }
+            allocated = allocations;
+            start = now_ns();
+            bench->call();
+            samples[r] = now_ns() - start;
+            call_allocations = allocations - allocated;
+        }
+    }
+
+    double mean = 0, variance = 0;
+    for (int r = 0; r < repetitions; r++) {
+        mean += samples[r] / (double) repetitions;
+    }
+    for (int r = 0; r < repetitions; r++) {
+        variance += (samples[r] - mean) * (samples[r] - mean) / repetitions;
+    }
+    qsort(samples, repetitions, sizeof(long long), compare_ns);
+    long long median = samples[repetitions / 2];
+
+    // Tracing every syscall of a call over the budget would take much longer still
+    long long syscalls = -1;
+    if (median <= BENCH_BUDGET_NS) {
+        if (bench->prepare) {
+            bench->prepare();
+        }
+        syscalls = count_syscalls(bench->call);
+    }
+    char syscalls_text[32] = "-";
+    if (syscalls != -1 && baseline_syscalls != -1) {
+        snprintf(syscalls_text, sizeof(syscalls_text), "%lld", syscalls - baseline_syscalls);
+    }
+
+    printf("%-10s %8d %14lld %14lld %6.1f%% %11.1f %10lld %10s%s\n", bench->name, n, median, samples[0],
+           mean > 0 ? 100 * sqrt(variance) / mean : 0, median / (double) n, call_allocations, syscalls_text,
+           repetitions == 1 ? "  (1 call)" : "");
+    return median;
+}
+
+
+int main(int argc, char **argv) {
+    int max_n = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_N;
+    int repetitions = argc > 2 ? atoi(argv[2]) : DEFAULT_REPETITIONS;
+    if (max_n < 100 || repetitions <= 0 || repetitions > MAX_REPETITIONS) {
+        fprintf(stderr, "Usage: %s [max_n >= 100] [repetitions <= %d]\n", argv[0], MAX_REPETITIONS);
+        return 1;
+    }
+
+    char dir[] = "/tmp/utils_bench_XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) == -1 || mkdir("solutions", 0755) == -1) {
+        perror("Failed to create benchmark directory");
+        exit(EXIT_FAILURE);
+    }
+
+    benchmark_t benchmarks[] = {
+        {"scan", setup_files, NULL, call_scan},
+        {"scan -x", setup_files, NULL, call_scan_exec_only},
+        {"results", setup_results, shuffle_results, call_write_results},
+        {"scores", setup_results_file, NULL, call_write_scores},
+        {"get_score", setup_results_file, NULL, call_get_score},
+    };
+    long long baseline_syscalls = count_syscalls(call_nothing);
+
+    printf("%-10s %8s %14s %14s %7s %11s %10s %10s\n", "benchmark", "n", "median (ns)", "min (ns)", "rsd",
+           "ns/entry", "allocs", "syscalls");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        for (long long n = 100; n <= max_n; n *= 10) {
+            if (run(&benchmarks[i], n, repetitions, baseline_syscalls) > BENCH_BUDGET_NS) {
+                break;
+            }
+        }
+    }
+
+    setup_files(0);
+    free_results();
+    unlink("results.txt");
+    unlink("scores.txt");
+    if (rmdir("solutions") == -1 || chdir("/") == -1 || rmdir(dir) == -1) {
+        perror("Failed to remove benchmark directory");
+    }
+    return 0;
+}
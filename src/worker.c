@@ -1,13 +1,26 @@
 #include "utils.h"
+#include "uring_engine.h"
+#include "transport.h"
+#include "concurrency.h"
+#include "oracle.h"
+#include "trace.h"
+#include "log.h"
+#include "capture.h"
+#include "host_pool.h"
 
-// Run the (executable, parameter) pairs in batches of 8 to avoid timeouts due to 
-// having too many child processes running at once
-#define PAIRS_BATCH_SIZE 8
+// Pairs a remote worker runs at once without --capacity
+#define DEFAULT_CAPACITY 8
+
+// Remote workers keep executables fetched from mq_autograder here, by content hash
+#define WORKER_CACHE_DIR "worker_cache"
 
 typedef struct {
-    char *executable_path;
-    int parameter;
+    int exe_index;         // Into executables / exe_entries
+    int param_idx;         // Into mq_autograder's parameters (how results are matched)
+    char *parameter;       // param_names[param_idx]
     int status;
+    long long runtime_ms;  // Reported to mq_autograder for its runtime history
+    int expected_timeout;  // 1 if mq_autograder's runtime history expects it to time out
 } pairs_t;
 
 // Store the pairs tested by this worker and the results
@@ -15,10 +28,41 @@ pairs_t *pairs;
 
 // Information about the child processes and their results
 pid_t *pids;
+long long *start_ms;   // When child j of the batch was started
+long long *exit_ms;    // When child j of the batch was reaped
+long long *launch_us;  // When child j of the batch was forked, on the trace clock (0 if tracing is off)
 int *child_status;     // Contains status of child processes (-1 for done, 1 for still running)
+int *batch_statuses;   // Statuses of the batch from the io_uring engine
+char **output_paths;   // output/<executable>.<param> of child j, PATH_MAX each
+int *stderr_fds;       // Memfd child j writes its stderr to (-1 entries with --inherit-stderr)
+int scratch_size;      // Children the per-batch arrays have room for
+
+// The per-batch arrays above are allocated once for controller.max_limit
+// children by alloc_batch_scratch() and reused by every batch
 
-int curr_batch_size;   // At most PAIRS_BATCH_SIZE (executable, parameter) pairs will be run at once
+int batch_size;        // --capacity: most pairs run at once
+int curr_batch_size;   // At most controller.limit (executable, parameter) pairs will be run at once
+concurrency_t controller; // Adapts the batch size up to batch_size (see concurrency.h)
 long worker_id;        // Used for sending/receiving messages from the message queue
+int total_params;      // Parameters each executable is tested on across all workers
+char **param_names;    // String of each parameter index, stored once when first received (NULL until then)
+grader_options_t options; // Command line options (see utils.h)
+transport_t transport; // Message queue, or connection to mq_autograder with --connect
+oracle_t oracle;       // Expected outputs with --expected (see oracle.h)
+capture_t capture;     // Children's stderr, saved to --stderr=FILE (see capture.h)
+host_pool_t host_pool; // Slots for children shared with the other graders on this host (see host_pool.h)
+
+// Executables of this worker's pairs, each path stored once (see exe_table_t)
+exe_table_t executables;
+
+// Per executable (same index as executables), so each one is opened once per
+// worker no matter how many pairs test it
+typedef struct {
+    int exe_fd;
+    failfast_state_t failfast;
+} exe_entry_t;
+
+exe_entry_t *exe_entries;
 
 
 // TODO: Timeout handler for alarm signal - should be the same as the one in autograder.c
@@ -34,23 +78,111 @@ void timeout_handler(int signum) {
 }
 
 
-// Execute the student's executable using exec()
-void execute_solution(char *executable_path, int param, int batch_idx) {
+// Remote worker: get a copy of executable_path from mq_autograder, unless the
+// cache already holds one with the same content hash. Returns an fd for
+// exec_solution(), or -1 if mq_autograder can't provide the executable.
+int fetch_executable(char *executable_path) {
+    msgbuf_t msg;
+    memset(&msg, 0, sizeof(msgbuf_t));
+    msg.mtype = BROADCAST_MTYPE + 1;
+    snprintf(msg.mtext, MESSAGE_SIZE, "FETCH %ld %s", worker_id, executable_path);
+    if (transport_send(&transport, &msg) == -1 || transport_recv(&transport, &msg, worker_id, 0) == -1) {
+        perror("Failed to fetch executable from autograder");
+        exit(EXIT_FAILURE);
+    }
+
+    char hash[HASH_HEX_LEN + 1];
+    long long size;
+    if (sscanf(msg.mtext, "FILE %64s %lld", hash, &size) != 2 || strlen(hash) != HASH_HEX_LEN) {
+        fprintf(stderr, "Autograder could not provide %s\n", executable_path);
+        return -1;
+    }
+
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, PATH_MAX, "%s/%s", WORKER_CACHE_DIR, hash);
+    int fd = open_executable(cache_path);
+    msg.mtype = worker_id;
+    snprintf(msg.mtext, MESSAGE_SIZE, fd == -1 ? "SEND" : "HAVE");
+    if (transport_send(&transport, &msg) == -1) {
+        perror("Failed to send message to autograder");
+        exit(EXIT_FAILURE);
+    }
+    if (fd != -1) {
+        return fd;
+    }
+
+    // Receive into a temporary file and rename it into place so an interrupted
+    // transfer never leaves a truncated executable in the cache
+    if (mkdir(WORKER_CACHE_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("Failed to create worker cache");
+        exit(EXIT_FAILURE);
+    }
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, PATH_MAX, "%s/.%s.%ld.%d", WORKER_CACHE_DIR, hash, worker_id, getpid());
+    int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (tmp_fd == -1 || transport_recv_file(&transport, tmp_fd, size) == -1) {
+        perror("Failed to receive executable from autograder");
+        exit(EXIT_FAILURE);
+    }
+    if (close(tmp_fd) == -1 || rename(tmp_path, cache_path) == -1) {
+        perror("Failed to store executable in worker cache");
+        exit(EXIT_FAILURE);
+    }
+    return open_executable(cache_path);
+}
+
+
+// Open every executable once. Remote workers fetch executables they can't open locally.
+void open_executables() {
+    exe_entries = (exe_entry_t *) calloc(executables.num_executables, sizeof(exe_entry_t));
+    if (exe_entries == NULL) {
+        fprintf(stderr, "Error occured at line %d: calloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < executables.num_executables; i++) {
+        char *executable_path = exe_table_path(&executables, i);
+        exe_entries[i].exe_fd = open_executable(executable_path);
+        if (exe_entries[i].exe_fd == -1 && transport.type == TRANSPORT_SOCKET) {
+            exe_entries[i].exe_fd = fetch_executable(executable_path);
+        }
+    }
+}
+
+
+// Path of the executable pair k tests
+static inline char *pair_path(int k) {
+    return exe_table_path(&executables, pairs[k].exe_index);
+}
+
+
+// trace_end_pair() of a span about (executable_path, param)
+void trace_pair(const char *name, const char *category, long long start_us, int tid, char *executable_path, char *param) {
+    if (start_us == 0) {
+        return;
+    }
+    trace_end_pair(name, category, start_us, tid, get_exe_name(executable_path), param);
+}
+
+
+// Execute the student's executable using exec() (from exe_fd when it is open)
+void execute_solution(char *executable_path, int exe_fd, char *param, int batch_idx) {
+    long long trace_start = trace_begin();
     pid_t pid = fork();
 
     // Child process
     if (pid == 0) {
+        capture_redirect(stderr_fds[batch_idx]);
         char *executable_name = get_exe_name(executable_path);
 
         // TODO: Redirect STDOUT to output/<executable>.<input> file
-        int path_len = strlen("output/") + strlen(executable_name) + MAX_INT_CHARS + 2;
+        int path_len = strlen("output/") + strlen(executable_name) + strlen(param) + 2;
         // int path_len = PATH_MAX;
         char *output_file = (char *) malloc(path_len);
         if (output_file == NULL) {
             fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
             exit(EXIT_FAILURE);
         }
-        snprintf(output_file, path_len, "output/%s.%d", executable_name, param);
+        snprintf(output_file, path_len, "output/%s.%s", executable_name, param);
         int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
         free(output_file);
         if (fd == -1) {
@@ -65,16 +197,19 @@ void execute_solution(char *executable_path, int param, int batch_idx) {
             fprintf(stderr, "Error occured at line %d: close failed\n", __LINE__ - 1);
             exit(EXIT_FAILURE);
         }
+        limit_output_size(options.output_limit);
         // TODO: Input to child program can be handled as in the EXEC case (see template.c)
-        char param_str[MAX_INT_CHARS + 1];
-        snprintf(param_str, MAX_INT_CHARS, "%d", param);
-        execl(executable_path, executable_name, param_str, NULL);
+        char *exec_argv[] = {executable_name, param, NULL};
+        exec_solution(exe_fd, executable_path, exec_argv);
         perror("Failed to execute program in worker");
         exit(EXIT_FAILURE);
     }
     // Parent process
     else if (pid > 0) {
         pids[batch_idx] = pid;
+        start_ms[batch_idx] = monotonic_ms();
+        launch_us[batch_idx] = trace_start;
+        trace_pair("launch", "worker", trace_start, 0, executable_path, param);
     }
     // Fork failed
     else {
@@ -87,32 +222,41 @@ void execute_solution(char *executable_path, int param, int batch_idx) {
 // Wait for the batch to finish and check results
 void monitor_and_evaluate_solutions(int finished) {
     // Keep track of finished processes for alarm handler
-    child_status = (int *) malloc(curr_batch_size * sizeof(int));
-    if (child_status == NULL) {
-        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-        exit(EXIT_FAILURE);
-    }
     for (int j = 0; j < curr_batch_size; j++) {
         child_status[j] = 1;
     }
 
-    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out
-    for (int j = 0; j < curr_batch_size; j++) {
-        char *current_exe_path = pairs[finished + j].executable_path;
-        int current_param = pairs[finished + j].parameter;
-
+    // MAIN EVALUATION LOOP: Wait until each process has finished or timed out.
+    // Children are reaped in the order they finish so their runtimes are exact.
+    for (int reaped = 0; reaped < curr_batch_size; reaped++) {
         int status;
 
         // TODO: What if waitpid is interrupted by a signal?
         // TODO: ERROR CHECK WAITPID
         pid_t pid;
+        long long reap_start = trace_begin();
         do {
-            pid = waitpid(pids[j], &status, 0);
+            pid = waitpid(-1, &status, 0);
             if (pid == -1 && errno != EINTR) {
                 perror("waitpid failed");
                 exit(EXIT_FAILURE);
             }
         } while (pid == -1 && errno == EINTR);
+        trace_end("reap", "worker", reap_start, 0, NULL);
+
+        int j = 0;
+        while (j < curr_batch_size && pids[j] != pid) {
+            j++;
+        }
+        if (j == curr_batch_size) {
+            reaped--;  // Not a child of this batch
+            continue;
+        }
+        exit_ms[j] = monotonic_ms();
+        char *current_exe_path = pair_path(finished + j);
+        char *current_param = pairs[finished + j].parameter;
+        trace_pair("run", "child", launch_us[j], pid, current_exe_path, current_param);
+        long long classify_start = trace_begin();
 
         int exited = WIFEXITED(status);
         int signaled = WIFSIGNALED(status);
@@ -124,83 +268,189 @@ void monitor_and_evaluate_solutions(int finished) {
         //       instead of `results`.
         int final_status;
         if (signaled) {
-            if (WTERMSIG(status) == SIGSEGV) {
-                final_status = SEGFAULT;
-            } else {
-                final_status = STUCK_OR_INFINITE;
-            }
+            final_status = get_signal_status(WTERMSIG(status));
         } else if (exited) {
-            char *executable_name = get_exe_name(current_exe_path);
-            int length_output_path = strlen("output/") + strlen(executable_name) + MAX_INT_CHARS + 2;  // +2 for the null terminator and the dot
-            char *output_path =  (char *) malloc(length_output_path);    // +2 for the null terminator and the dot
-            if (output_path == NULL) {
-                fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-                exit(EXIT_FAILURE);
-            }
-            snprintf(output_path, length_output_path, "output/%s.%d", executable_name, current_param);
+            char *output_path = output_paths[j];
+            snprintf(output_path, PATH_MAX, "output/%s.%s", get_exe_name(current_exe_path), current_param);
 
             int fd;
             if ((fd = open(output_path, O_RDONLY)) == -1) {
-                free(output_path);
-                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 3);
+                fprintf(stderr, "Error occured at line %d: open failed\n", __LINE__ - 1);
                 exit(EXIT_FAILURE);
             }
-            free(output_path);
 
-            int bytes_read;
-            char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
-            if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
-                perror("Read Failed");
-                exit(EXIT_FAILURE);
+            if (oracle.dir != NULL) {
+                final_status = oracle_compare_fd(&oracle, current_param, fd);
+            } else {
+                int bytes_read;
+                char output[MAX_INT_CHARS + 1];  // +1 for the null terminator
+                if ((bytes_read = read(fd, output, MAX_INT_CHARS)) == -1) {
+                    perror("Read Failed");
+                    exit(EXIT_FAILURE);
+                }
+                output[bytes_read] = '\0';
+                final_status = get_output_status(output);
             }
             if (close(fd) == -1) {
                 perror("close failed");
                 exit(EXIT_FAILURE);
             }
-            output[bytes_read] = '\0';
-            if (atoi(output) == 0) {
-                final_status = CORRECT;
-            } else if (atoi(output) == 1) {
-                final_status = INCORRECT;
-            } else {
-                perror("Invalid output");
-                exit(EXIT_FAILURE);
-            }
         }
         pairs[finished + j].status = final_status;
+        trace_pair("classify", "worker", classify_start, 0, current_exe_path, current_param);
 
         // Mark the process as finished
         child_status[j] = -1;
     }
+}
+
+
+// Same as monitor_and_evaluate_solutions(), supervised through io_uring (see
+// uring_engine.h). Output files are left for mq_autograder to remove, unless
+// mq_autograder is remote.
+void uring_monitor_and_evaluate_solutions(int finished) {
+    for (int j = 0; j < curr_batch_size; j++) {
+        snprintf(output_paths[j], PATH_MAX, "output/%s.%s", get_exe_name(pair_path(finished + j)), pairs[finished + j].parameter);
+    }
+
+    long long trace_start = trace_begin();
+    uring_monitor_batch(pids, output_paths, curr_batch_size, TIMEOUT_SECS,
+                        transport.type == TRANSPORT_SOCKET, batch_statuses, exit_ms);
+    trace_end("uring batch", "worker", trace_start, 0, NULL);
+
+    for (int j = 0; j < curr_batch_size; j++) {
+        pairs[finished + j].status = batch_statuses[j];
+    }
+}
+
+
+// Allocate the per-batch arrays for up to max_children children at once
+void alloc_batch_scratch(int max_children) {
+    pids = (pid_t *) malloc(max_children * sizeof(pid_t));
+    child_status = (int *) malloc(max_children * sizeof(int));
+    start_ms = (long long *) malloc(max_children * sizeof(long long));
+    exit_ms = (long long *) malloc(max_children * sizeof(long long));
+    launch_us = (long long *) malloc(max_children * sizeof(long long));
+    batch_statuses = (int *) malloc(max_children * sizeof(int));
+    output_paths = (char **) malloc(max_children * sizeof(char *));
+    stderr_fds = (int *) malloc(max_children * sizeof(int));
+    char *path_block = (char *) malloc((size_t) max_children * PATH_MAX);
+    if (pids == NULL || child_status == NULL || start_ms == NULL || exit_ms == NULL || launch_us == NULL ||
+        batch_statuses == NULL || output_paths == NULL || stderr_fds == NULL || path_block == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 3);
+        exit(EXIT_FAILURE);
+    }
+    for (int j = 0; j < max_children; j++) {
+        output_paths[j] = path_block + (size_t) j * PATH_MAX;
+        stderr_fds[j] = capture_create_fd(&capture);
+    }
+    scratch_size = max_children;
+}
 
+
+void free_batch_scratch() {
+    for (int j = 0; j < scratch_size; j++) {
+        if (stderr_fds[j] != -1) {
+            close(stderr_fds[j]);
+        }
+    }
+    free(stderr_fds);
+    free(pids);
     free(child_status);
+    free(start_ms);
+    free(exit_ms);
+    free(launch_us);
+    free(batch_statuses);
+    free(output_paths[0]);
+    free(output_paths);
+}
+
+
+// Remove the output files of the current batch. Only needed for remote workers;
+// mq_autograder removes local workers' output files at the end.
+void remove_batch_outputs(int finished) {
+    for (int j = 0; j < curr_batch_size; j++) {
+        char output_path[PATH_MAX];
+        snprintf(output_path, PATH_MAX, "output/%s.%s", get_exe_name(pair_path(finished + j)), pairs[finished + j].parameter);
+        if (unlink(output_path) == -1 && errno != ENOENT) {
+            perror("Failed to remove output file");
+        }
+    }
+}
+
+
+// Report the batch starting at pairs[finished] to the controller and note runtimes
+void end_batch(int finished) {
+    int timed_out = 0, expected_timeouts = 0;
+    for (int j = 0; j < curr_batch_size; j++) {
+        pairs[finished + j].runtime_ms = exit_ms[j] - start_ms[j];
+        failfast_record(&exe_entries[pairs[finished + j].exe_index].failfast, pairs[finished + j].status, total_params, &options);
+        capture_collect(&capture, stderr_fds[j], pair_path(finished + j), pairs[finished + j].parameter);
+        if (pairs[finished + j].status == STUCK_OR_INFINITE) {
+            timed_out++;
+            expected_timeouts += pairs[finished + j].expected_timeout;
+        }
+    }
+    host_pool_release(&host_pool, curr_batch_size);
+    concurrency_end_batch(&controller, curr_batch_size, timed_out, expected_timeouts);
+}
+
+
+// Move the pairs of executables the fail-fast policy gave up on to the front of
+// pairs[first..], keeping the order otherwise, and mark them SKIPPED. Returns
+// how many were moved.
+int skip_stopped_pairs(int first, int pairs_to_test) {
+    if (options.stop_after == 0 && options.min_score == 0) {
+        return 0;
+    }
+    pairs_t *kept = (pairs_t *) malloc((pairs_to_test - first) * sizeof(pairs_t));
+    if (kept == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int skipped = 0, num_kept = 0;
+    for (int k = first; k < pairs_to_test; k++) {
+        if (exe_entries[pairs[k].exe_index].failfast.stopped) {
+            pairs[k].status = SKIPPED;
+            pairs[k].runtime_ms = 0;
+            pairs[first + skipped++] = pairs[k];
+        } else {
+            kept[num_kept++] = pairs[k];
+        }
+    }
+    memcpy(&pairs[first + skipped], kept, num_kept * sizeof(pairs_t));
+    free(kept);
+    return skipped;
 }
 
 
 // Send results for the current batch back to the autograder
-void send_results(int msqid, long mtype, int finished) {
-    // Format of message should be ("%s %d %d", executable_path, parameter, status)
+void send_results(long mtype, int finished) {
+    // Format of message should be ("%s %d %d %lld", executable_path, parameter index, status, runtime_ms)
     msgbuf_t msg;
     memset(&msg, 0, sizeof(msgbuf_t));
     msg.mtype = mtype;
+    long long trace_start = trace_begin();
     for (int i = 0; i < curr_batch_size; ++i) {
-        snprintf(msg.mtext, MESSAGE_SIZE, "%s %d %d", pairs[finished + i].executable_path, pairs[finished + i].parameter, pairs[finished + i].status);
-        if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
+        snprintf(msg.mtext, MESSAGE_SIZE, "%s %d %d %lld", pair_path(finished + i), pairs[finished + i].param_idx,
+                 pairs[finished + i].status, pairs[finished + i].runtime_ms);
+        if (transport_send(&transport, &msg) == -1) {
             perror("Failed to send results to autograder");
             exit(EXIT_FAILURE);
         }
     }
+    trace_end("send results", "worker", trace_start, 0, NULL);
 }
 
 
 // Send DONE message to autograder to indicate that the worker has finished testing
-void send_done_msg(int msqid, long mtype) {
+void send_done_msg(long mtype) {
     msgbuf_t msg;
     memset(&msg, 0, sizeof(msgbuf_t));
     msg.mtype = mtype;
     snprintf(msg.mtext, MESSAGE_SIZE, "DONE");
-    printf("Worker %ld sending DONE\n", mtype);
-    if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
+    log_info("done_sent", "worker=%ld", mtype);
+    if (transport_send(&transport, &msg) == -1) {
         perror("Failed to send DONE message to autograder");
         exit(EXIT_FAILURE);
     }
@@ -208,94 +458,190 @@ void send_done_msg(int msqid, long mtype) {
 
 
 int main(int argc, char **argv) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <msqid> <worker_id>\n", argv[0]);
+    int first_arg = parse_grader_options(argc, argv, &options);
+    if (options.connect_address != NULL) {
+        // Remote worker: mq_autograder assigns the worker id
+        batch_size = options.capacity > 0 ? options.capacity : DEFAULT_CAPACITY;
+        worker_id = transport_connect(&transport, options.connect_address, batch_size);
+        if (mkdir("output", 0755) == -1 && errno != EEXIST) {
+            perror("Failed to create output directory");
+            exit(EXIT_FAILURE);
+        }
+    } else if (argc - first_arg < 2) {
+        fprintf(stderr, "Usage: %s [--engine=uring] <msqid|channel> <worker_id>\n"
+                        "       %s [--engine=uring] [--capacity=N] --connect=ADDR\n", argv[0], argv[0]);
         return 1;
+    } else {
+        // Local worker: channel is the one transport_prepare_worker() handed over
+        worker_id = atoi(argv[first_arg + 1]);
+        transport_attach(&transport, argv[first_arg], worker_id);
+        // mq_autograder passes its share of MAX_CONCURRENCY_FACTOR children per processor
+        batch_size = options.capacity > 0 ? options.capacity : MAX_CONCURRENCY_FACTOR * get_batch_size();
     }
-
-    int msqid = atoi(argv[1]);
-    worker_id = atoi(argv[2]);
-    printf("Worker %ld started\n", worker_id);
+    char process_name[32];
+    snprintf(process_name, sizeof(process_name), "worker %ld", worker_id);
+    log_open(options.log_path, options.log_level, process_name);
+    log_info("worker_started", "worker=%ld", worker_id);
+    trace_open(options.trace_path, process_name);
 
     // TODO: Receive initial message from autograder specifying the number of (executable, parameter) 
     // pairs that the worker will test (should just be an integer in the message body). (mtype = worker_id)
     msgbuf_t msg;
     memset(&msg, 0, sizeof(msgbuf_t));
-    if (msgrcv(msqid, &msg, sizeof(msg), worker_id, 0) == -1) {
+    if (transport_recv(&transport, &msg, worker_id, 0) == -1) {
         perror("Failed to receive message from autograder");
         exit(EXIT_FAILURE);
     }
 
     // TODO: Parse message and set up pairs_t array
-    int pairs_to_test = atoi(msg.mtext);
+    // ("%d %d", pairs_to_test, total_params)
+    int pairs_to_test = 0;
+    total_params = 0;
+    sscanf(msg.mtext, "%d %d", &pairs_to_test, &total_params);
     pairs = (pairs_t *) malloc(pairs_to_test * sizeof(pairs_t));
-    if (pairs == NULL) {
+    param_names = (char **) calloc(total_params, sizeof(char *));
+    if (pairs == NULL || param_names == NULL) {
         fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < pairs_to_test; i++) {
-        pairs[i].executable_path = (char *) malloc(PATH_MAX);
-        if (pairs[i].executable_path == NULL) {
-            fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
-            exit(EXIT_FAILURE);
-        }
-    }
+    raise_open_file_limit();
+    exe_table_init(&executables);
 
     // TODO: Receive (executable, parameter) pairs from autograder and store them in pairs_t array.
-    //       Messages will have the format ("%s %d", executable_path, parameter). (mtype = worker_id)
+    //       Messages will have the format ("%s %d %s %d", executable_path, parameter index, parameter,
+    //       expected_timeout) (mtype = worker_id). Parameters may be any string and repeat (--params=@FILE),
+    //       so results go back by index. expected_timeout is 1 if the runtime history expects a timeout.
     for (int i = 0; i < pairs_to_test; i++) {
-        if (msgrcv(msqid, &msg, sizeof(msg), worker_id, 0) == -1) {
+        if (transport_recv(&transport, &msg, worker_id, 0) == -1) {
             perror("Failed to receive message from autograder");
             exit(EXIT_FAILURE);
         }
         char *executable_path = strtok(msg.mtext, " ");
-        int parameter = atoi(strtok(NULL, " "));
-        strcpy(pairs[i].executable_path, executable_path);
-        // pairs[i].executable_path = executable_path;
-        pairs[i].parameter = parameter;
-        printf("Worker %ld received: %s %d i: %d\n", worker_id, pairs[i].executable_path, pairs[i].parameter, i);
+        char *param_idx = strtok(NULL, " ");
+        char *parameter = strtok(NULL, " ");
+        char *expected_timeout = strtok(NULL, " ");
+        if (parameter == NULL || atoi(param_idx) < 0 || atoi(param_idx) >= total_params) {
+            fprintf(stderr, "Malformed pair from autograder\n");
+            exit(EXIT_FAILURE);
+        }
+        pairs[i].exe_index = exe_table_intern(&executables, executable_path);
+        pairs[i].param_idx = atoi(param_idx);
+        if (param_names[pairs[i].param_idx] == NULL && (param_names[pairs[i].param_idx] = strdup(parameter)) == NULL) {
+            fprintf(stderr, "Error occured at line %d: strdup failed\n", __LINE__ - 1);
+            exit(EXIT_FAILURE);
+        }
+        pairs[i].parameter = param_names[pairs[i].param_idx];
+        pairs[i].expected_timeout = expected_timeout != NULL && atoi(expected_timeout) == 1;
+        log_debug("pair_received", "worker=%ld index=%d exe=%s param=%s", worker_id, i, pair_path(i), pairs[i].parameter);
     }
 
+    // Open the executables only once every pair is in, so a remote worker's fetches
+    // don't interleave with pairs still being sent
+    open_executables();
+
+    // Map the expected outputs of this worker's parameters
+    char **param_strs = (char **) malloc(total_params * sizeof(char *));
+    if (param_strs == NULL) {
+        fprintf(stderr, "Error occured at line %d: malloc failed\n", __LINE__ - 2);
+        exit(EXIT_FAILURE);
+    }
+    int num_param_strs = 0;
+    for (int k = 0; k < total_params; k++) {
+        if (param_names[k] != NULL) {
+            param_strs[num_param_strs++] = param_names[k];
+        }
+    }
+    oracle_open(&oracle, options.expected_dir, options.ignore_whitespace, param_strs, num_param_strs);
+
     // TODO: Send ACK message to mq_autograder after all pairs received (mtype = BROADCAST_MTYPE)
+    long long handshake_start = trace_begin();
     msg.mtype = BROADCAST_MTYPE + 1;
     snprintf(msg.mtext, MESSAGE_SIZE, "ACK");
-    printf("Sending ACK to autograder\n");
-    printf("Worker %ld sending ACK\n", worker_id);
-    if (msgsnd(msqid, &msg, sizeof(msg), 0) == -1) {
+    log_info("ack_sent", "worker=%ld pairs=%d", worker_id, pairs_to_test);
+    if (transport_send(&transport, &msg) == -1) {
         perror("Failed to send message to autograder");
         exit(EXIT_FAILURE);
     }
-    printf("Pairs[%d].executable_path: %s\n", 0, pairs[0].executable_path);
     // TODO: Wait for SYNACK from autograder to start testing (mtype = BROADCAST_MTYPE).
     //       Be careful to account for the possibility of receiving ACK messages just sent.
     int received = 0;
-    printf("Waiting for SYNACK\n");
     while (received < 1) {
-        if (msgrcv(msqid, &msg, sizeof(msg), BROADCAST_MTYPE, 0) == -1) {
+        if (transport_recv(&transport, &msg, BROADCAST_MTYPE, 0) == -1) {
             perror("Failed to receive message from autograder");
             exit(EXIT_FAILURE);
         }
         if (strcmp(msg.mtext, "SYNACK") == 0) {
             received++;
         }
-        printf("msg.mtext: %s\n", msg.mtext);
-        printf("worker %ld received: %d / 1\n", worker_id, received);
+        log_debug("handshake_message", "worker=%ld text=%s", worker_id, msg.mtext);
+    }
+    log_info("synack_received", "worker=%ld", worker_id);
+    trace_end("handshake", "worker", handshake_start, 0, NULL);
+
+    // With --pin, this worker and its children share one core or L3 domain
+    cpu_set_t *cpu_domains;
+    int num_cpu_domains = get_cpu_domains(options.pin, &cpu_domains);
+    pin_to_cpu_domain(cpu_domains, num_cpu_domains, worker_id - 1);
+    free(cpu_domains);
+
+    // Local workers start at one child each (there is one worker per processor) and
+    // remote workers at their capacity; both adapt from there unless fixed
+    if (options.concurrency > 0) {
+        concurrency_init(&controller, options.concurrency, options.concurrency, 1);
+    } else {
+        concurrency_init(&controller, transport.type == TRANSPORT_SOCKET ? batch_size : 1, batch_size, 0);
+    }
+
+    // Local workers append to the file mq_autograder started, remote ones keep their own
+    capture_open(&capture, options.stderr_path, options.stderr_keep, options.stderr_budget, transport.type == TRANSPORT_SOCKET);
+    // A remote worker is a grader of its own host
+    host_pool_open(&host_pool, options.host_pool && options.concurrency == 0, options.host_slots,
+                   transport.type == TRANSPORT_SOCKET, options.host_pool_split);
+    alloc_batch_scratch(controller.max_limit);
+
+    // The io_uring engine only reads the first bytes of each output ("0" / "1")
+    if (options.use_uring && oracle.dir != NULL) {
+        options.use_uring = 0;
+    }
+    if (options.use_uring && uring_engine_init(controller.max_limit) == -1) {
+        fprintf(stderr, "io_uring engine unavailable, falling back to the classic engine\n");
+        options.use_uring = 0;
     }
-    printf("Received SYNACK\n");
-    // Run the pairs in batches of 8 and send results back to autograder
-    for (int i = 0; i < pairs_to_test; i+= PAIRS_BATCH_SIZE) {
+
+    // Run the pairs in batches of controller.limit and send results back to autograder
+    for (int i = 0; i < pairs_to_test; i += curr_batch_size) {
+        // Report the pairs the fail-fast policy gave up on without running them
+        int skipped = skip_stopped_pairs(i, pairs_to_test);
+        if (skipped > 0) {
+            curr_batch_size = skipped;
+            send_results(worker_id, i);
+            continue;
+        }
+
         int remaining = pairs_to_test - i;
-        curr_batch_size = remaining < PAIRS_BATCH_SIZE ? remaining : PAIRS_BATCH_SIZE;
-        pids = (pid_t *) malloc(curr_batch_size * sizeof(pid_t));
+        curr_batch_size = remaining < controller.limit ? remaining : controller.limit;
+        // One host slot per child, within this worker's part of its grader's share
+        curr_batch_size = host_pool_acquire(&host_pool, curr_batch_size);
 
+        concurrency_begin_batch(&controller);
         for (int j = 0; j < curr_batch_size; j++) {
             // TODO: Execute the student executable
-            printf("i + j: %d\n", i + j);
-            printf("executable_path: %s\n", pairs[i + j].executable_path);
-            printf("parameter: %d\n", pairs[i + j].parameter);
-            execute_solution(pairs[i + j].executable_path, pairs[i + j].parameter, j);
+            log_debug("pair_launch", "worker=%ld index=%d exe=%s param=%s", worker_id, i + j, pair_path(i + j), pairs[i + j].parameter);
+            execute_solution(pair_path(i + j), exe_entries[pairs[i + j].exe_index].exe_fd, pairs[i + j].parameter, j);
+        }
+
+        // Warm the page cache for the next batch while this one runs
+        for (int j = i + curr_batch_size; j < pairs_to_test && j < i + curr_batch_size + controller.limit; j++) {
+            prefetch_executable(exe_entries[pairs[j].exe_index].exe_fd);
+        }
+        log_debug("batch_launched", "worker=%ld first=%d size=%d", worker_id, i, curr_batch_size);
+
+        if (options.use_uring) {
+            uring_monitor_and_evaluate_solutions(i);
+            end_batch(i);
+            send_results(worker_id, i);
+            continue;
         }
-        printf("Executed batch %d\n", i);
         // TODO: Setup timer to determine if child process is stuck
         start_timer(TIMEOUT_SECS, timeout_handler);  // Implement this function (src/utils.c)
 
@@ -307,19 +653,42 @@ int main(int argc, char **argv) {
             cancel_timer();
         }
 
-        // TODO: Send batch results (intermediate results) back to autograder
-        send_results(msqid, worker_id, i);
+        if (transport.type == TRANSPORT_SOCKET) {
+            remove_batch_outputs(i);
+        }
+        end_batch(i);
 
-        free(pids);
+        // TODO: Send batch results (intermediate results) back to autograder
+        send_results(worker_id, i);
     }
 
+    uring_engine_cleanup();
+    concurrency_cleanup(&controller);
+
     // TODO: Send DONE message to autograder to indicate that the worker has finished testing
-    send_done_msg(msqid, worker_id);
+    send_done_msg(worker_id);
+    if (transport.type == TRANSPORT_SOCKET) {
+        transport_close(&transport);
+    }
+    trace_save_part();
 
-    // Free the pairs_t array
-    for (int i = 0; i < pairs_to_test; i++) {
-        free(pairs[i].executable_path);
+    // Close the executables and free the pairs_t array
+    for (int i = 0; i < executables.num_executables; i++) {
+        if (exe_entries[i].exe_fd != -1) {
+            close(exe_entries[i].exe_fd);
+        }
     }
+    free(exe_entries);
+    exe_table_free(&executables);
+    free_batch_scratch();
+    oracle_close(&oracle);
+    capture_close(&capture);
+    host_pool_close(&host_pool);
     free(pairs);
+    free(param_strs);
+    for (int k = 0; k < total_params; k++) {
+        free(param_names[k]);
+    }
+    free(param_names);
 
 }